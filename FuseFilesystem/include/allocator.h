@@ -0,0 +1,78 @@
+#ifndef ALLOCATOR_H
+#define ALLOCATOR_H
+
+#include <stdint.h>
+
+#define NO_BLOCK_HINT 0xFFFFFFFF
+
+// Policies for choosing which free blocks to hand out.
+typedef enum alloc_policy {
+    ALLOC_FIRST_FIT, // Lowest numbered free blocks
+    ALLOC_NEXT_FIT,  // Free blocks following the hint (the file's tail), wrapping around
+    ALLOC_BEST_FIT   // Smallest free run that holds the whole request, else next fit
+} alloc_policy_t;
+
+// int allocate_blocks(uint32_t, uint32_t, uint32_t*)
+// Description: Reserves free user data blocks using the current allocation policy.
+// Preconditions: Free map is built. Hint is the block the new blocks will follow, or NO_BLOCK_HINT.
+// Postconditions: Blocks are marked in use in the free map, or nothing changes on failure.
+// Returns: 0 on success, -ENOSPC if fewer than count blocks are free.
+int allocate_blocks(uint32_t count, uint32_t hint, uint32_t* blocks);
+
+// int allocate_run(uint32_t, uint32_t*)
+// Description: Reserves a contiguous run of free user data blocks, best fit.
+// Preconditions: Free map is built.
+// Postconditions: Run is marked in use in the free map, or nothing changes on failure.
+// Returns: 0 on success, -ENOSPC if no free run is long enough.
+int allocate_run(uint32_t count, uint32_t* first_block);
+
+// int build_free_map()
+// Description: Sizes and rebuilds the free block bitmap and free count from the main FAT.
+// Preconditions: Geometry is read. Main FAT is loaded into memory.
+// Postconditions: Every free FAT entry backed by a user data block is marked free.
+// Returns: 0 on success, -ENOMEM on failure.
+int build_free_map();
+
+// void free_chain(uint32_t)
+// Description: Releases every block in a FAT chain.
+// Preconditions: Block starts a chain, or is FAT_END_OF_CHAIN for an empty chain.
+// Postconditions: Chain's FAT entries are cleared and its blocks are marked free.
+// Returns: None.
+void free_chain(uint32_t first_block);
+
+// uint32_t free_block_count()
+// Description: Gets the number of free user data blocks.
+// Preconditions: Free map is built.
+// Postconditions: None.
+// Returns: Number of free blocks.
+uint32_t free_block_count();
+
+// uint32_t get_fat_entry(uint32_t)
+// Description: Reads an entry of the main FAT.
+// Preconditions: Index is a valid FAT index.
+// Postconditions: None.
+// Returns: FAT entry value.
+uint32_t get_fat_entry(uint32_t index);
+
+// int set_alloc_policy(const char*)
+// Description: Selects the allocation policy by name ("first", "next" or "best").
+// Preconditions: None.
+// Postconditions: Later allocations use the named policy.
+// Returns: 0 on success, -EINVAL for an unknown name.
+int set_alloc_policy(const char* name);
+
+// void set_fat_entry(uint32_t, uint32_t)
+// Description: Sets an entry in the FAT.
+// Preconditions: Index is a valid FAT index.
+// Postconditions: FAT holds the value and both on-disk copies are marked dirty.
+// Returns: None.
+void set_fat_entry(uint32_t index, uint32_t value);
+
+// void snapshot_fat(uint32_t, uint32_t, void*)
+// Description: Copies a range of FAT entries in the on-disk format for writeback.
+// Preconditions: Output holds num_entries entries of the on-disk entry size.
+// Postconditions: Output holds a consistent copy of the entries that exist.
+// Returns: None.
+void snapshot_fat(uint32_t first_index, uint32_t num_entries, void* out);
+
+#endif // ALLOCATOR_H
\ No newline at end of file
@@ -0,0 +1,107 @@
+#ifndef BLOCK_CACHE_H
+#define BLOCK_CACHE_H
+
+#include <stdint.h>
+
+#include "memefs_ioctl.h"
+
+// What a pinned block will be used for.
+typedef enum pin_mode {
+    PIN_READ,        // Data is only read
+    PIN_READ_NOWAIT, // Data is only read, and the caller already holds other pins, so fail rather than wait for a frame
+    PIN_WRITE,       // Part of the data is changed, the rest must come from the image
+    PIN_OVERWRITE    // Every byte is written, so the image copy is never read
+} pin_mode_t;
+
+// int finish_block_writeback(uint32_t, int)
+// Description: Releases a block pinned by pin_for_writeback.
+// Preconditions: Block was pinned by pin_for_writeback.
+// Postconditions: Block is unpinned, and may be evicted without another write if written is set.
+// Returns: None.
+void finish_block_writeback(uint32_t data_block, int written);
+
+// void get_cache_stats(memefs_cache_stats_t*)
+// Description: Copies the block cache counters.
+// Preconditions: None.
+// Postconditions: Stats hold the counters as of the call.
+// Returns: None.
+void get_cache_stats(memefs_cache_stats_t* out);
+
+// int init_block_cache()
+// Description: Empties the cache and sizes it for the image and memory budget.
+// Preconditions: Geometry is read. use_mmap is set. No other thread is running.
+// Postconditions: Cache holds no blocks.
+// Returns: 0 on success, -ENOMEM on failure.
+int init_block_cache();
+
+// const uint8_t* peek_block(uint32_t)
+// Description: Gets the memory holding a block without pinning it.
+// Preconditions: Caller holds a pin on the block.
+// Postconditions: None.
+// Returns: Block data, or NULL if the block is not in the cache.
+const uint8_t* peek_block(uint32_t data_block);
+
+// int pin_block(uint32_t, pin_mode_t, uint8_t**)
+// Description: Gets a user data block in memory, reading it from the image on a miss, and holds it there.
+// Preconditions: File owning the block is locked, for writing unless mode is PIN_READ or PIN_READ_NOWAIT.
+// Postconditions: data points at the block until unpin_block. Frame counts as modified unless mode is a read.
+// Returns: 0 on success, -EAGAIN if mode is PIN_READ_NOWAIT and every frame is pinned, -EIO on failure.
+int pin_block(uint32_t data_block, pin_mode_t mode, uint8_t** data);
+
+// int pin_for_writeback(uint32_t)
+// Description: Holds a block in memory while writeback writes it home.
+// Preconditions: Block was claimed from the dirty map.
+// Postconditions: Block is pinned if it was in memory.
+// Returns: 0 if pinned, -ENOENT if the block was evicted (and so already written).
+int pin_for_writeback(uint32_t data_block);
+
+// void prefetch_blocks(const uint32_t*, uint32_t, uint32_t, uint32_t, uint32_t)
+// Description: Reads missing blocks of a range of a file's chain, and ahead more past it, in runs of adjacent blocks.
+// Preconditions: Chain is the file's block map. File is locked.
+// Postconditions: Blocks are in memory unless the cache ran out of free frames. Failures are left for pin_block to report.
+// Returns: None.
+void prefetch_blocks(const uint32_t* chain, uint32_t chain_length, uint32_t first, uint32_t count, uint32_t ahead);
+
+// int preload_block_cache()
+// Description: Reads the whole user data region at mount, unless loading is lazy or it doesn't fit the budget.
+// Preconditions: Cache is initialized and empty.
+// Postconditions: Every user data block is in memory if it was preloaded.
+// Returns: 0 on success, -1 on failure.
+int preload_block_cache();
+
+// uint32_t readahead_window(uint32_t)
+// Description: Gets how far past a fault to read, growing with the number of sequential reads leading up to it.
+// Preconditions: None.
+// Postconditions: None.
+// Returns: The readahead setting for 0 sequential reads, doubling per read up to MAX_READAHEAD_SHIFT times.
+uint32_t readahead_window(uint32_t sequential_run);
+
+// void set_cache_size(uint64_t)
+// Description: Sets the memory budget for cached user data, 0 for the whole data region.
+// Preconditions: Image is not loaded yet.
+// Postconditions: Next load_image sizes the cache to the budget.
+// Returns: None.
+void set_cache_size(uint64_t bytes);
+
+// void set_lazy_loading(int)
+// Description: Turns loading user data on first access on or off.
+// Preconditions: Image is not loaded yet.
+// Postconditions: Next load_image follows the setting.
+// Returns: None.
+void set_lazy_loading(int enabled);
+
+// void set_readahead(uint32_t)
+// Description: Sets how many blocks further along a chain are read with each fault.
+// Preconditions: None.
+// Postconditions: Later faults read ahead by that many blocks, more while a file is read sequentially. 0 disables readahead.
+// Returns: None.
+void set_readahead(uint32_t num_blocks);
+
+// void unpin_block(uint32_t)
+// Description: Releases a block pinned by pin_block.
+// Preconditions: Caller holds a pin on the block.
+// Postconditions: Block may be evicted once nothing else pins it.
+// Returns: None.
+void unpin_block(uint32_t data_block);
+
+#endif // BLOCK_CACHE_H
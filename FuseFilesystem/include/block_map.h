@@ -0,0 +1,41 @@
+#ifndef BLOCK_MAP_H
+#define BLOCK_MAP_H
+
+#include <stdint.h>
+
+// void block_map_append(int, uint32_t)
+// Description: Records a block newly linked onto the end of a file's FAT chain.
+// Preconditions: Block has been linked as the new tail of the chain. File is locked for writing.
+// Postconditions: Cached block map includes the block if the map was built.
+// Returns: None.
+void block_map_append(int entry_index, uint32_t block);
+
+// int block_map_tail(int)
+// Description: Finds the last block in a file's FAT chain.
+// Preconditions: Entry is in use.
+// Postconditions: Block map is built if it was not cached.
+// Returns: Last block number on success, < 0 on failure.
+int block_map_tail(int entry_index);
+
+// const uint32_t* get_block_map(int, uint32_t*)
+// Description: Gets the ordered list of blocks in a file's FAT chain.
+// Preconditions: Entry is in use. File is locked.
+// Postconditions: Block map is built from the main FAT if it was not cached.
+// Returns: Array of block numbers on success, NULL on failure.
+const uint32_t* get_block_map(int entry_index, uint32_t* num_blocks);
+
+// int init_block_maps()
+// Description: Drops every cached block map and sizes the cache for the directory.
+// Preconditions: Geometry is read. No other thread is running.
+// Postconditions: Every file's block map is built fresh on next access.
+// Returns: 0 on success, -ENOMEM on failure.
+int init_block_maps();
+
+// void invalidate_block_map(int)
+// Description: Drops the cached block map for a file.
+// Preconditions: File is locked for writing, or the namespace is.
+// Postconditions: Next access rebuilds the map from the main FAT.
+// Returns: None.
+void invalidate_block_map(int entry_index);
+
+#endif // BLOCK_MAP_H
\ No newline at end of file
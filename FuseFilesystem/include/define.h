@@ -8,6 +8,10 @@
 #define FAT_MAIN_BEGIN 254
 #define FILE_ENTRY_SIZE 32
 #define FUSE_USE_VERSION 35
+#define IMAGE_NUM_BLOCKS 256
+#define JOURNAL_BEGIN 1
+#define JOURNAL_NUM_BLOCKS 18
+#define MAX(a, b) (((a) > (b)) ? (a) : (b))
 #define MAX_ENCODED_FILENAME_LENGTH 11
 #define MAX_FAT_ENTRIES 256
 #define MAX_FILE_ENTRIES 224
@@ -0,0 +1,20 @@
+#ifndef DEFRAG_H
+#define DEFRAG_H
+
+#include <stdint.h>
+
+// int defragment_all(uint32_t*)
+// Description: Rewrites every fragmented file into a contiguous run where one is free.
+// Preconditions: Filesystem image is loaded into memory.
+// Postconditions: Moved files occupy contiguous runs, their old blocks are free.
+// Returns: 0 on success, < 0 on failure.
+int defragment_all(uint32_t* files_moved);
+
+// int defragment_file(int)
+// Description: Rewrites a fragmented file's FAT chain into a contiguous run.
+// Preconditions: Entry is in use.
+// Postconditions: Data is copied to the run, start_block points at it and the old chain is freed.
+// Returns: 1 if the file was moved, 0 if already contiguous, -ENOSPC if no run is free, < 0 on failure.
+int defragment_file(int entry_index);
+
+#endif // DEFRAG_H
\ No newline at end of file
@@ -0,0 +1,81 @@
+#ifndef DIR_INDEX_H
+#define DIR_INDEX_H
+
+#include <stdint.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#include "memefs_file_entry.h"
+
+// int build_dir_index()
+// Description: Sizes and builds the in-memory name index over the directory.
+// Preconditions: Geometry is read. Directory is loaded into memory.
+// Postconditions: Every in-use entry with a legal name is indexed.
+// Returns: 0 on success, -ENOMEM on failure.
+int build_dir_index();
+
+// const struct stat* dir_index_attrs(int)
+// Description: Gets a file's attributes, decoded from its directory entry when it was last changed.
+//              st_ino is left 0, the inode number is file_ops' to give.
+// Preconditions: Entry is indexed. Namespace lock is held, and the file's lock for reading.
+// Postconditions: None.
+// Returns: Attributes of the file.
+const struct stat* dir_index_attrs(int entry_index);
+
+// uint32_t dir_index_generation(int)
+// Description: Gets how many times a directory entry has been given to a new file since mount.
+// Preconditions: Namespace lock is held.
+// Postconditions: None.
+// Returns: Generation of the entry.
+uint32_t dir_index_generation(int entry_index);
+
+// void dir_index_insert(int)
+// Description: Adds a directory entry to the name index.
+// Preconditions: Entry is in use and holds a legal name.
+// Postconditions: Entry can be found by its name.
+// Returns: None.
+void dir_index_insert(int entry_index);
+
+// int dir_index_lookup(const char*)
+// Description: Finds the directory entry holding a memefs encoded filename.
+// Preconditions: Encoded filename is MAX_ENCODED_FILENAME_LENGTH bytes.
+// Postconditions: None.
+// Returns: Directory entry index on success, -1 if not found.
+int dir_index_lookup(const char* encoded_name);
+
+// const char* dir_index_name(int)
+// Description: Gets the readable name of an indexed directory entry.
+// Preconditions: Namespace lock is held.
+// Postconditions: None.
+// Returns: Readable filename, or NULL if the entry is not indexed.
+const char* dir_index_name(int entry_index);
+
+// int dir_index_next(int)
+// Description: Finds the first indexed directory entry at or after another.
+// Preconditions: Namespace lock is held.
+// Postconditions: None.
+// Returns: Directory entry index, or -1 if there are no more.
+int dir_index_next(int from_entry);
+
+// void dir_index_remove(int)
+// Description: Removes a directory entry from the name index.
+// Preconditions: None.
+// Postconditions: Entry can no longer be found by name.
+// Returns: None.
+void dir_index_remove(int entry_index);
+
+// void dir_index_touch(int, time_t)
+// Description: Updates an indexed file's attributes after its contents changed.
+// Preconditions: Entry is indexed. Namespace lock is held, and the file's lock for writing.
+// Postconditions: Attributes hold the entry's size and the new modification time.
+// Returns: None.
+void dir_index_touch(int entry_index, time_t mtime);
+
+// int lookup_file_entry(const char*)
+// Description: Finds the directory entry for a readable filename.
+// Preconditions: None.
+// Postconditions: None.
+// Returns: Directory entry index on success, -ENOENT if not found.
+int lookup_file_entry(const char* readable_name);
+
+#endif // DIR_INDEX_H
\ No newline at end of file
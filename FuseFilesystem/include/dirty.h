@@ -0,0 +1,135 @@
+#ifndef DIRTY_H
+#define DIRTY_H
+
+#include <stdint.h>
+
+#include "memefs_file_entry.h"
+
+#define DIRTY_WORD_BITS 64
+
+// Set of image blocks, e.g. those claimed for writeback.
+typedef struct dirty_set {
+    uint64_t* words;    // One bit per image block
+    uint32_t num_words; // Length of words
+} dirty_set_t;
+
+// void add_to_dirty_set(dirty_set_t*, uint32_t)
+// Description: Adds an image block to a set.
+// Preconditions: Set is initialized.
+// Postconditions: Set holds the block if it lies within the image.
+// Returns: None.
+void add_to_dirty_set(dirty_set_t* set, uint32_t image_block);
+
+// int claim_dirty_block(uint32_t)
+// Description: Atomically claims a single dirty block, e.g. one about to be evicted from the block cache.
+// Preconditions: None.
+// Postconditions: Block is marked clean.
+// Returns: 1 if the block was dirty, 0 otherwise.
+int claim_dirty_block(uint32_t image_block);
+
+// void clear_dirty_set(dirty_set_t*)
+// Description: Removes every block from a set.
+// Preconditions: Set is initialized.
+// Postconditions: Set is empty.
+// Returns: None.
+void clear_dirty_set(dirty_set_t* set);
+
+// uint32_t dirty_block_count()
+// Description: Gets the number of image blocks waiting for writeback.
+// Preconditions: None.
+// Postconditions: None.
+// Returns: Number of dirty blocks.
+uint32_t dirty_block_count();
+
+// void free_dirty_set(dirty_set_t*)
+// Description: Releases a set's memory.
+// Preconditions: Set was initialized, or zeroed.
+// Postconditions: Set is empty and holds no memory.
+// Returns: None.
+void free_dirty_set(dirty_set_t* set);
+
+// int init_dirty_blocks()
+// Description: Sizes the dirty map for the image and marks every block clean.
+// Preconditions: Geometry is read. No other thread is running.
+// Postconditions: Dirty map covers every image block.
+// Returns: 0 on success, -ENOMEM on failure.
+int init_dirty_blocks();
+
+// int init_dirty_set(dirty_set_t*)
+// Description: Allocates an empty set covering every image block.
+// Preconditions: Geometry is read.
+// Postconditions: Set is empty.
+// Returns: 0 on success, -ENOMEM on failure.
+int init_dirty_set(dirty_set_t* set);
+
+// void mark_block_dirty(uint32_t)
+// Description: Marks a block of the filesystem image as needing writeback.
+// Preconditions: None.
+// Postconditions: Block is marked dirty if it lies within the image.
+// Returns: None.
+void mark_block_dirty(uint32_t image_block);
+
+// void mark_data_dirty(uint32_t)
+// Description: Marks a user data block as needing writeback.
+// Preconditions: None.
+// Postconditions: User data block is marked dirty if it exists.
+// Returns: None.
+void mark_data_dirty(uint32_t data_block);
+
+// void mark_directory_dirty(const memefs_file_entry_t*)
+// Description: Marks the directory block holding a file entry as needing writeback.
+// Preconditions: File entry points into the directory.
+// Postconditions: Directory block holding the entry is marked dirty.
+// Returns: None.
+void mark_directory_dirty(const memefs_file_entry_t* file_entry);
+
+// void mark_fat_dirty(uint32_t)
+// Description: Marks the main and backup FAT blocks holding an entry as needing writeback.
+// Preconditions: None.
+// Postconditions: Both FAT blocks holding the entry are marked dirty.
+// Returns: None.
+void mark_fat_dirty(uint32_t fat_index);
+
+// void mark_superblock_dirty()
+// Description: Marks the main and backup superblocks as needing writeback.
+// Preconditions: None.
+// Postconditions: Both superblocks are marked dirty.
+// Returns: None.
+void mark_superblock_dirty();
+
+// int next_dirty_run(const dirty_set_t*, uint32_t, uint32_t*, uint32_t*)
+// Description: Finds the next run of adjacent blocks in a set at or after a block.
+// Preconditions: None.
+// Postconditions: run_start and run_length describe the run if one was found.
+// Returns: 1 if a run was found, 0 otherwise.
+int next_dirty_run(const dirty_set_t* set, uint32_t from_block, uint32_t* run_start, uint32_t* run_length);
+
+// void remove_from_dirty_set(dirty_set_t*, uint32_t)
+// Description: Removes an image block from a set.
+// Preconditions: Set is initialized.
+// Postconditions: Set does not hold the block.
+// Returns: None.
+void remove_from_dirty_set(dirty_set_t* set, uint32_t image_block);
+
+// void return_dirty_blocks(const dirty_set_t*)
+// Description: Marks a claimed set dirty again, e.g. after a failed write.
+// Preconditions: None.
+// Postconditions: Every block in the set is marked dirty.
+// Returns: None.
+void return_dirty_blocks(const dirty_set_t* set);
+
+// void take_dirty_blocks(dirty_set_t*)
+// Description: Atomically claims every dirty block for writeback.
+// Preconditions: Set is initialized.
+// Postconditions: Set holds the claimed blocks, which are marked clean. Blocks dirtied afterwards are marked again.
+// Returns: None.
+void take_dirty_blocks(dirty_set_t* set);
+
+// void take_dirty_subset(dirty_set_t*)
+// Description: Atomically claims the dirty blocks among those in a set.
+// Preconditions: Set holds the blocks of interest.
+// Postconditions: Set holds only the claimed blocks, which are marked clean.
+// Returns: None.
+void take_dirty_subset(dirty_set_t* set);
+
+#endif // DIRTY_H
\ No newline at end of file
@@ -0,0 +1,59 @@
+#ifndef EVENTS_H
+#define EVENTS_H
+
+#include <stdint.h>
+
+// Phases of an op timed on their own, nested inside the op's event.
+typedef enum event_phase {
+    PHASE_ALLOCATE,  // Taking blocks from the allocator
+    PHASE_COPY,      // Copying data between a request and the blocks
+    PHASE_JOURNAL,   // Writing a journal transaction
+    PHASE_LOOKUP,    // Looking a name up in the directory
+    PHASE_SYNC,      // Syncing the image
+    PHASE_WRITEBACK, // Writing claimed dirty blocks to the image
+    NUM_EVENT_PHASES
+} event_phase_t;
+
+// uint64_t event_begin()
+// Description: Marks the start of a phase.
+// Preconditions: None.
+// Postconditions: None.
+// Returns: Start time to pass to event_end, 0 if not recording.
+uint64_t event_begin();
+
+// void event_end(event_phase_t, uint64_t)
+// Description: Records a phase that started at event_begin in the calling thread's ring.
+// Preconditions: started came from event_begin.
+// Postconditions: Phase is recorded, if recording.
+// Returns: None.
+void event_end(event_phase_t phase, uint64_t started);
+
+// void record_op_event(const char*, uint64_t, uint64_t)
+// Description: Records an op in the calling thread's ring.
+// Preconditions: name is a string literal. started is from the monotonic clock, in nanoseconds.
+// Postconditions: Op is recorded, if recording.
+// Returns: None.
+void record_op_event(const char* name, uint64_t started, uint64_t latency);
+
+// int set_event_file(const char*)
+// Description: Starts recording events, to be written to a Chrome trace file on SIGUSR1.
+// Preconditions: No other thread is running.
+// Postconditions: Every thread keeps its latest events in its own ring from now on.
+// Returns: 0 on success, -1 on failure.
+int set_event_file(const char* path);
+
+// int start_events()
+// Description: Starts the thread that writes out the rings when SIGUSR1 arrives, if recording.
+// Preconditions: Process won't fork again.
+// Postconditions: SIGUSR1 dumps the events until stop_events.
+// Returns: 0 on success, -1 on failure.
+int start_events();
+
+// void stop_events()
+// Description: Stops the dump thread and recording.
+// Preconditions: None.
+// Postconditions: SIGUSR1 has its old action back. Later events are not recorded.
+// Returns: None.
+void stop_events();
+
+#endif // EVENTS_H
@@ -0,0 +1,204 @@
+#ifndef FILE_OPS_H
+#define FILE_OPS_H
+
+#include <stdint.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <sys/types.h>
+
+#include "define.h"
+
+#define ROOT_INODE 1 // Inode number of the root directory, FUSE_ROOT_ID.
+#define FIRST_DIR_OFFSET 2 // readdir offset of directory entry 0, after "." and "..".
+
+#define DEFAULT_ATTR_TIMEOUT 1.0     // Seconds the kernel may cache attributes, as libfuse defaults to.
+#define DEFAULT_ENTRY_TIMEOUT 1.0    // Seconds the kernel may cache a name lookup, as libfuse defaults to.
+#define DEFAULT_NEGATIVE_TIMEOUT 0.0 // Seconds the kernel may cache a failed lookup.
+
+// What memefs changed about a file on its own, outside any kernel request.
+#define CHANGED_ATTRS 0x1 // Size, times or ownership.
+#define CHANGED_DATA 0x2  // File contents, or the blocks holding them.
+#define CHANGED_NAME 0x4  // The name now refers to a different file, or to none.
+
+// Struct holding how long the kernel may cache what memefs tells it.
+typedef struct kernel_cache_config {
+    double attr_timeout;     // Seconds attributes stay valid.
+    double entry_timeout;    // Seconds a name lookup stays valid.
+    double negative_timeout; // Seconds a failed lookup stays valid, 0 to not cache it.
+    int kernel_cache;        // Keep file pages cached across opens.
+} kernel_cache_config_t;
+
+// Tells the kernel to drop what it cached about a file. Called without any memefs lock held.
+typedef void (*change_notifier_t)(uint64_t inode, const char* readable_name, int changes);
+
+// Struct held by an open file descriptor, so ops on it skip the name lookup.
+typedef struct open_file {
+    uint64_t inode;          // File the handle was opened on, which also names its directory entry.
+    uint64_t next_offset;    // Offset just past the last read, where a sequential reader goes next.
+    uint32_t sequential_run; // Reads in a row that each started at next_offset.
+} open_file_t;
+
+// Replies to a read with data that is only valid until it returns.
+typedef void (*data_sender_t)(void* context, struct fuse_bufvec* bufv);
+
+// Ops on a single entry take the namespace lock from the frontend, which found the entry under it,
+// and release it before committing the update.
+
+// int create_entry(const char*, struct stat*)
+// Description: Creates an empty file.
+// Preconditions: Namespace lock is not held.
+// Postconditions: File exists with one block, and stbuf describes it if not NULL.
+// Returns: Directory entry index on success, < 0 on failure.
+int create_entry(const char* readable_name, struct stat* stbuf);
+
+// int defragment_entry(int)
+// Description: Makes a file's FAT chain contiguous.
+// Preconditions: Namespace lock is held for reading. Entry is in use.
+// Postconditions: File occupies one run of blocks. Namespace lock is released.
+// Returns: 0 on success, < 0 on failure.
+int defragment_entry(int entry_index);
+
+// int defragment_every_entry()
+// Description: Makes every file's FAT chain contiguous.
+// Preconditions: Namespace lock is not held.
+// Postconditions: Every file occupies one run of blocks.
+// Returns: 0 on success, < 0 on failure.
+int defragment_every_entry();
+
+// uint64_t entry_inode(int)
+// Description: Gets the inode number of a file, its directory entry index plus the entry's generation.
+// Preconditions: Namespace lock is held. Entry is in use.
+// Postconditions: None.
+// Returns: Inode number, never ROOT_INODE.
+uint64_t entry_inode(int entry_index);
+
+// void free_open_file(open_file_t*)
+// Description: Frees the handle of a closed file.
+// Preconditions: No op is using the handle.
+// Postconditions: Handle is freed. NULL is ignored.
+// Returns: None.
+void free_open_file(open_file_t* handle);
+
+// int inode_entry(uint64_t)
+// Description: Finds the directory entry an inode number refers to.
+// Preconditions: Namespace lock is held.
+// Postconditions: None.
+// Returns: Directory entry index on success, -ENOENT if the file is gone or the entry holds a newer file.
+int inode_entry(uint64_t inode);
+
+// int lock_named_entry(const char*)
+// Description: Finds a file's directory entry by name and takes the namespace lock for reading.
+// Preconditions: Namespace lock is not held.
+// Postconditions: Namespace lock is held for reading if the file was found.
+// Returns: Directory entry index on success, < 0 if not found.
+int lock_named_entry(const char* readable_name);
+
+// int lock_open_file(const open_file_t*)
+// Description: Finds the directory entry of an open file and takes the namespace lock for reading.
+// Preconditions: Namespace lock is not held.
+// Postconditions: Namespace lock is held for reading if the file still exists.
+// Returns: Directory entry index on success, -ENOENT if the file was deleted since it was opened.
+int lock_open_file(const open_file_t* handle);
+
+// open_file_t* new_open_file(uint64_t)
+// Description: Allocates the handle for a file being opened or created.
+// Preconditions: inode came from entry_inode.
+// Postconditions: Handle expects a sequential read from offset 0.
+// Returns: Handle, or NULL if out of memory.
+open_file_t* new_open_file(uint64_t inode);
+
+// int next_listed_entry(int, const char**, struct stat*)
+// Description: Finds the next file to list in the root directory at or after a directory entry.
+// Preconditions: Namespace lock is held. stbuf may be NULL.
+// Postconditions: readable_name points at the file's name if one was found, valid while the namespace lock is held.
+//                 stbuf holds its attributes, unless NULL.
+// Returns: Directory entry index, or -1 if there are no more files.
+int next_listed_entry(int from_entry, const char** readable_name, struct stat* stbuf);
+
+// int read_entry(int, open_file_t*, char*, size_t, off_t)
+// Description: Reads a byte range of a file, reading further ahead while handle sees sequential reads.
+// Preconditions: Namespace lock is held for reading. Entry is in use. Offset is not negative. handle may be NULL.
+// Postconditions: buf holds the bytes read. Namespace lock is released.
+// Returns: Number of bytes read on success, < 0 on failure.
+int read_entry(int entry_index, open_file_t* handle, char* buf, size_t size, off_t offset);
+
+// int send_entry(int, open_file_t*, size_t, off_t, data_sender_t, void*)
+// Description: Reads a byte range of a file by handing send a buffer vector pointing straight at the file's
+//              blocks, held in memory until send returns. Falls back to one copy when the cache can't hold
+//              the whole range at once. Reads further ahead while handle sees sequential reads.
+// Preconditions: Namespace lock is held for reading. Entry is in use. Offset is not negative. handle may be NULL.
+// Postconditions: send was called once on success, never otherwise. Namespace lock is released.
+// Returns: Number of bytes sent on success, < 0 on failure.
+int send_entry(int entry_index, open_file_t* handle, size_t size, off_t offset, data_sender_t send, void* context);
+
+// void set_change_notifier(change_notifier_t)
+// Description: Sets the frontend hook told about files memefs changes on its own, e.g. by defragmenting.
+// Preconditions: No op is running.
+// Postconditions: Later changes are passed to notifier from a separate thread. NULL stops notifying.
+// Returns: None.
+void set_change_notifier(change_notifier_t notifier);
+
+// void start_filesystem()
+// Description: Starts the background flusher once FUSE is running.
+// Preconditions: Image is loaded.
+// Postconditions: Flusher runs, or updates are written back in sync mode if it couldn't start.
+// Returns: None.
+void start_filesystem();
+
+// int stat_entry(int, struct stat*)
+// Description: Gets a file's attributes.
+// Preconditions: Namespace lock is held for reading. Entry is in use.
+// Postconditions: stbuf describes the file. Namespace lock is released.
+// Returns: 0.
+int stat_entry(int entry_index, struct stat* stbuf);
+
+// void stat_filesystem(struct statvfs*)
+// Description: Gets the filesystem's block and directory entry counts, as statfs reports them.
+// Preconditions: Image is loaded. Namespace lock is not held.
+// Postconditions: stbuf describes the filesystem.
+// Returns: None.
+void stat_filesystem(struct statvfs* stbuf);
+
+// void stat_root(struct stat*)
+// Description: Gets the root directory's attributes.
+// Preconditions: None.
+// Postconditions: stbuf describes the root directory.
+// Returns: None.
+void stat_root(struct stat* stbuf);
+
+// int stop_filesystem()
+// Description: Writes everything back, marks the image cleanly unmounted and closes it.
+// Preconditions: Image is loaded. No op is running.
+// Postconditions: Pending change notifications were sent. Image is closed, even if the writeback failed.
+// Returns: 0 on success, -1 if the image couldn't be written back or synced.
+int stop_filesystem();
+
+// int sync_entry(int, int)
+// Description: Forces a file's dirty data and metadata out to the image.
+// Preconditions: Namespace lock is held for reading. Entry is in use.
+// Postconditions: File is on stable storage. Namespace lock is released.
+// Returns: 0 on success, < 0 on failure.
+int sync_entry(int entry_index, int datasync);
+
+// int truncate_entry(int, off_t)
+// Description: Sets a file's size, zero filling any extension.
+// Preconditions: Namespace lock is held for reading. Entry is in use.
+// Postconditions: File has the new size. Namespace lock is released.
+// Returns: 0 on success, < 0 on failure.
+int truncate_entry(int entry_index, off_t new_size);
+
+// int unlink_entry(const char*)
+// Description: Removes a file and frees its blocks.
+// Preconditions: Namespace lock is not held.
+// Postconditions: File no longer exists.
+// Returns: 0 on success, < 0 on failure.
+int unlink_entry(const char* readable_name);
+
+// int write_entry(int, struct fuse_bufvec*, off_t)
+// Description: Writes the data of a FUSE buffer vector into a file, growing it as needed.
+// Preconditions: Namespace lock is held for reading. Entry is in use. Offset is not negative.
+// Postconditions: File holds the bytes. src is consumed. Namespace lock is released.
+// Returns: Number of bytes written on success, < 0 on failure.
+int write_entry(int entry_index, struct fuse_bufvec* src, off_t offset);
+
+#endif // FILE_OPS_H
@@ -0,0 +1,57 @@
+#ifndef GEOMETRY_H
+#define GEOMETRY_H
+
+#include <stdint.h>
+
+#include "memefs_file_entry.h"
+#include "memefs_superblock.h"
+
+#define FAT_END_OF_CHAIN 0xFFFFFFFF // In-memory end of chain marker for every format version.
+#define FAT_FREE 0x00000000
+#define MAX_BLOCK_SIZE 65536
+#define MAX_USER_BLOCKS_V2 0x00FFFFFF // Starting blocks are 24 bits in a v2 directory entry.
+#define MIN_BLOCK_SIZE 512
+
+// Struct describing where each region of the image lives, read from the superblock at mount.
+typedef struct memefs_geometry {
+    uint32_t version;              // On-disk format version, 1 or 2
+    uint32_t block_size;           // Bytes per block
+    uint32_t total_blocks;         // Blocks in the image
+    uint32_t superblock_main;      // Block holding the main superblock
+    uint32_t superblock_backup;    // Block holding the backup superblock
+    uint32_t journal_begin;        // First block of the metadata journal
+    uint32_t journal_num_blocks;   // Blocks in the journal, header included
+    uint32_t fat_main_begin;       // First block of the main FAT
+    uint32_t fat_backup_begin;     // First block of the backup FAT
+    uint32_t fat_num_blocks;       // Blocks in each FAT
+    uint32_t fat_entry_size;       // Bytes per on-disk FAT entry, 2 or 4
+    uint32_t fat_num_entries;      // Entries in each FAT
+    uint32_t directory_begin;      // First block of the directory
+    uint32_t directory_num_blocks; // Blocks in the directory
+    uint32_t max_file_entries;     // Entries the directory holds
+    uint32_t user_data_begin;      // First user data block
+    uint32_t user_data_num_blocks; // User data blocks that can be given to files
+} memefs_geometry_t;
+
+// uint32_t get_start_block(const memefs_file_entry_t*)
+// Description: Gets a file's starting block, including the high bits on v2 images.
+// Preconditions: Geometry is read.
+// Postconditions: None.
+// Returns: Starting block number.
+uint32_t get_start_block(const memefs_file_entry_t* file_entry);
+
+// int read_geometry(const memefs_superblock_t*, uint64_t)
+// Description: Reads and validates the image layout from a superblock.
+// Preconditions: Superblock signature has been checked.
+// Postconditions: Global geometry describes the image.
+// Returns: 0 on success, -1 if the layout is unsupported or doesn't fit the image.
+int read_geometry(const memefs_superblock_t* superblock, uint64_t image_size);
+
+// void set_start_block(memefs_file_entry_t*, uint32_t)
+// Description: Sets a file's starting block, including the high bits on v2 images.
+// Preconditions: Geometry is read. Block fits the format.
+// Postconditions: Entry holds the block.
+// Returns: None.
+void set_start_block(memefs_file_entry_t* file_entry, uint32_t block);
+
+#endif // GEOMETRY_H
\ No newline at end of file
@@ -0,0 +1,27 @@
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <stdint.h>
+
+// uint32_t journal_capacity()
+// Description: Gets the most blocks one journal transaction can log.
+// Preconditions: Geometry is read.
+// Postconditions: None.
+// Returns: Number of blocks.
+uint32_t journal_capacity();
+
+// int load_journal(int, int)
+// Description: Reads the journal header and, if asked, replays the last committed transaction.
+// Preconditions: Image is open and geometry is read. Nothing has been loaded from the directory or FATs yet.
+// Postconditions: Logged blocks are back at their home locations and synced if replayed.
+// Returns: 1 if a transaction was replayed, 0 if not, -1 on failure.
+int load_journal(int fd, int replay);
+
+// int write_journal(int, const uint32_t*, const void* const*, uint32_t)
+// Description: Writes a transaction of metadata blocks to the journal. Does not sync.
+// Preconditions: At most journal_capacity() blocks. Previous transaction has been checkpointed and synced.
+// Postconditions: Journal holds the transaction once the image is synced. An empty transaction retires the last one.
+// Returns: 0 on success, -1 on failure.
+int write_journal(int fd, const uint32_t* home_blocks, const void* const* sources, uint32_t num_blocks);
+
+#endif // JOURNAL_H
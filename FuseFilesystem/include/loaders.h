@@ -1,18 +1,58 @@
 #ifndef LOADERS_H
 #define LOADERS_H
 
+#include <stdint.h>
+
+#include "dirty.h"
+
+// void close_image()
+// Description: Releases the image mapping, if any, and closes the image file.
+// Preconditions: None.
+// Postconditions: Image file descriptor is closed and set to -1.
+// Returns: None.
+void close_image();
+
 // int load_image()
-// Description: Loads the filesystem image into memory.
+// Description: Loads the filesystem image into memory, or maps it if use_mmap is set.
 // Preconditions: Filesystem image exists.
 // Postconditions: Filesystem image is loaded into memory.
-// Returns: 0 on success, 1 on failure.
+// Returns: 0 on success, 2 if refused as set by set_refuse_unclean, 1 on other failure.
 int load_image();
 
+// void set_refuse_unclean(int)
+// Description: Sets whether load_image refuses an image that is mounted or was not cleanly unmounted,
+//              rather than replaying its journal and taking it over.
+// Preconditions: Image is not loaded.
+// Postconditions: Later load_image calls leave such an image untouched if refuse is non-zero.
+// Returns: None.
+void set_refuse_unclean(int refuse);
+
+// int sync_image(int)
+// Description: Forces written blocks of the filesystem image to stable storage.
+// Preconditions: Filesystem image is open.
+// Postconditions: Image contents (and metadata unless datasync) are durable.
+// Returns: 0 on success, -1 on failure.
+int sync_image(int datasync);
+
+// int unload_blocks(const dirty_set_t*)
+// Description: Writes the dirty blocks among a set back to the filesystem image.
+// Preconditions: Filesystem image is loaded into memory.
+// Postconditions: Dirty blocks in the set are rewritten on image and marked clean.
+// Returns: 0 on success, -1 on failure.
+int unload_blocks(const dirty_set_t* blocks);
+
 // int unload_image()
-// Description: Unloads the filesystem image from memory.
+// Description: Writes blocks marked dirty back to the filesystem image. Safe to call from any thread.
 // Preconditions: Filesystem image is loaded into memory.
-// Postconditions: Filesystem image is rewritten from memory.
-// Returns: 0 on success, 1 on failure.
+// Postconditions: Dirty blocks are rewritten on image from memory and marked clean.
+// Returns: 0 on success, -1 on failure.
 int unload_image();
 
+// int write_data_block(uint32_t, const void*)
+// Description: Writes one user data block straight home, e.g. when the block cache evicts it.
+// Preconditions: Caller claimed the block from the dirty map.
+// Postconditions: Image holds the block. Next sync_image syncs even if writeback left nothing unprotected.
+// Returns: 0 on success, -1 on failure.
+int write_data_block(uint32_t data_block, const void* data);
+
 #endif // LOADERS_H
\ No newline at end of file
@@ -0,0 +1,88 @@
+#ifndef LOCKS_H
+#define LOCKS_H
+
+// Lock order: namespace -> file -> writeback (loaders.c) -> update barrier -> FAT/allocator (allocator.c).
+// The namespace lock is held for reading by every op that resolves a path and for
+// writing by ops that add or remove directory entries. File locks guard a file's
+// entry, FAT chain and data. Ops that change metadata hold the update barrier for
+// reading while they do, so writeback can snapshot the directory and FATs between ops.
+// Ops drop their locks before writing back.
+
+// void begin_update()
+// Description: Marks the start of a metadata change.
+// Preconditions: Caller holds the namespace lock, and the file's write lock if it changes one file.
+// Postconditions: Writeback won't snapshot metadata until end_update.
+// Returns: None.
+void begin_update();
+
+// void end_update()
+// Description: Marks the end of a metadata change.
+// Preconditions: Caller called begin_update.
+// Postconditions: Writeback may snapshot metadata.
+// Returns: None.
+void end_update();
+
+// int init_file_locks()
+// Description: Creates one unlocked lock per directory entry.
+// Preconditions: Geometry is read. No other thread is running.
+// Postconditions: Every entry index has a file lock.
+// Returns: 0 on success, -ENOMEM on failure.
+int init_file_locks();
+
+// void lock_file_read(int)
+// Description: Takes a file's lock for reading.
+// Preconditions: Namespace lock is held. Entry index is valid.
+// Postconditions: Other readers may proceed, writers wait.
+// Returns: None.
+void lock_file_read(int entry_index);
+
+// void lock_file_write(int)
+// Description: Takes a file's lock for writing.
+// Preconditions: Namespace lock is held. Entry index is valid.
+// Postconditions: File is held exclusively.
+// Returns: None.
+void lock_file_write(int entry_index);
+
+// void lock_namespace_read()
+// Description: Takes the namespace lock for reading.
+// Preconditions: No other memefs lock is held by the caller.
+// Postconditions: Directory entries can't be added or removed.
+// Returns: None.
+void lock_namespace_read();
+
+// void lock_namespace_write()
+// Description: Takes the namespace lock for writing.
+// Preconditions: No other memefs lock is held by the caller.
+// Postconditions: Filesystem is held exclusively.
+// Returns: None.
+void lock_namespace_write();
+
+// void quiesce_updates()
+// Description: Waits for metadata changes in progress to finish and holds off new ones.
+// Preconditions: Caller holds no update barrier.
+// Postconditions: Directory and FATs are consistent until resume_updates.
+// Returns: None.
+void quiesce_updates();
+
+// void resume_updates()
+// Description: Lets metadata changes continue after quiesce_updates.
+// Preconditions: Caller called quiesce_updates.
+// Postconditions: Metadata changes may proceed.
+// Returns: None.
+void resume_updates();
+
+// void unlock_file(int)
+// Description: Releases a file's lock.
+// Preconditions: Caller holds the file's lock.
+// Postconditions: File's lock is released.
+// Returns: None.
+void unlock_file(int entry_index);
+
+// void unlock_namespace()
+// Description: Releases the namespace lock.
+// Preconditions: Caller holds the namespace lock and no file lock.
+// Postconditions: Namespace lock is released.
+// Returns: None.
+void unlock_namespace();
+
+#endif // LOCKS_H
\ No newline at end of file
@@ -8,9 +8,9 @@
 // Struct representing a file entry in the directory.
 typedef struct memefs_file_entry {
     uint16_t type_permissions; // File type and permissions
-    uint16_t start_block;      // Starting block number
+    uint16_t start_block;      // Starting block number (low 16 bits on v2 images)
     char filename[MAX_ENCODED_FILENAME_LENGTH];         // Filename
-    uint8_t unused;            // Unused byte
+    uint8_t start_block_high;  // High 8 bits of the starting block number on v2 images, unused on v1
     uint8_t bcd_timestamp[8];  // Timestamp in BCD format
     uint32_t size;             // File size
     uint16_t uid_owner;        // User ID of owner
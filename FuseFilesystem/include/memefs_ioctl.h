@@ -0,0 +1,23 @@
+#ifndef MEMEFS_IOCTL_H
+#define MEMEFS_IOCTL_H
+
+#include <stdint.h>
+#include <sys/ioctl.h>
+
+// Struct holding block cache counters, returned by MEMEFS_IOC_CACHE_STATS.
+typedef struct memefs_cache_stats {
+    uint64_t hits;             // Pins that found the block in memory
+    uint64_t misses;           // Pins that had to read or claim a frame
+    uint64_t readahead_blocks; // Blocks read ahead of a fault
+    uint64_t evictions;        // Blocks dropped to make room
+    uint64_t dirty_evictions;  // Evicted blocks that were written home first
+    uint64_t resident_blocks;  // Blocks held right now
+    uint64_t capacity_blocks;  // Blocks the memory budget allows
+} memefs_cache_stats_t;
+
+// ioctl commands accepted on any file in a mounted memefs.
+#define MEMEFS_IOC_DEFRAG      _IO('M', 1) // Make the file's FAT chain contiguous
+#define MEMEFS_IOC_DEFRAG_ALL  _IO('M', 2) // Make every file's FAT chain contiguous
+#define MEMEFS_IOC_CACHE_STATS _IOR('M', 3, memefs_cache_stats_t) // Read the block cache counters
+
+#endif // MEMEFS_IOCTL_H
@@ -0,0 +1,19 @@
+#ifndef MEMEFS_JOURNAL_H
+#define MEMEFS_JOURNAL_H
+
+#include <stdint.h>
+
+#define JOURNAL_MAGIC "MEMEJRNL"
+
+// Struct representing the header of the metadata journal, stored in the first journal block.
+// The home block of each logged block follows it, as wide as a FAT entry (2 bytes on v1, 4 on v2),
+// and the rest of the header block is zero. The logged blocks follow the header block.
+// Multi-byte fields are big-endian like the FAT.
+typedef struct memefs_journal_header {
+    char magic[8];       // Journal signature, set once a transaction has been written
+    uint32_t sequence;   // Transaction number
+    uint32_t checksum;   // FNV-1a over the header block (checksum zeroed) and the logged blocks
+    uint16_t num_blocks; // Number of logged blocks
+} __attribute__((packed)) memefs_journal_header_t;
+
+#endif // MEMEFS_JOURNAL_H
@@ -0,0 +1,14 @@
+#ifndef MEMEFS_LL_H
+#define MEMEFS_LL_H
+
+#include "define.h"
+#include "file_ops.h"
+
+// int run_lowlevel(struct fuse_args*, const kernel_cache_config_t*)
+// Description: Mounts the loaded image through the FUSE low level API, addressing files by inode number, and serves it until unmounted.
+// Preconditions: Image is loaded. memefs options were already parsed out of args, cache holds the kernel caching ones.
+// Postconditions: Filesystem is unmounted and the image closed.
+// Returns: 0 on success, 1 on failure.
+int run_lowlevel(struct fuse_args* args, const kernel_cache_config_t* cache);
+
+#endif // MEMEFS_LL_H
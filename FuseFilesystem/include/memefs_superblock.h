@@ -4,6 +4,8 @@
 #include <stdint.h>
 
 // Struct representing superblock metadata for the filesystem.
+// Version 1 images use the fixed 16-bit fields, version 2 images the 32-bit geometry after them.
+// Multi-byte fields are big-endian.
 typedef struct memefs_superblock {
     char signature[16];        // Filesystem signature
     uint8_t cleanly_unmounted; // Flag for unmounted state
@@ -19,7 +21,19 @@ typedef struct memefs_superblock {
     uint16_t num_user_blocks;  // Number of user data blocks
     uint16_t first_user_block; // First user data block
     char volume_label[16];     // Volume label
-    uint8_t unused[448];       // Unused space for alignment
+    uint32_t block_size;       // Bytes per block (v2)
+    uint32_t total_blocks;     // Blocks in the image (v2)
+    uint32_t journal_start;    // Starting block for the metadata journal (v2)
+    uint32_t journal_size;     // Journal size in blocks (v2)
+    uint32_t main_fat32;       // Starting block for main FAT (v2)
+    uint32_t backup_fat32;     // Starting block for backup FAT (v2)
+    uint32_t fat_size32;       // Size of each FAT in blocks (v2)
+    uint32_t directory_start32; // Starting block for directory (v2)
+    uint32_t directory_size32; // Directory size in blocks (v2)
+    uint32_t first_user_block32; // First user data block (v2)
+    uint32_t num_user_blocks32; // Number of user data blocks (v2)
+    uint8_t fat_entry_size;    // Bytes per FAT entry (v2)
+    uint8_t unused[403];       // Unused space for alignment
 } __attribute__((packed)) memefs_superblock_t;
 
 #endif // MEMEFS_SUPERBLOCK_H
\ No newline at end of file
@@ -0,0 +1,50 @@
+#ifndef MEMEFS_TRACE_H
+#define MEMEFS_TRACE_H
+
+#include <stdint.h>
+
+#define TRACE_MAGIC "MEMETRC1"
+#define TRACE_NAME_LENGTH 13 // Readable 8.3 name and its terminator.
+
+// Ops recorded in a trace.
+typedef enum trace_op {
+    TRACE_FILE = 0,  // File that existed when tracing started, size in offset
+    TRACE_CREATE,
+    TRACE_FLUSH,
+    TRACE_FSYNC,
+    TRACE_GETATTR,
+    TRACE_LOOKUP,
+    TRACE_OPEN,
+    TRACE_READ,
+    TRACE_READDIR,   // Entries listed in size
+    TRACE_RELEASE,
+    TRACE_TRUNCATE,  // New size in offset
+    TRACE_UNLINK,
+    TRACE_WRITE,
+    TRACE_STATFS,
+    NUM_TRACE_OPS
+} trace_op_t;
+
+// Struct representing the header at the start of a trace file.
+// Records follow it back to back, in the order the ops finished, in host byte order.
+typedef struct memefs_trace_header {
+    char magic[8];             // Trace signature
+    uint32_t record_size;      // sizeof(memefs_trace_record_t) when written
+    uint32_t block_size;       // Block size of the traced image
+    uint32_t max_file_entries; // Directory entries of the traced image
+    uint64_t start_time;       // Wall clock time tracing started, in ns since the epoch
+} __attribute__((packed)) memefs_trace_header_t;
+
+// Struct representing one op in a trace.
+typedef struct memefs_trace_record {
+    uint64_t timestamp;     // ns from the start of the trace to the start of the op
+    uint64_t offset;        // Byte offset, or size for TRACE_FILE and TRACE_TRUNCATE
+    uint32_t latency;       // ns the op took, saturated at UINT32_MAX
+    uint32_t size;          // Bytes asked for, or entries listed for TRACE_READDIR
+    int32_t result;         // Bytes read or written, else 0, or -errno on failure
+    int32_t slot;           // Directory entry of the file, -1 if none was found
+    uint8_t op;             // trace_op_t
+    char name[TRACE_NAME_LENGTH]; // File name if the op was given one, else empty
+} __attribute__((packed)) memefs_trace_record_t;
+
+#endif // MEMEFS_TRACE_H
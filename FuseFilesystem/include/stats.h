@@ -0,0 +1,63 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "memefs_trace.h"
+
+#define STATS_FILE_NAME ".memefs-stats" // Virtual file holding the counters, never a legal 8.3 name.
+#define STATS_INODE 0xFFFFFFFFull       // Inode number of the stats file, past every directory entry's.
+#define NUM_LATENCY_BUCKETS 24          // Bucket 0 is < 1 us, bucket k is [2^(k-1), 2^k) us, the last has no upper bound.
+
+// Counters kept by the engine, outside any single op.
+typedef enum stat_counter {
+    STAT_ALLOCATIONS,     // Calls that allocated blocks
+    STAT_BLOCKS_ALLOCATED,
+    STAT_BLOCKS_FREED,
+    STAT_WRITEBACKS,      // Writeback passes, by the flusher or an op
+    STAT_FILE_FLUSHES,    // Files forced out by fsync or close
+    STAT_JOURNAL_COMMITS,
+    STAT_IMAGE_SYNCS,     // fsync, fdatasync and msync calls on the image
+    STAT_BYTES_WRITTEN,   // Bytes written to the image, journal included
+    NUM_STAT_COUNTERS
+} stat_counter_t;
+
+// void add_stat(stat_counter_t, uint64_t)
+// Description: Adds to one of the engine's counters.
+// Preconditions: None.
+// Postconditions: Counter is incremented atomically.
+// Returns: None.
+void add_stat(stat_counter_t counter, uint64_t amount);
+
+// size_t format_stats(char*, size_t)
+// Description: Writes every counter and histogram as "name value" lines, as the stats file shows them.
+// Preconditions: Image is loaded. Namespace lock is not held.
+// Postconditions: buf holds as much of the text as fits, without a terminator.
+// Returns: Length of the whole text, which may be more than size.
+size_t format_stats(char* buf, size_t size);
+
+// int read_stats(char*, size_t, off_t)
+// Description: Reads a byte range of the stats file, formatted as of the call.
+// Preconditions: Image is loaded. Namespace lock is not held. Offset is not negative.
+// Postconditions: buf holds the bytes read.
+// Returns: Number of bytes read on success, < 0 on failure.
+int read_stats(char* buf, size_t size, off_t offset);
+
+// void record_op_stats(trace_op_t, uint64_t, int, uint64_t)
+// Description: Counts an op that finished, its bytes if it moved any, and its latency.
+// Preconditions: None.
+// Postconditions: Op's counters and histogram are updated atomically.
+// Returns: None.
+void record_op_stats(trace_op_t op, uint64_t bytes, int failed, uint64_t latency);
+
+// void stat_stats_file(struct stat*)
+// Description: Gets the stats file's attributes. Its size is 0, reads go past it as in /proc.
+// Preconditions: None.
+// Postconditions: stbuf describes a read-only regular file.
+// Returns: None.
+void stat_stats_file(struct stat* stbuf);
+
+#endif // STATS_H
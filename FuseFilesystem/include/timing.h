@@ -0,0 +1,20 @@
+#ifndef TIMING_H
+#define TIMING_H
+
+#include <stdint.h>
+
+// int compare_ns(const void*, const void*)
+// Description: Orders two nanosecond durations for qsort, e.g. to read latency percentiles.
+// Preconditions: a and b point at uint64_t values.
+// Postconditions: None.
+// Returns: < 0 if a is shorter, 0 if equal, > 0 if a is longer.
+int compare_ns(const void* a, const void* b);
+
+// uint64_t monotonic_ns()
+// Description: Reads the monotonic clock.
+// Preconditions: None.
+// Postconditions: None.
+// Returns: Nanoseconds since an arbitrary point, never 0, so 0 can mean not timed.
+uint64_t monotonic_ns();
+
+#endif // TIMING_H
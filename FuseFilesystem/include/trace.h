@@ -0,0 +1,44 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+
+#include "memefs_trace.h"
+
+// int start_trace(const char*)
+// Description: Starts recording every op to a trace file, beginning with the files that already exist.
+// Preconditions: Image is loaded. No op is running.
+// Postconditions: Later ops are recorded until stop_trace.
+// Returns: 0 on success, -1 on failure.
+int start_trace(const char* path);
+
+// void stop_trace()
+// Description: Writes out the records still buffered and closes the trace file.
+// Preconditions: No op is running.
+// Postconditions: Trace is complete. Later ops are not recorded.
+// Returns: None.
+void stop_trace();
+
+// uint64_t trace_begin()
+// Description: Marks the start of an op.
+// Preconditions: None.
+// Postconditions: None.
+// Returns: Start time to pass to trace_end.
+uint64_t trace_begin();
+
+// void trace_end(trace_op_t, const char*, int, uint64_t, uint64_t, int, uint64_t)
+// Description: Counts an op that started at trace_begin in the stats, and records it if tracing.
+// Preconditions: started came from trace_begin. readable_name may be NULL. slot < 0 if no file was found.
+//                result is the bytes read or written for reads and writes.
+// Postconditions: Op is counted, and buffered for the trace file if tracing.
+// Returns: None.
+void trace_end(trace_op_t op, const char* readable_name, int slot, uint64_t offset, uint64_t size, int result, uint64_t started);
+
+// const char* trace_op_name(trace_op_t)
+// Description: Gets the name of an op, as the stats file and memefs_replay show it.
+// Preconditions: None.
+// Postconditions: None.
+// Returns: Lowercase name.
+const char* trace_op_name(trace_op_t op);
+
+#endif // TRACE_H
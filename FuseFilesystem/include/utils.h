@@ -3,16 +3,11 @@
 
 #include <stddef.h>
 #include <stdint.h>
+#include <sys/types.h>
 
+#include "define.h"
 #include "memefs_file_entry.h"
 
-// Type for write operations.
-typedef enum write_type {
-    OVERWRITE,
-    APPEND,
-    INVALID
-} write_type_t;
-
 // int append_file(memefs_file_entry_t*, const char*, size_t)
 // Description: Appends data to the end of a file.
 // Preconditions: File exists.
@@ -27,12 +22,12 @@ int append_file(memefs_file_entry_t* file_entry, const char* buf, size_t size);
 // Returns: 0 on success, < 0 on failure.
 int check_legal_name(const char* filename);
 
-// void generate_memefs_timestamp(uint8_t*)
+// time_t generate_memefs_timestamp(uint8_t*)
 // Description: Generates a timestamp in BCD format.
 // Preconditions: None.
 // Postconditions: BCD timestamp is generated.
-// Returns: None.
-void generate_memefs_timestamp(uint8_t bcd_time[8]);
+// Returns: Time the timestamp holds.
+time_t generate_memefs_timestamp(uint8_t bcd_time[8]);
 
 // time_t memefs_bcd_to_time(const uint8_t*)
 // Description: Converts a BCD timestamp to a time_t.
@@ -62,11 +57,27 @@ void name_to_encoded(const char* readable_name, char* encoded_name);
 // Returns: None.
 void name_to_readable(const char* name, char* readable_name);
 
-// int overwrite_file(memefs_file_entry_t*, const char*, size_t)
-// Description: Overwrites a file.
+// int truncate_file(memefs_file_entry_t*, off_t)
+// Description: Changes the size of a file.
+// Preconditions: File exists.
+// Postconditions: Chain holds exactly the blocks the new size needs, new bytes read as zeros.
+// Returns: 0 on success, < 0 on failure.
+int truncate_file(memefs_file_entry_t* file_entry, off_t new_size);
+
+// int write_file(memefs_file_entry_t*, const char*, size_t, off_t)
+// Description: Writes data into a file at an offset, in place.
+// Preconditions: File exists.
+// Postconditions: Range [offset, offset + size) holds the data, chain is extended past EOF if needed.
+// Returns: 0 on success, < 0 on failure.
+int write_file(memefs_file_entry_t* file_entry, const char* buf, size_t size, off_t offset);
+
+// int write_file_buf(memefs_file_entry_t*, struct fuse_bufvec*, off_t)
+// Description: Writes the data of a FUSE buffer vector into a file at an offset, copying it straight into the
+//              file's blocks, so data spliced from the kernel is read from its pipe only once.
 // Preconditions: File exists.
-// Postconditions: File data overwritten.
+// Postconditions: Range [offset, offset + fuse_buf_size(src)) holds the data, chain is extended past EOF if needed.
+//                 src is consumed.
 // Returns: 0 on success, < 0 on failure.
-int overwrite_file(memefs_file_entry_t* file_entry, const char* buf, size_t size);
+int write_file_buf(memefs_file_entry_t* file_entry, struct fuse_bufvec* src, off_t offset);
 
 #endif // UTILS_H
\ No newline at end of file
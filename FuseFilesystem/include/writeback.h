@@ -0,0 +1,69 @@
+#ifndef WRITEBACK_H
+#define WRITEBACK_H
+
+#include <stdint.h>
+
+// How hard memefs works to get updates onto the image before reporting success.
+typedef enum durability {
+    DURABILITY_SYNC,     // Every update is written and synced before the op returns
+    DURABILITY_STANDARD, // Background flusher, files are also forced out on fsync and close
+    DURABILITY_RELAXED   // Background flusher, files are only forced out on fsync
+} durability_t;
+
+// int commit_update()
+// Description: Finishes an op that changed the filesystem, per the durability mode.
+// Preconditions: Changes are marked dirty. Caller holds no namespace or file lock.
+// Postconditions: Changes are on stable storage in sync mode, otherwise queued for the flusher.
+// Returns: 0 on success, -1 on failure.
+int commit_update();
+
+// int flush_file(int, int)
+// Description: Writes a file's dirty data and metadata to the image and syncs it.
+// Preconditions: Entry is in use. File is locked.
+// Postconditions: File's blocks, directory entry, FATs and superblocks are on stable storage.
+// Returns: 0 on success, -1 on failure.
+int flush_file(int entry_index, int datasync);
+
+// durability_t get_durability()
+// Description: Gets the durability mode.
+// Preconditions: None.
+// Postconditions: None.
+// Returns: Current durability mode.
+durability_t get_durability();
+
+// void set_dirty_limit(uint32_t)
+// Description: Sets how many dirty bytes wake the flusher before its interval is up.
+// Preconditions: None.
+// Postconditions: Later updates wake the flusher once the limit is reached.
+// Returns: None.
+void set_dirty_limit(uint32_t bytes);
+
+// int set_durability(const char*)
+// Description: Selects the durability mode by name ("sync", "standard" or "relaxed").
+// Preconditions: Flusher is not running.
+// Postconditions: Later updates use the named mode.
+// Returns: 0 on success, -EINVAL for an unknown name.
+int set_durability(const char* name);
+
+// void set_flush_interval(uint32_t)
+// Description: Sets how often the flusher writes back dirty blocks.
+// Preconditions: None.
+// Postconditions: Flusher waits at most the interval between writebacks.
+// Returns: None.
+void set_flush_interval(uint32_t milliseconds);
+
+// int start_flusher()
+// Description: Starts the background flusher thread unless the mode is sync.
+// Preconditions: Filesystem image is loaded into memory.
+// Postconditions: Flusher is running if the mode uses it.
+// Returns: 0 on success, -1 on failure.
+int start_flusher();
+
+// void stop_flusher()
+// Description: Stops the background flusher thread and waits for it to exit.
+// Preconditions: None.
+// Postconditions: Flusher is not running. Dirty blocks may remain.
+// Returns: None.
+void stop_flusher();
+
+#endif // WRITEBACK_H
\ No newline at end of file
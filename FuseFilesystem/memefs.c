@@ -3,388 +3,438 @@
 // Date:    04/27/2025
 // Desc:    Implementation of the memefs filesystem.
 
-#include <arpa/inet.h>
 #include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <string.h>
 #include <unistd.h>
 
+#include "allocator.h"
+#include "block_cache.h"
 #include "define.h"
+#include "dir_index.h"
+#include "events.h"
+#include "file_ops.h"
 #include "loaders.h"
-#include "memefs_file_entry.h"
-#include "memefs_superblock.h"
-#include "utils.h"
+#include "locks.h"
+#include "memefs_ioctl.h"
+#include "memefs_ll.h"
+#include "stats.h"
+#include "trace.h"
+#include "writeback.h"
 
 #pragma region Globals
 
 extern int img_fd;
-extern memefs_superblock_t main_superblock;
-extern memefs_superblock_t backup_superblock;
-extern memefs_file_entry_t directory[MAX_FILE_ENTRIES];
-extern uint16_t main_fat[MAX_FAT_ENTRIES];
-extern uint16_t backup_fat[MAX_FAT_ENTRIES];
-extern uint8_t user_data[USER_DATA_NUM_BLOCKS * BLOCK_SIZE];
+extern int use_mmap;
+
+static struct fuse* mounted_fuse = NULL; // Set once init() runs, for invalidating kernel caches.
 
 #pragma endregion Globals
 
+#pragma region Mount Options
+
+// Struct holding memefs specific mount options.
+typedef struct memefs_options {
+    char* alloc_policy;      // -o alloc=first|next|best
+    double attr_timeout;     // -o attr_timeout=<s>
+    unsigned cache_size;     // -o cache_size=<MiB>
+    char* durability;        // -o durability=sync|standard|relaxed
+    unsigned dirty_limit;    // -o dirty_limit=<KiB>
+    double entry_timeout;    // -o entry_timeout=<s>
+    char* events;            // -o events=<file>
+    unsigned flush_interval; // -o flush_interval=<ms>
+    int kernel_cache;        // -o kernel_cache, -o no_kernel_cache
+    int lazy;                // -o lazy
+    int lowlevel;            // -o lowlevel
+    double negative_timeout; // -o negative_timeout=<s>
+    int readahead;           // -o readahead=<blocks>, -1 if not given
+    char* trace;             // -o trace=<file>
+    int use_mmap;            // -o mmap
+} memefs_options_t;
+
+static memefs_options_t options;
+
+static const struct fuse_opt memefs_opts[] = {
+    { "alloc=%s", offsetof(memefs_options_t, alloc_policy), 0 },
+    { "attr_timeout=%lf", offsetof(memefs_options_t, attr_timeout), 0 },
+    { "cache_size=%u", offsetof(memefs_options_t, cache_size), 0 },
+    { "dirty_limit=%u", offsetof(memefs_options_t, dirty_limit), 0 },
+    { "durability=%s", offsetof(memefs_options_t, durability), 0 },
+    { "entry_timeout=%lf", offsetof(memefs_options_t, entry_timeout), 0 },
+    { "events=%s", offsetof(memefs_options_t, events), 0 },
+    { "flush_interval=%u", offsetof(memefs_options_t, flush_interval), 0 },
+    { "kernel_cache", offsetof(memefs_options_t, kernel_cache), 1 },
+    { "lazy", offsetof(memefs_options_t, lazy), 1 },
+    { "lowlevel", offsetof(memefs_options_t, lowlevel), 1 },
+    { "mmap", offsetof(memefs_options_t, use_mmap), 1 },
+    { "negative_timeout=%lf", offsetof(memefs_options_t, negative_timeout), 0 },
+    { "no_kernel_cache", offsetof(memefs_options_t, kernel_cache), 0 },
+    { "readahead=%d", offsetof(memefs_options_t, readahead), 0 },
+    { "trace=%s", offsetof(memefs_options_t, trace), 0 },
+    FUSE_OPT_END
+};
+
+#pragma endregion Mount Options
+
 #pragma region FUSE Prototypes
 
 // FUSE operations.
 static int memefs_create(const char *path, mode_t mode, struct fuse_file_info *fi);
 static void memefs_destroy(void* private_data);
+static int memefs_flush(const char* path, struct fuse_file_info* fi);
+static int memefs_fsync(const char* path, int datasync, struct fuse_file_info* fi);
 static int memefs_getattr(const char* path, struct stat* stbuf, struct fuse_file_info* fi);
+static void* memefs_init(struct fuse_conn_info* conn, struct fuse_config* cfg);
+static int memefs_ioctl(const char* path, unsigned int cmd, void* arg, struct fuse_file_info* fi, unsigned int flags, void* data);
 static int memefs_open(const char* path, struct fuse_file_info* fi);
 static int memefs_read(const char* path, char* buf, size_t size, off_t offset, struct fuse_file_info* fi);
 static int memefs_readdir(const char* path, void* buf, fuse_fill_dir_t filler, off_t offset, struct fuse_file_info* fi, enum fuse_readdir_flags flags);
+static int memefs_release(const char* path, struct fuse_file_info* fi);
+static int memefs_statfs(const char* path, struct statvfs* stbuf);
 static int memefs_truncate(const char* path, off_t new_size, struct fuse_file_info* fi);
 static int memefs_unlink(const char *path);
 static int memefs_utimens(const char *path, const struct timespec ts[2], struct fuse_file_info *fi);
-static int memefs_write(const char* path, const char *buf, size_t size, off_t offset, struct fuse_file_info *fi);
+static int memefs_write_buf(const char* path, struct fuse_bufvec* buf, off_t offset, struct fuse_file_info* fi);
 
 #pragma endregion FUSE Prototypes
 
+#pragma region Prototypes
+
+// static open_file_t* file_handle(struct fuse_file_info*)
+// Description: Gets the handle open or create stored for a file.
+// Preconditions: None.
+// Postconditions: None.
+// Returns: Handle, or NULL if the op came without one.
+static open_file_t* file_handle(struct fuse_file_info* fi);
+
+// static void invalidate_path(uint64_t, const char*, int)
+// Description: Change notifier dropping what the kernel cached about a file under its path.
+// Preconditions: Filesystem is mounted. No memefs lock is held.
+// Postconditions: Kernel rereads the file's name, attributes and data on next use.
+// Returns: None.
+static void invalidate_path(uint64_t inode, const char* readable_name, int changes);
+
+// static int is_stats_path(const char*)
+// Description: Checks if a path names the stats file.
+// Preconditions: None.
+// Postconditions: None.
+// Returns: 1 if it does, 0 otherwise.
+static int is_stats_path(const char* path);
+
+// static int lock_handle(const char*, struct fuse_file_info*)
+// Description: Finds the directory entry for an op through its open file's handle, or by path if it has none,
+//              and takes the namespace lock for reading.
+// Preconditions: Namespace lock is not held.
+// Postconditions: Namespace lock is held for reading if the file was found.
+// Returns: Directory entry index on success, -ENOENT if not found.
+static int lock_handle(const char* path, struct fuse_file_info* fi);
+
+// static int sync_path(const char*, struct fuse_file_info*, int, trace_op_t, uint64_t)
+// Description: Forces a file's dirty data and metadata out to the image, recording it as op.
+// Preconditions: started came from trace_begin.
+// Postconditions: File is on stable storage.
+// Returns: 0 on success, < 0 on failure.
+static int sync_path(const char* path, struct fuse_file_info* fi, int datasync, trace_op_t op, uint64_t started);
+
+#pragma endregion Prototypes
+
 #pragma region FUSE Implementations
 
 // FUSE operations.
 static const struct fuse_operations memefs_oper = {
-    .create   = memefs_create,
-    .destroy  = memefs_destroy,
-    .getattr  = memefs_getattr,
-    .open     = memefs_open,
-    .read     = memefs_read,
-    .readdir  = memefs_readdir,
-    .truncate = memefs_truncate,
-    .unlink   = memefs_unlink,
-    .utimens  = memefs_utimens,
-    .write    = memefs_write,
+    .create    = memefs_create,
+    .destroy   = memefs_destroy,
+    .flush     = memefs_flush,
+    .fsync     = memefs_fsync,
+    .getattr   = memefs_getattr,
+    .init      = memefs_init,
+    .ioctl     = memefs_ioctl,
+    .open      = memefs_open,
+    .read      = memefs_read,
+    .readdir   = memefs_readdir,
+    .release   = memefs_release,
+    .statfs    = memefs_statfs,
+    .truncate  = memefs_truncate,
+    .unlink    = memefs_unlink,
+    .utimens   = memefs_utimens,
+    .write_buf = memefs_write_buf,
 };
 
 static int memefs_create(const char* path, mode_t mode, struct fuse_file_info* fi) {
-    (void) fi;
     (void) mode;
-    char encoded_filename[MAX_ENCODED_FILENAME_LENGTH];
-    char readable_filename[MAX_READABLE_FILENAME_LENGTH];
-    int i, j, name_legal;
-
-    if ((name_legal = check_legal_name(path + 1)) != 0) {
-        // File name is not legal.
-        return name_legal;
-    }
-
-    for (i = 0; i < MAX_FILE_ENTRIES; i++) {
-        name_to_readable(directory[i].filename, readable_filename);
-        if ((strcmp(readable_filename, path + 1) == 0) && (directory[i].type_permissions != 0x0000)) {
-            // File already exists.
-            return -EEXIST;
-        }
+    open_file_t* handle;
+    struct stat stbuf;
+    uint64_t started;
+    int i, result;
+
+    started = trace_begin();
+    if ((i = create_entry(path + 1, &stbuf)) < 0) {
+        result = i;
+    } else if ((handle = new_open_file((uint64_t)stbuf.st_ino)) == NULL) {
+        result = -ENOMEM;
+    } else {
+        fi->fh = (uint64_t)(uintptr_t)handle;
+        result = 0;
     }
-
-    for (i = 0; i < MAX_FILE_ENTRIES; i++) {
-        if (directory[i].type_permissions == 0x0000) {
-            // Found free file entry in directory.
-            for (j = 0; j < MAX_FAT_ENTRIES; j++) {
-                if (main_fat[j] == 0x0000) {
-                    // Found free FAT entry.
-                    name_to_encoded(path + 1, encoded_filename);
-                    memcpy(directory[i].filename, encoded_filename, 11);
-                    directory[i].type_permissions = (uint16_t)(S_IFREG | 0644);
-                    directory[i].start_block = (uint16_t)j;
-                    directory[i].unused = (uint16_t)0x00;
-                    generate_memefs_timestamp(directory[i].bcd_timestamp);
-                    directory[i].uid_owner = (uint16_t)getuid();
-                    directory[i].gid_owner = (uint16_t)getgid();
-                    directory[i].size = (uint32_t)0;
-                    main_fat[j] = (uint16_t)0xFFFF;
-                    backup_fat[j] = (uint16_t)0xFFFF;
-                    if (unload_image() != 0) {
-                        fprintf(stderr, "Failed to update image after create()\n");
-                        return -EIO;
-                    }
-                    return 0;
-                }
-            }
-        }
-    }
-
-    return -ENOSPC;
+    trace_end(TRACE_CREATE, path + 1, i, 0, 0, result, started);
+    return result;
 }
 
 static void memefs_destroy(void* private_data) {
     (void) private_data;
 
-    main_superblock.cleanly_unmounted = 0x00;
-    backup_superblock.cleanly_unmounted = 0x00;
-    if (unload_image() != 0) {
-        fprintf(stderr, "Failed to update image after destroy()\n");
+    stop_filesystem();
+}
+
+static int memefs_flush(const char* path, struct fuse_file_info* fi) {
+    uint64_t started;
+
+    if (is_stats_path(path)) {
+        return 0;
     }
 
-    // Close the image file descriptor
-    if (img_fd >= 0) {
-        close(img_fd);
-        img_fd = -1;
+    started = trace_begin();
+    if (get_durability() != DURABILITY_STANDARD) {
+        // Sync mode has nothing pending, relaxed mode leaves it to the flusher.
+        trace_end(TRACE_FLUSH, path + 1, -1, 0, 0, 0, started);
+        return 0;
+    }
+    return sync_path(path, fi, 1, TRACE_FLUSH, started);
+}
+
+static int memefs_fsync(const char* path, int datasync, struct fuse_file_info* fi) {
+    if (is_stats_path(path)) {
+        return 0;
     }
+    return sync_path(path, fi, datasync, TRACE_FSYNC, trace_begin());
 }
 
 static int memefs_getattr(const char* path, struct stat* stbuf, struct fuse_file_info* fi) {
-    (void) fi;
-    char readable_filename[MAX_READABLE_FILENAME_LENGTH];
-    int i;
+    uint64_t started;
+    int i, result;
 
-    memset(stbuf, 0, sizeof(struct stat));
+    if (is_stats_path(path)) {
+        // Not a directory entry, and left out of the counts it shows.
+        stat_stats_file(stbuf);
+        return 0;
+    }
 
+    started = trace_begin();
     if (strcmp(path, "/") == 0) {
         // Root directory or "." or ".."
-        stbuf->st_mode = (mode_t)(S_IFDIR | 0755);
-        stbuf->st_nlink = (nlink_t)2;
-        return 0;
+        stat_root(stbuf);
+        i = -1;
+        result = 0;
+    } else if ((i = lock_handle(path, fi)) < 0) {
+        // File not found.
+        result = i;
+    } else {
+        result = stat_entry(i, stbuf);
     }
+    trace_end(TRACE_GETATTR, path + 1, i, 0, 0, result, started);
+    return result;
+}
 
-    for (i = 0; i < MAX_FILE_ENTRIES; i++) {
-        name_to_readable(directory[i].filename, readable_filename);
-        if ((strcmp(readable_filename, path + 1) == 0) && (directory[i].type_permissions != 0x0000) && (check_legal_name(readable_filename) == 0)) {
-            // Found file.
-            stbuf->st_mode = (mode_t)(S_IFREG | 0644);
-            stbuf->st_nlink = (nlink_t)1;
-            stbuf->st_uid = (uid_t)directory[i].uid_owner;
-            stbuf->st_gid = (gid_t)directory[i].gid_owner;
-            stbuf->st_size = (off_t)directory[i].size;
-            stbuf->st_mtime = memefs_bcd_to_time(directory[i].bcd_timestamp);
-            stbuf->st_blocks = (blkcnt_t)((directory[i].size + 511) / BLOCK_SIZE);
-            return 0;
-        }
-    }
+static void* memefs_init(struct fuse_conn_info* conn, struct fuse_config* cfg) {
+    // Writes arrive in a pipe read straight into the blocks, and listings carry each file's attributes.
+    conn->want |= conn->capable & (FUSE_CAP_SPLICE_READ | FUSE_CAP_READDIRPLUS);
+
+    // Every change goes through the kernel or is notified, so what it caches stays valid.
+    cfg->attr_timeout = options.attr_timeout;
+    cfg->entry_timeout = options.entry_timeout;
+    cfg->negative_timeout = options.negative_timeout;
+    cfg->kernel_cache = options.kernel_cache;
+    mounted_fuse = fuse_get_context()->fuse;
+    set_change_notifier(invalidate_path);
 
-    return -ENOENT;
+    start_filesystem();
+    return NULL;
 }
 
-static int memefs_open(const char* path, struct fuse_file_info* fi) {
-    (void) fi;
-    char readable_filename[MAX_READABLE_FILENAME_LENGTH];
+static int memefs_ioctl(const char* path, unsigned int cmd, void* arg, struct fuse_file_info* fi, unsigned int flags, void* data) {
+    (void) arg;
     int i;
 
-    for (i = 0; i < MAX_FILE_ENTRIES; i++) {
-        name_to_readable(directory[i].filename, readable_filename);
-        if ((strcmp(readable_filename, path + 1) == 0) && (directory[i].type_permissions != 0x0000) && (check_legal_name(readable_filename) == 0)) {
-            // Found file entry.
+    if (flags & FUSE_IOCTL_COMPAT) {
+        return -ENOSYS;
+    }
+
+    switch (cmd) {
+        case MEMEFS_IOC_CACHE_STATS:
+            // Read only, nothing to commit.
+            get_cache_stats((memefs_cache_stats_t*)data);
             return 0;
-        }
+        case MEMEFS_IOC_DEFRAG:
+            if ((i = lock_handle(path, fi)) < 0) {
+                // File not found.
+                return i;
+            }
+            return defragment_entry(i);
+        case MEMEFS_IOC_DEFRAG_ALL:
+            return defragment_every_entry();
+        default:
+            return -ENOTTY;
     }
-    
+}
+
+static int memefs_open(const char* path, struct fuse_file_info* fi) {
+    open_file_t* handle;
+    uint64_t inode, started;
+    int i, result;
+
     if (strcmp(path, "/") == 0) {
-        // Found root directory.
+        // Found root directory, which needs no handle.
+        fi->fh = 0;
         return 0;
     }
-
-    return -ENOENT;
-}
-
-static int memefs_read(const char* path, char* buf, size_t size, off_t offset, struct fuse_file_info* fi) {
-    (void) offset;
-    (void) fi;
-    char readable_filename[MAX_READABLE_FILENAME_LENGTH];
-    int i, curr_block, bytes_read;
-    uint32_t file_size;
-    size_t bytes_to_read;
-    off_t buffer_offset;
-
-    // Locate file in directory
-    for (i = 0, curr_block = -1; i < MAX_FILE_ENTRIES; i++) {
-        name_to_readable(directory[i].filename, readable_filename);
-        if ((strcmp(readable_filename, path + 1) == 0) && (directory[i].type_permissions != 0x0000) && (check_legal_name(readable_filename) == 0)) {
-            // Found file entry.
-            curr_block = directory[i].start_block;
-            file_size = directory[i].size;
-            break;
+    if (is_stats_path(path)) {
+        // Formatted anew by every read, so the kernel must not cache it or trust its size.
+        if ((fi->flags & O_ACCMODE) != O_RDONLY) {
+            return -EACCES;
         }
+        fi->direct_io = 1;
+        fi->fh = 0;
+        return 0;
     }
 
-    if (curr_block == -1) {
+    // Resolve the path once, ops on the descriptor then go through the handle.
+    started = trace_begin();
+    if ((i = lock_named_entry(path + 1)) < 0) {
         // File not found.
-        return -ENOENT;
+        result = i;
+    } else {
+        inode = entry_inode(i);
+        unlock_namespace();
+        if ((handle = new_open_file(inode)) == NULL) {
+            result = -ENOMEM;
+        } else {
+            fi->fh = (uint64_t)(uintptr_t)handle;
+            result = 0;
+        }
     }
+    trace_end(TRACE_OPEN, path + 1, i, 0, 0, result, started);
+    return result;
+}
+
+static int memefs_read(const char* path, char* buf, size_t size, off_t offset, struct fuse_file_info* fi) {
+    uint64_t started;
+    int i, result;
 
-    // Adjust size if reading beyond EOF
-    size = (size_t)MIN(size, file_size);
-    bytes_to_read = 0;
-    bytes_read = 0;
-    buffer_offset = 0;
-
-    // Copy data from FAT into buffer.
-    while (((int)size > 0) && (curr_block != 0xFFFF)) {
-        bytes_to_read = MIN(BLOCK_SIZE, size);
-        memcpy(buf + buffer_offset, &user_data[curr_block * BLOCK_SIZE], bytes_to_read);
-        buffer_offset += bytes_to_read;
-        size -= bytes_to_read;
-        bytes_read += bytes_to_read;
-        curr_block = main_fat[curr_block];
+    if (is_stats_path(path)) {
+        return (offset < 0) ? -EINVAL : read_stats(buf, size, offset);
     }
 
-    return bytes_read;
+    started = trace_begin();
+    i = -1;
+    if (offset < 0) {
+        result = -EINVAL;
+    } else if ((i = lock_handle(path, fi)) < 0) {
+        // File not found.
+        result = i;
+    } else {
+        result = read_entry(i, file_handle(fi), buf, size, offset);
+    }
+    trace_end(TRACE_READ, path + 1, i, (uint64_t)offset, size, result, started);
+    return result;
 }
 
 static int memefs_readdir(const char* path, void* buf, fuse_fill_dir_t filler, off_t offset, struct fuse_file_info* fi, enum fuse_readdir_flags flags) {
-    (void) offset;
     (void) fi;
-    (void) flags;
-    char readable_filename[MAX_READABLE_FILENAME_LENGTH];
-    int i;
+    enum fuse_fill_dir_flags fill_flags;
+    const char* readable_filename;
+    struct stat stbuf;
+    struct stat* attrs;
+    uint64_t started;
+    int i, full, listed;
 
     if (strcmp(path, "/") != 0) {
         // Not root directory.
         return -ENOENT;
     }
 
-    filler(buf, ".", NULL, 0, 0);
-    filler(buf, "..", NULL, 0, 0);
-    for (i = 0; i < MAX_FILE_ENTRIES; i++) {
-        name_to_readable(directory[i].filename, readable_filename);
-        if (directory[i].type_permissions != 0x0000
-            && strlen(directory[i].filename) > 0
-            && directory[i].filename[0] != '\0'
-            && check_legal_name(readable_filename) == 0) {
-            // Found file.
-            // Convert to readable name.
-            filler(buf, readable_filename, NULL, 0, 0);
-        }
-    }
-
-    return 0;
-}
-
-static int memefs_truncate(const char* path, off_t new_size, struct fuse_file_info* fi) {
-    (void) path;
-    (void) new_size;
-    (void) fi;
-    char readable_filename[MAX_READABLE_FILENAME_LENGTH];
-    int g, h, i, j, k, curr_block, next_block, found;
-    int blocks_in_use, blocks_needed, free_fat_blocks;
-
-    if (strcmp(path, "/") == 0) {
-        // Can't truncate a directory.
-        return -EISDIR;
+    // With readdirplus every name carries its attributes, so listing a directory needs no getattr per file.
+    fill_flags = (flags & FUSE_READDIR_PLUS) ? FUSE_FILL_DIR_PLUS : 0;
+    attrs = (flags & FUSE_READDIR_PLUS) ? &stbuf : NULL;
+
+    // Same offsets as the low level frontend: "." and ".." first, then one past each file's directory entry.
+    started = trace_begin();
+    full = 0;
+    listed = 0;
+    stat_root(&stbuf);
+    for (i = (int)MAX(offset, 0); (i < FIRST_DIR_OFFSET) && !full; i++) {
+        full = filler(buf, (i == 0) ? "." : "..", attrs, i + 1, fill_flags);
     }
 
-    // Find file in directory.
-    for (i = 0, h = 0, found = 0; i < MAX_FILE_ENTRIES && !found; i++) {
-        name_to_readable(directory[i].filename, readable_filename);
-        if ((strcmp(readable_filename, path + 1) == 0) && (directory[i].type_permissions != 0x0000) && (check_legal_name(readable_filename) == 0)) {
-            // Found file.
-            found = 1;
-            h = i;
-            break;
-        }
+    lock_namespace_read();
+    for (i = next_listed_entry((int)MIN(MAX(offset, FIRST_DIR_OFFSET) - FIRST_DIR_OFFSET, (off_t)INT32_MAX), &readable_filename, attrs); (i >= 0) && !full; i = next_listed_entry(i + 1, &readable_filename, attrs)) {
+        // Out of room, FUSE asks again from this entry.
+        full = filler(buf, readable_filename, attrs, i + FIRST_DIR_OFFSET + 1, fill_flags);
+        listed += !full;
     }
+    unlock_namespace();
 
-    if (!found) {
-        // File not found.
-        return -ENOENT;
-    }
+    trace_end(TRACE_READDIR, NULL, -1, (uint64_t)MAX(offset, 0), (uint64_t)listed, 0, started);
+    return 0;
+}
 
-    blocks_in_use = (int)myCeil((double)directory[i].size / (double)BLOCK_SIZE);
-    blocks_needed = (int)myCeil((double)new_size / (double)BLOCK_SIZE);
-    if (blocks_needed == 0) {
-        // Even empty files take up a FAT block.
-        blocks_needed = 1;
-    }
+static int memefs_release(const char* path, struct fuse_file_info* fi) {
+    uint64_t started;
 
-    // Truncate file to smaller size.
-    if (blocks_needed < blocks_in_use) {
-        // Traverse FAT Chain
-        for (g = 1, curr_block = directory[h].start_block; g <= blocks_in_use; g++, curr_block = next_block) {
-            next_block = main_fat[curr_block];
-            if (g == blocks_needed) {
-                // New end of chain block.
-                main_fat[curr_block] = 0xFFFF;
-                backup_fat[curr_block] = 0xFFFF;
-            } else if (g > blocks_needed) {
-                // Blocks after new end of chain.
-                main_fat[curr_block] = 0x0000;
-                backup_fat[curr_block] = 0x0000;
-            }
-        }
+    if (is_stats_path(path)) {
+        return 0;
     }
 
-    // Truncate file to larger size.
-    if (blocks_needed > blocks_in_use) {
-        // Count free FAT blocks.
-        for (k = 0, free_fat_blocks = 0; k < MAX_FAT_ENTRIES; k++) {
-            if (main_fat[k] == 0x0000) {
-                free_fat_blocks++;
-            }
-        }
-        
-        // Check if there are enough free FAT blocks.
-        if ((blocks_needed - blocks_in_use) > free_fat_blocks) {
-            // Not enough free FAT blocks.
-            return -ENOSPC;
-        }
-
-        // Traverse to last block in use
-        for (j = 0, curr_block = directory[h].start_block; j < blocks_in_use; j++) {
-            next_block = main_fat[curr_block];
-            curr_block = next_block;
-        }
+    // Every close already flushed the file in standard mode, so only the handle is left.
+    started = trace_begin();
+    free_open_file(file_handle(fi));
+    trace_end(TRACE_RELEASE, path + 1, -1, 0, 0, 0, started);
+    return 0;
+}
 
-        // Find free blocks in the FAT to extend into.
-        while (j < blocks_needed) {
-            for (i = 0; i < MAX_FAT_ENTRIES; i++) {
-                if (main_fat[i] == 0x0000) {
-                    // Found free block, make use of it.
-                    main_fat[curr_block] = i;
-                    backup_fat[curr_block] = i;
-                    main_fat[i] = 0xFFFF;
-                    backup_fat[i] = 0xFFFF;
-                    curr_block = i;
-                    j++;
-                    break;
-                }
-            }
-        }
-    }
+static int memefs_statfs(const char* path, struct statvfs* stbuf) {
+    (void) path;
+    uint64_t started;
 
-    // Update file size.
-    generate_memefs_timestamp(directory[h].bcd_timestamp);
-    directory[h].size = (uint32_t)new_size;
-    if (unload_image() != 0) {
-        fprintf(stderr, "Failed to unload image after truncate()\n");
-        return -EIO;
-    }
+    started = trace_begin();
+    stat_filesystem(stbuf);
+    trace_end(TRACE_STATFS, NULL, -1, 0, 0, 0, started);
     return 0;
 }
 
-static int memefs_unlink(const char* path) {
-    char readable_filename[MAX_READABLE_FILENAME_LENGTH];
-    int i;
-    uint16_t curr_block, next_block;
+static int memefs_truncate(const char* path, off_t new_size, struct fuse_file_info* fi) {
+    uint64_t started;
+    int h, result;
 
-    // Find file in directory.
-    for (i = 0, curr_block = 0xFFFF; i < MAX_FILE_ENTRIES; i++) {
-        name_to_readable(directory[i].filename, readable_filename);
-        if ((strcmp(readable_filename, path + 1) == 0) && (directory[i].type_permissions != 0x0000) && (check_legal_name(readable_filename) == 0)) {
-            // Found file entry.
-            curr_block = directory[i].start_block;
-            break;
-        }
+    if (strcmp(path, "/") == 0) {
+        // Can't truncate a directory.
+        return -EISDIR;
+    }
+    if (is_stats_path(path)) {
+        return -EACCES;
     }
 
-    if (curr_block == 0xFFFF) {
+    // Find file in directory.
+    started = trace_begin();
+    if ((h = lock_handle(path, fi)) < 0) {
         // File not found.
-        return -ENOENT;
+        result = h;
+    } else {
+        result = truncate_entry(h, new_size);
     }
+    trace_end(TRACE_TRUNCATE, path + 1, h, (uint64_t)new_size, 0, result, started);
+    return result;
+}
 
-    // Unlink file from FAT.
-    for (next_block = 0xFFFF; curr_block != 0xFFFF; curr_block = next_block) {
-        next_block = main_fat[curr_block];
-        main_fat[curr_block] = 0x0000;
-        backup_fat[curr_block] = 0x0000;
-    }
-    directory[i].type_permissions = 0x0000;
+static int memefs_unlink(const char* path) {
+    uint64_t started;
+    int result;
 
-    if (unload_image() != 0) {
-        fprintf(stderr, "Failed to unload image after unlink()\n");
-        return -EIO;
-    }
-    return 0;
+    started = trace_begin();
+    result = unlink_entry(path + 1);
+    trace_end(TRACE_UNLINK, path + 1, -1, 0, 0, result, started);
+    return result;
 }
 
 static int memefs_utimens(const char* path, const struct timespec tv[2], struct fuse_file_info* fi) {
@@ -394,65 +444,142 @@ static int memefs_utimens(const char* path, const struct timespec tv[2], struct
     return 0;
 }
 
-static int memefs_write(const char* path, const char* buf, size_t size, off_t offset, struct fuse_file_info* fi) {
-    (void) fi;
-    char readable_filename[MAX_READABLE_FILENAME_LENGTH];
-    int i;
-    write_type_t write_type;
-
-    write_type = INVALID;
-    for (i = 0; i < MAX_FILE_ENTRIES; i++) {
-        name_to_readable(directory[i].filename, readable_filename);
-        if ((strcmp(readable_filename, path + 1) == 0) && (directory[i].type_permissions != 0x0000) && (check_legal_name(path + 1) == 0)) {
-            // Found file.
-            if (offset < directory[i].size) {
-                write_type = OVERWRITE;
-                break;
-            } else if (offset == directory[i].size) {
-                write_type = APPEND;
-                break;
-            }
-        }
+static int memefs_write_buf(const char* path, struct fuse_bufvec* buf, off_t offset, struct fuse_file_info* fi) {
+    uint64_t started;
+    size_t size;
+    int i, result;
+
+    started = trace_begin();
+    size = fuse_buf_size(buf);
+    if ((i = lock_handle(path, fi)) < 0) {
+        // File not found.
+        result = i;
+    } else {
+        result = write_entry(i, buf, offset);
     }
+    trace_end(TRACE_WRITE, path + 1, i, (uint64_t)offset, size, result, started);
+    return result;
+}
 
-    switch (write_type) {
-        case OVERWRITE:
-            if (overwrite_file(&directory[i], buf, size) != 0) {
-                return -ENOSPC;
-            }            
-            break;
-        case APPEND:
-            if (append_file(&directory[i], buf, size) != 0) {
-                return -ENOSPC;
-            }
-            break;
-        case INVALID:
-            return -ENOENT;
+#pragma endregion FUSE Implementations
+
+#pragma region Implementations
+
+static open_file_t* file_handle(struct fuse_file_info* fi) {
+    return (fi != NULL) ? (open_file_t*)(uintptr_t)fi->fh : NULL;
+}
+
+static int is_stats_path(const char* path) {
+    return strcmp(path + 1, STATS_FILE_NAME) == 0;
+}
+
+static void invalidate_path(uint64_t inode, const char* readable_name, int changes) {
+    (void) inode;
+    (void) changes;
+    char path[MAX_READABLE_FILENAME_LENGTH + 1];
+
+    // Paths are all the high level API offers, and dropping one drops everything cached under it.
+    snprintf(path, sizeof(path), "/%s", readable_name);
+    fuse_invalidate_path(mounted_fuse, path);
+}
+
+static int lock_handle(const char* path, struct fuse_file_info* fi) {
+    open_file_t* handle;
+
+    if ((handle = file_handle(fi)) != NULL) {
+        return lock_open_file(handle);
     }
-            
-    generate_memefs_timestamp(directory[i].bcd_timestamp);
-    if (unload_image() != 0) {
-        fprintf(stderr, "Failed to unload image after write()\n");
-        return -EIO;
+    return lock_named_entry(path + 1);
+}
+
+static int sync_path(const char* path, struct fuse_file_info* fi, int datasync, trace_op_t op, uint64_t started) {
+    int i, result;
+
+    if ((i = lock_handle(path, fi)) < 0) {
+        // File not found.
+        result = i;
+    } else if (sync_entry(i, datasync) != 0) {
+        fprintf(stderr, "Failed to flush %s\n", path);
+        result = -EIO;
+    } else {
+        result = 0;
     }
-    return (int)size;
+    trace_end(op, path + 1, i, 0, 0, result, started);
+    return result;
 }
 
-#pragma endregion FUSE Implementations
+#pragma endregion Implementations
 
 int main(int argc, char* argv[]) {
+	struct fuse_args args = FUSE_ARGS_INIT(argc - 1, argv + 1);
+	kernel_cache_config_t cache_config;
+	int result;
+
 	if (argc < 2) {
-    	fprintf(stderr, "Usage: %s <filesystem image> <mount point>\n", argv[0]);
+    	fprintf(stderr, "Usage: %s <filesystem image> <mount point> [-o alloc=first|next|best] [-o lowlevel] [-o kernel_cache|no_kernel_cache] [-o attr_timeout=<s>] [-o entry_timeout=<s>] [-o negative_timeout=<s>] [-o mmap] [-o lazy] [-o readahead=<blocks>] [-o cache_size=<MiB>] [-o durability=sync|standard|relaxed] [-o flush_interval=<ms>] [-o dirty_limit=<KiB>] [-o trace=<file>] [-o events=<file>]\n", argv[0]);
     	return 1;
 	}
 
+	// Parse memefs mount options, leaving the rest for FUSE.
+	options.readahead = -1;
+	options.attr_timeout = DEFAULT_ATTR_TIMEOUT;
+	options.entry_timeout = DEFAULT_ENTRY_TIMEOUT;
+	options.negative_timeout = DEFAULT_NEGATIVE_TIMEOUT;
+	options.kernel_cache = 1;
+	if (fuse_opt_parse(&args, &options, memefs_opts, NULL) == -1) {
+		return 1;
+	}
+	if ((options.alloc_policy != NULL) && (set_alloc_policy(options.alloc_policy) != 0)) {
+		fprintf(stderr, "Unknown allocation policy: %s\n", options.alloc_policy);
+		fuse_opt_free_args(&args);
+		return 1;
+	}
+
+	if ((options.durability != NULL) && (set_durability(options.durability) != 0)) {
+		fprintf(stderr, "Unknown durability mode: %s\n", options.durability);
+		fuse_opt_free_args(&args);
+		return 1;
+	}
+	if (options.flush_interval != 0) {
+		set_flush_interval(options.flush_interval);
+	}
+	if (options.dirty_limit != 0) {
+		set_dirty_limit(options.dirty_limit * 1024);
+	}
+
+	use_mmap = options.use_mmap;
+	// A mapping already faults blocks in on demand.
+	set_lazy_loading(options.lazy && !options.use_mmap);
+	if (options.readahead >= 0) {
+		set_readahead((uint32_t)options.readahead);
+	}
+	set_cache_size((uint64_t)options.cache_size * 1024 * 1024);
+
 	// Open filesystem image
 	img_fd = open(argv[1], O_RDWR);
 	if (img_fd < 0) {
     	perror("Failed to open filesystem image");
+		fuse_opt_free_args(&args);
     	return 1;
 	}
 
-	return (load_image() ? 1 : fuse_main(argc - 1, argv + 1, &memefs_oper, NULL));
+	if (load_image()) {
+		result = 1;
+	} else if ((options.trace != NULL) && (start_trace(options.trace) != 0)) {
+		result = 1;
+	} else if ((options.events != NULL) && (set_event_file(options.events) != 0)) {
+		result = 1;
+	} else if (options.lowlevel) {
+		cache_config.attr_timeout = options.attr_timeout;
+		cache_config.entry_timeout = options.entry_timeout;
+		cache_config.negative_timeout = options.negative_timeout;
+		cache_config.kernel_cache = options.kernel_cache;
+		result = run_lowlevel(&args, &cache_config);
+	} else {
+		result = fuse_main(args.argc, args.argv, &memefs_oper, NULL);
+	}
+	stop_trace();
+	fuse_opt_free_args(&args);
+	return result;
 }
 
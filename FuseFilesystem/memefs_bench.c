@@ -0,0 +1,347 @@
+// File:    memefs_bench.c
+// Author:  Eric Ekey
+// Date:    10/16/2026
+// Desc:    In-process microbenchmarks for the memefs engine, run against an image without mounting it.
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "allocator.h"
+#include "block_cache.h"
+#include "define.h"
+#include "file_ops.h"
+#include "geometry.h"
+#include "loaders.h"
+#include "timing.h"
+#include "writeback.h"
+
+#define DEFAULT_OPS 10000     // Operations per benchmark, unless the image runs out of room first.
+#define DEFAULT_SEQ_MIB 16    // Size of the large file streamed by the sequential benchmarks.
+#define SEQ_CHUNK (128 * 1024) // Bytes per sequential read or write, the most FUSE sends at once.
+#define SMALL_APPEND 64       // Bytes per small append.
+#define OVERWRITE_SIZE 4096   // Bytes per random overwrite and per truncate step.
+#define BIG_FILE "bigfile.dat"
+
+#pragma region Globals
+
+extern int img_fd;
+extern int use_mmap;
+extern memefs_geometry_t geometry;
+
+// Latencies of one benchmark's operations.
+typedef struct samples {
+    uint64_t* latencies; // Nanoseconds per operation.
+    size_t count;
+    uint64_t bytes;      // Bytes read or written, 0 for metadata benchmarks.
+    uint64_t start;      // When the benchmark started.
+} samples_t;
+
+static uint32_t rng_state = 0x9E3779B9; // Fixed seed, so every run overwrites the same offsets.
+
+#pragma endregion Globals
+
+#pragma region Prototypes
+
+// static void check(int, const char*)
+// Description: Exits if an op failed, since later benchmarks depend on earlier ones.
+// Preconditions: None.
+// Postconditions: Process exits if result is negative.
+// Returns: None.
+static void check(int result, const char* what);
+
+// static void finish(samples_t*, const char*)
+// Description: Prints a benchmark's throughput and latency percentiles.
+// Preconditions: samples was started with start_samples.
+// Postconditions: Row is printed and the samples are freed.
+// Returns: None.
+static void finish(samples_t* samples, const char* name);
+
+// static uint32_t next_random()
+// Description: Steps a xorshift generator.
+// Preconditions: None.
+// Postconditions: Generator has advanced.
+// Returns: Next pseudo random number.
+static uint32_t next_random();
+
+// static void record(samples_t*, uint64_t, size_t)
+// Description: Records one operation that started at a given time.
+// Preconditions: samples has room for another operation.
+// Postconditions: Operation's latency and bytes are counted.
+// Returns: None.
+static void record(samples_t* samples, uint64_t op_start, size_t bytes);
+
+// static void start_samples(samples_t*, size_t)
+// Description: Starts a benchmark of up to a number of operations.
+// Preconditions: None.
+// Postconditions: samples is empty and its clock is running. Exits if out of memory.
+// Returns: None.
+static void start_samples(samples_t* samples, size_t max_ops);
+
+// static void usage(const char*)
+// Description: Prints the command line usage.
+// Preconditions: None.
+// Postconditions: None.
+// Returns: None.
+static void usage(const char* prog);
+
+// static int write_name(const char*, const char*, size_t, off_t)
+// Description: Writes to a file found by name.
+// Preconditions: Namespace lock is not held.
+// Postconditions: Data is written.
+// Returns: Bytes written on success, < 0 on failure.
+static int write_name(const char* readable_name, const char* buf, size_t size, off_t offset);
+
+#pragma endregion Prototypes
+
+#pragma region Implementations
+
+static void check(int result, const char* what) {
+    if (result < 0) {
+        fprintf(stderr, "%s failed: %s\n", what, strerror(-result));
+        exit(1);
+    }
+}
+
+static void finish(samples_t* samples, const char* name) {
+    double seconds;
+    size_t n;
+
+    seconds = (double)(monotonic_ns() - samples->start) / 1e9;
+    n = samples->count;
+    if (n == 0) {
+        printf("%-18s %8s\n", name, "skipped");
+        free(samples->latencies);
+        return;
+    }
+
+    qsort(samples->latencies, n, sizeof(uint64_t), compare_ns);
+    printf("%-18s %8zu %12.1f ", name, n, (double)n / seconds);
+    if (samples->bytes > 0) {
+        printf("%9.1f ", (double)samples->bytes / (1024.0 * 1024.0) / seconds);
+    } else {
+        printf("%9s ", "-");
+    }
+    printf("%9.1f %9.1f %9.1f %9.1f\n", samples->latencies[n / 2] / 1e3, samples->latencies[(n * 90) / 100] / 1e3,
+           samples->latencies[(n * 99) / 100] / 1e3, samples->latencies[n - 1] / 1e3);
+    free(samples->latencies);
+}
+
+static uint32_t next_random() {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 17;
+    rng_state ^= rng_state << 5;
+    return rng_state;
+}
+
+static void record(samples_t* samples, uint64_t op_start, size_t bytes) {
+    samples->latencies[samples->count++] = monotonic_ns() - op_start;
+    samples->bytes += bytes;
+}
+
+static void start_samples(samples_t* samples, size_t max_ops) {
+    if ((samples->latencies = malloc(MAX(max_ops, 1) * sizeof(uint64_t))) == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+    samples->count = 0;
+    samples->bytes = 0;
+    samples->start = monotonic_ns();
+}
+
+static void usage(const char* prog) {
+    fprintf(stderr, "Usage: %s [-n ops] [-s seq_MiB] [-a first|next|best] [-D sync|standard|relaxed] "
+            "[-c cache_MiB] [-r readahead] [-l] [-m] <filesystem image>\n", prog);
+}
+
+static int write_name(const char* readable_name, const char* buf, size_t size, off_t offset) {
+    struct fuse_bufvec src = FUSE_BUFVEC_INIT(size);
+    int i;
+
+    if ((i = lock_named_entry(readable_name)) < 0) {
+        return i;
+    }
+    src.buf[0].mem = (void*)buf;
+    return write_entry(i, &src, offset);
+}
+
+#pragma endregion Implementations
+
+int main(int argc, char* argv[]) {
+    char (*names)[MAX_READABLE_FILENAME_LENGTH];
+    uint64_t seq_bytes, max_bytes, op_start, off;
+    size_t num_ops, num_files, num_appends, k, steps;
+    uint32_t* sizes;
+    open_file_t* handle;
+    samples_t samples;
+    struct stat stbuf;
+    char* buf;
+    int opt, i, lazy;
+
+    num_ops = DEFAULT_OPS;
+    seq_bytes = (uint64_t)DEFAULT_SEQ_MIB * 1024 * 1024;
+    lazy = 0;
+    while ((opt = getopt(argc, argv, "n:s:a:D:c:r:lm")) != -1) {
+        switch (opt) {
+            case 'n': num_ops = strtoul(optarg, NULL, 10); break;
+            case 's': seq_bytes = strtoull(optarg, NULL, 10) * 1024 * 1024; break;
+            case 'a':
+                if (set_alloc_policy(optarg) != 0) {
+                    fprintf(stderr, "Unknown allocation policy: %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'D':
+                if (set_durability(optarg) != 0) {
+                    fprintf(stderr, "Unknown durability mode: %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'c': set_cache_size(strtoull(optarg, NULL, 10) * 1024 * 1024); break;
+            case 'r': set_readahead((uint32_t)strtoul(optarg, NULL, 10)); break;
+            case 'l': lazy = 1; break;
+            case 'm': use_mmap = 1; break;
+            default: usage(argv[0]); return 1;
+        }
+    }
+    if (optind != argc - 1 || num_ops == 0) {
+        usage(argv[0]);
+        return 1;
+    }
+    set_lazy_loading(lazy && !use_mmap);
+
+    // Everything the benchmarks create is removed again, so the image can be reused.
+    if ((img_fd = open(argv[optind], O_RDWR)) < 0) {
+        perror("Failed to open filesystem image");
+        return 1;
+    }
+    if (load_image() != 0) {
+        return 1;
+    }
+    start_filesystem();
+
+    // Leave room for the large file, then split the rest between the small files' first blocks and the appends.
+    max_bytes = (uint64_t)free_block_count() * geometry.block_size;
+    seq_bytes = MIN(seq_bytes, max_bytes / 2) / SEQ_CHUNK * SEQ_CHUNK;
+    num_files = MIN(num_ops, (size_t)geometry.max_file_entries - 1);
+    num_files = MIN(num_files, (size_t)((max_bytes - seq_bytes) / 2 / geometry.block_size));
+    num_appends = MIN(num_ops, (size_t)((max_bytes - seq_bytes) / 2 / SMALL_APPEND));
+    names = malloc(MAX(num_files, 1) * sizeof(*names));
+    sizes = calloc(MAX(num_files, 1), sizeof(uint32_t));
+    buf = malloc(SEQ_CHUNK);
+    if (names == NULL || sizes == NULL || buf == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+    for (k = 0; k < SEQ_CHUNK; k++) {
+        buf[k] = (char)(k * 31 + k / 4096);
+    }
+
+    printf("v%u image, %u byte blocks, %u user blocks, %u directory entries, %zu small files, %llu MiB sequential\n",
+           geometry.version, geometry.block_size, geometry.user_data_num_blocks, geometry.max_file_entries, num_files,
+           (unsigned long long)(seq_bytes / (1024 * 1024)));
+    printf("%-18s %8s %12s %9s %9s %9s %9s %9s\n", "benchmark", "ops", "ops/s", "MiB/s", "p50 us", "p90 us", "p99 us", "max us");
+
+    start_samples(&samples, num_files);
+    for (k = 0; k < num_files; k++) {
+        snprintf(names[k], MAX_READABLE_FILENAME_LENGTH, "b%06u.dat", (unsigned)(k % 1000000));
+        op_start = monotonic_ns();
+        check(create_entry(names[k], NULL), "create");
+        record(&samples, op_start, 0);
+    }
+    finish(&samples, "create");
+
+    start_samples(&samples, num_ops);
+    for (k = 0; (k < num_ops) && (num_files > 0); k++) {
+        op_start = monotonic_ns();
+        check(i = lock_named_entry(names[next_random() % num_files]), "getattr");
+        stat_entry(i, &stbuf);
+        record(&samples, op_start, 0);
+    }
+    finish(&samples, "getattr");
+
+    start_samples(&samples, num_appends);
+    for (k = 0; (k < num_appends) && (num_files > 0); k++) {
+        op_start = monotonic_ns();
+        check(write_name(names[k % num_files], buf, SMALL_APPEND, sizes[k % num_files]), "append");
+        sizes[k % num_files] += SMALL_APPEND;
+        record(&samples, op_start, SMALL_APPEND);
+    }
+    finish(&samples, "small append");
+
+    // The large file goes through an open file's handle, as reads and writes on a descriptor do.
+    check(i = create_entry(BIG_FILE, &stbuf), "create");
+    if ((handle = new_open_file((uint64_t)stbuf.st_ino)) == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+
+    start_samples(&samples, seq_bytes / SEQ_CHUNK);
+    for (off = 0; off < seq_bytes; off += SEQ_CHUNK) {
+        struct fuse_bufvec src = FUSE_BUFVEC_INIT(SEQ_CHUNK);
+
+        src.buf[0].mem = buf;
+        op_start = monotonic_ns();
+        check(i = lock_open_file(handle), "sequential write");
+        check(write_entry(i, &src, (off_t)off), "sequential write");
+        record(&samples, op_start, SEQ_CHUNK);
+    }
+    finish(&samples, "sequential write");
+
+    start_samples(&samples, seq_bytes / SEQ_CHUNK);
+    for (off = 0; off < seq_bytes; off += SEQ_CHUNK) {
+        op_start = monotonic_ns();
+        check(i = lock_open_file(handle), "sequential read");
+        check(read_entry(i, handle, buf, SEQ_CHUNK, (off_t)off), "sequential read");
+        record(&samples, op_start, SEQ_CHUNK);
+    }
+    finish(&samples, "sequential read");
+
+    steps = (size_t)(seq_bytes / OVERWRITE_SIZE);
+    start_samples(&samples, num_ops);
+    for (k = 0; (k < num_ops) && (steps > 0); k++) {
+        struct fuse_bufvec src = FUSE_BUFVEC_INIT(OVERWRITE_SIZE);
+
+        src.buf[0].mem = buf;
+        off = (uint64_t)(next_random() % steps) * OVERWRITE_SIZE;
+        op_start = monotonic_ns();
+        check(i = lock_open_file(handle), "random overwrite");
+        check(write_entry(i, &src, (off_t)off), "random overwrite");
+        record(&samples, op_start, OVERWRITE_SIZE);
+    }
+    finish(&samples, "random overwrite");
+
+    // Shrinks the large file from the end, freeing a few blocks each time.
+    steps = MIN(steps, num_ops);
+    start_samples(&samples, steps);
+    for (k = 1; k <= steps; k++) {
+        op_start = monotonic_ns();
+        check(i = lock_open_file(handle), "truncate");
+        check(truncate_entry(i, (off_t)(seq_bytes - (uint64_t)k * OVERWRITE_SIZE)), "truncate");
+        record(&samples, op_start, 0);
+    }
+    finish(&samples, "truncate");
+    free_open_file(handle);
+
+    start_samples(&samples, num_files + 1);
+    for (k = 0; k < num_files; k++) {
+        op_start = monotonic_ns();
+        check(unlink_entry(names[k]), "unlink");
+        record(&samples, op_start, 0);
+    }
+    op_start = monotonic_ns();
+    check(unlink_entry(BIG_FILE), "unlink");
+    record(&samples, op_start, 0);
+    finish(&samples, "unlink");
+
+    free(names);
+    free(sizes);
+    free(buf);
+    stop_filesystem();
+    return 0;
+}
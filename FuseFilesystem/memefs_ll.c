@@ -0,0 +1,721 @@
+// File:    memefs_ll.c
+// Author:  Eric Ekey
+// Date:    10/16/2026
+// Desc:    FUSE low level frontend for memefs, addressing files by inode number instead of path.
+
+#include "memefs_ll.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fuse3/fuse_lowlevel.h>
+
+#include "block_cache.h"
+#include "define.h"
+#include "dir_index.h"
+#include "file_ops.h"
+#include "locks.h"
+#include "memefs_ioctl.h"
+#include "stats.h"
+#include "trace.h"
+#include "writeback.h"
+
+#define HANDLE(fi) ((open_file_t*)(uintptr_t)(fi)->fh) // Handle open or create stored for a file, NULL for the root.
+
+static kernel_cache_config_t cache_config; // How long the kernel may cache replies.
+static struct fuse_session* session = NULL;
+
+#pragma region FUSE Prototypes
+
+// FUSE low level operations.
+static void memefs_ll_create(fuse_req_t req, fuse_ino_t parent, const char* name, mode_t mode, struct fuse_file_info* fi);
+static void memefs_ll_destroy(void* userdata);
+static void memefs_ll_flush(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info* fi);
+static void memefs_ll_forget(fuse_req_t req, fuse_ino_t ino, uint64_t nlookup);
+static void memefs_ll_forget_multi(fuse_req_t req, size_t count, struct fuse_forget_data* forgets);
+static void memefs_ll_fsync(fuse_req_t req, fuse_ino_t ino, int datasync, struct fuse_file_info* fi);
+static void memefs_ll_getattr(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info* fi);
+static void memefs_ll_init(void* userdata, struct fuse_conn_info* conn);
+static void memefs_ll_ioctl(fuse_req_t req, fuse_ino_t ino, unsigned int cmd, void* arg, struct fuse_file_info* fi, unsigned flags, const void* in_buf, size_t in_bufsz, size_t out_bufsz);
+static void memefs_ll_lookup(fuse_req_t req, fuse_ino_t parent, const char* name);
+static void memefs_ll_open(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info* fi);
+static void memefs_ll_read(fuse_req_t req, fuse_ino_t ino, size_t size, off_t offset, struct fuse_file_info* fi);
+static void memefs_ll_readdir(fuse_req_t req, fuse_ino_t ino, size_t size, off_t offset, struct fuse_file_info* fi);
+static void memefs_ll_readdirplus(fuse_req_t req, fuse_ino_t ino, size_t size, off_t offset, struct fuse_file_info* fi);
+static void memefs_ll_release(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info* fi);
+static void memefs_ll_setattr(fuse_req_t req, fuse_ino_t ino, struct stat* attr, int to_set, struct fuse_file_info* fi);
+static void memefs_ll_statfs(fuse_req_t req, fuse_ino_t ino);
+static void memefs_ll_unlink(fuse_req_t req, fuse_ino_t parent, const char* name);
+static void memefs_ll_write_buf(fuse_req_t req, fuse_ino_t ino, struct fuse_bufvec* bufv, off_t offset, struct fuse_file_info* fi);
+
+#pragma endregion FUSE Prototypes
+
+#pragma region Prototypes
+
+// static size_t add_dir_entry(fuse_req_t, char*, size_t, const char*, const struct stat*, off_t, int)
+// Description: Adds a name to a readdir reply, with its attributes and a lookup of it if plus is set.
+// Preconditions: attr was filled in by file_ops, so st_ino holds the inode number.
+// Postconditions: Entry is in buf if it fit.
+// Returns: Size of the entry, larger than size if it didn't fit.
+static size_t add_dir_entry(fuse_req_t req, char* buf, size_t size, const char* name, const struct stat* attr, off_t offset, int plus);
+
+// static void fill_entry_param(struct fuse_entry_param*, const struct stat*)
+// Description: Describes a file to the kernel as a lookup of it would.
+// Preconditions: attr was filled in by file_ops, so st_ino holds the inode number.
+// Postconditions: entry holds the inode, generation, attributes and how long to trust them.
+// Returns: None.
+static void fill_entry_param(struct fuse_entry_param* entry, const struct stat* attr);
+
+// static void invalidate_inode(uint64_t, const char*, int)
+// Description: Change notifier dropping what the kernel cached about a file's inode and name.
+// Preconditions: Session is mounted. No memefs lock is held.
+// Postconditions: Kernel rereads whatever changed on next use.
+// Returns: None.
+static void invalidate_inode(uint64_t inode, const char* readable_name, int changes);
+
+// static int lock_inode(fuse_ino_t)
+// Description: Finds the directory entry for an inode number and takes the namespace lock for reading.
+// Preconditions: Namespace lock is not held.
+// Postconditions: Namespace lock is held for reading if the file was found.
+// Returns: Directory entry index on success, -ENOENT if the file is gone.
+static int lock_inode(fuse_ino_t ino);
+
+// static void reply_data(void*, struct fuse_bufvec*)
+// Description: Sender for send_entry, replying to a read with the file's blocks.
+// Preconditions: req is the read request.
+// Postconditions: Request is answered, and the data copied into the kernel.
+// Returns: None.
+static void reply_data(void* req, struct fuse_bufvec* bufv);
+
+// static void reply_dir(fuse_req_t, fuse_ino_t, size_t, off_t, int)
+// Description: Replies to a readdir, or a readdirplus if plus is set, with the names from an offset on, and records it.
+// Preconditions: None.
+// Postconditions: Request is answered.
+// Returns: None.
+static void reply_dir(fuse_req_t req, fuse_ino_t ino, size_t size, off_t offset, int plus);
+
+// static void reply_entry(fuse_req_t, const struct stat*, struct fuse_file_info*)
+// Description: Replies to a lookup, or a create if fi is not NULL, with a file's inode and attributes.
+// Preconditions: attr was filled in by file_ops, so st_ino holds the inode number.
+// Postconditions: Request is answered.
+// Returns: None.
+static void reply_entry(fuse_req_t req, const struct stat* attr, struct fuse_file_info* fi);
+
+// static void reply_stats(fuse_req_t, size_t, off_t)
+// Description: Replies to a read of the stats file.
+// Preconditions: None.
+// Postconditions: Request is answered.
+// Returns: None.
+static void reply_stats(fuse_req_t req, size_t size, off_t offset);
+
+// static void reply_sync(fuse_req_t, fuse_ino_t, int, trace_op_t, uint64_t)
+// Description: Forces a file out to the image, replies with the result and records it as op.
+// Preconditions: started came from trace_begin.
+// Postconditions: Request is answered.
+// Returns: None.
+static void reply_sync(fuse_req_t req, fuse_ino_t ino, int datasync, trace_op_t op, uint64_t started);
+
+#pragma endregion Prototypes
+
+#pragma region FUSE Implementations
+
+// FUSE low level operations.
+static const struct fuse_lowlevel_ops memefs_ll_oper = {
+    .create       = memefs_ll_create,
+    .destroy      = memefs_ll_destroy,
+    .flush        = memefs_ll_flush,
+    .forget       = memefs_ll_forget,
+    .forget_multi = memefs_ll_forget_multi,
+    .fsync        = memefs_ll_fsync,
+    .getattr      = memefs_ll_getattr,
+    .init         = memefs_ll_init,
+    .ioctl        = memefs_ll_ioctl,
+    .lookup       = memefs_ll_lookup,
+    .open         = memefs_ll_open,
+    .read         = memefs_ll_read,
+    .readdir      = memefs_ll_readdir,
+    .readdirplus  = memefs_ll_readdirplus,
+    .release      = memefs_ll_release,
+    .setattr      = memefs_ll_setattr,
+    .statfs       = memefs_ll_statfs,
+    .unlink       = memefs_ll_unlink,
+    .write_buf    = memefs_ll_write_buf,
+};
+
+static void memefs_ll_create(fuse_req_t req, fuse_ino_t parent, const char* name, mode_t mode, struct fuse_file_info* fi) {
+    (void) mode;
+    open_file_t* handle;
+    struct stat attr;
+    uint64_t started;
+    int i, result;
+
+    started = trace_begin();
+    i = -1;
+    if (parent != ROOT_INODE) {
+        // Only the root directory exists.
+        result = -ENOENT;
+    } else if ((i = create_entry(name, &attr)) < 0) {
+        result = i;
+    } else if ((handle = new_open_file((uint64_t)attr.st_ino)) == NULL) {
+        result = -ENOMEM;
+    } else {
+        fi->fh = (uint64_t)(uintptr_t)handle;
+        result = 0;
+    }
+    if (result == 0) {
+        reply_entry(req, &attr, fi);
+    } else {
+        fuse_reply_err(req, -result);
+    }
+    trace_end(TRACE_CREATE, name, i, 0, 0, result, started);
+}
+
+static void memefs_ll_destroy(void* userdata) {
+    (void) userdata;
+
+    stop_filesystem();
+}
+
+static void memefs_ll_flush(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info* fi) {
+    (void) fi;
+    uint64_t started;
+
+    if (ino == STATS_INODE) {
+        fuse_reply_err(req, 0);
+        return;
+    }
+
+    started = trace_begin();
+    if (get_durability() != DURABILITY_STANDARD) {
+        // Sync mode has nothing pending, relaxed mode leaves it to the flusher.
+        fuse_reply_err(req, 0);
+        trace_end(TRACE_FLUSH, NULL, -1, 0, 0, 0, started);
+        return;
+    }
+    reply_sync(req, ino, 1, TRACE_FLUSH, started);
+}
+
+static void memefs_ll_forget(fuse_req_t req, fuse_ino_t ino, uint64_t nlookup) {
+    (void) ino;
+    (void) nlookup;
+
+    // Nothing is held per lookup, a reused entry is told apart by its generation.
+    fuse_reply_none(req);
+}
+
+static void memefs_ll_forget_multi(fuse_req_t req, size_t count, struct fuse_forget_data* forgets) {
+    (void) count;
+    (void) forgets;
+
+    fuse_reply_none(req);
+}
+
+static void memefs_ll_fsync(fuse_req_t req, fuse_ino_t ino, int datasync, struct fuse_file_info* fi) {
+    (void) fi;
+
+    reply_sync(req, ino, datasync, TRACE_FSYNC, trace_begin());
+}
+
+static void memefs_ll_getattr(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info* fi) {
+    (void) fi;
+    struct stat attr;
+    uint64_t started;
+    int i;
+
+    if (ino == STATS_INODE) {
+        stat_stats_file(&attr);
+        fuse_reply_attr(req, &attr, cache_config.attr_timeout);
+        return;
+    }
+
+    started = trace_begin();
+    i = -1;
+    if (ino == ROOT_INODE) {
+        stat_root(&attr);
+    } else if ((i = lock_inode(ino)) < 0) {
+        fuse_reply_err(req, -i);
+        trace_end(TRACE_GETATTR, NULL, -1, 0, 0, i, started);
+        return;
+    } else {
+        stat_entry(i, &attr);
+    }
+    fuse_reply_attr(req, &attr, cache_config.attr_timeout);
+    trace_end(TRACE_GETATTR, NULL, i, 0, 0, 0, started);
+}
+
+static void memefs_ll_init(void* userdata, struct fuse_conn_info* conn) {
+    (void) userdata;
+
+    // Writes arrive in a pipe read straight into the blocks, reads leave from the blocks through one.
+    // Listings carry each file's attributes, so ls -l needs no lookup per file.
+    conn->want |= conn->capable & (FUSE_CAP_SPLICE_READ | FUSE_CAP_SPLICE_WRITE | FUSE_CAP_READDIRPLUS);
+
+    start_filesystem();
+}
+
+static void memefs_ll_ioctl(fuse_req_t req, fuse_ino_t ino, unsigned int cmd, void* arg, struct fuse_file_info* fi, unsigned flags, const void* in_buf, size_t in_bufsz, size_t out_bufsz) {
+    (void) arg;
+    (void) fi;
+    (void) in_buf;
+    (void) in_bufsz;
+    memefs_cache_stats_t stats;
+    int i, result;
+
+    if (flags & FUSE_IOCTL_COMPAT) {
+        fuse_reply_err(req, ENOSYS);
+        return;
+    }
+
+    switch (cmd) {
+        case MEMEFS_IOC_CACHE_STATS:
+            if (out_bufsz < sizeof(stats)) {
+                fuse_reply_err(req, EINVAL);
+                return;
+            }
+            get_cache_stats(&stats);
+            fuse_reply_ioctl(req, 0, &stats, sizeof(stats));
+            return;
+        case MEMEFS_IOC_DEFRAG:
+            if ((i = lock_inode(ino)) < 0) {
+                result = i;
+            } else {
+                result = defragment_entry(i);
+            }
+            break;
+        case MEMEFS_IOC_DEFRAG_ALL:
+            result = defragment_every_entry();
+            break;
+        default:
+            result = -ENOTTY;
+            break;
+    }
+
+    if (result < 0) {
+        fuse_reply_err(req, -result);
+        return;
+    }
+    fuse_reply_ioctl(req, 0, NULL, 0);
+}
+
+static void memefs_ll_lookup(fuse_req_t req, fuse_ino_t parent, const char* name) {
+    struct stat attr;
+    uint64_t started;
+    int i;
+
+    if (parent != ROOT_INODE) {
+        fuse_reply_err(req, ENOENT);
+        return;
+    }
+    if (strcmp(name, STATS_FILE_NAME) == 0) {
+        // Not a directory entry, and left out of the counts it shows.
+        stat_stats_file(&attr);
+        reply_entry(req, &attr, NULL);
+        return;
+    }
+
+    started = trace_begin();
+    lock_namespace_read();
+    if ((i = lookup_file_entry(name)) < 0) {
+        // File not found.
+        unlock_namespace();
+        if ((i == -ENOENT) && (cache_config.negative_timeout > 0)) {
+            // Inode 0 lets the kernel remember the name is free, until a create through it.
+            memset(&attr, 0, sizeof(attr));
+            reply_entry(req, &attr, NULL);
+        } else {
+            fuse_reply_err(req, -i);
+        }
+        trace_end(TRACE_LOOKUP, name, -1, 0, 0, i, started);
+        return;
+    }
+    stat_entry(i, &attr);
+    reply_entry(req, &attr, NULL);
+    trace_end(TRACE_LOOKUP, name, i, 0, 0, 0, started);
+}
+
+static void memefs_ll_open(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info* fi) {
+    open_file_t* handle;
+    uint64_t started;
+    int i;
+
+    fi->fh = 0;
+    if (ino == STATS_INODE) {
+        // Formatted anew by every read, so the kernel must not cache it or trust its size.
+        if ((fi->flags & O_ACCMODE) != O_RDONLY) {
+            fuse_reply_err(req, EACCES);
+            return;
+        }
+        fi->direct_io = 1;
+        fuse_reply_open(req, fi);
+        return;
+    }
+    if (ino != ROOT_INODE) {
+        started = trace_begin();
+        if ((i = lock_inode(ino)) < 0) {
+            fuse_reply_err(req, -i);
+            trace_end(TRACE_OPEN, NULL, -1, 0, 0, i, started);
+            return;
+        }
+        unlock_namespace();
+        if ((handle = new_open_file((uint64_t)ino)) == NULL) {
+            fuse_reply_err(req, ENOMEM);
+            trace_end(TRACE_OPEN, NULL, i, 0, 0, -ENOMEM, started);
+            return;
+        }
+        fi->fh = (uint64_t)(uintptr_t)handle;
+        trace_end(TRACE_OPEN, NULL, i, 0, 0, 0, started);
+    }
+    fi->keep_cache = cache_config.kernel_cache;
+    fuse_reply_open(req, fi);
+}
+
+static void memefs_ll_read(fuse_req_t req, fuse_ino_t ino, size_t size, off_t offset, struct fuse_file_info* fi) {
+    uint64_t started;
+    int i, result;
+
+    if (ino == STATS_INODE) {
+        reply_stats(req, size, offset);
+        return;
+    }
+
+    started = trace_begin();
+    i = -1;
+    if (offset < 0) {
+        result = -EINVAL;
+    } else if ((i = lock_inode(ino)) < 0) {
+        result = i;
+    } else {
+        // Replied to from the blocks themselves, before they are unpinned.
+        result = send_entry(i, HANDLE(fi), size, offset, reply_data, req);
+    }
+    if (result < 0) {
+        fuse_reply_err(req, -result);
+    }
+    trace_end(TRACE_READ, NULL, i, (uint64_t)MAX(offset, 0), size, result, started);
+}
+
+static void memefs_ll_readdir(fuse_req_t req, fuse_ino_t ino, size_t size, off_t offset, struct fuse_file_info* fi) {
+    (void) fi;
+
+    reply_dir(req, ino, size, offset, 0);
+}
+
+static void memefs_ll_readdirplus(fuse_req_t req, fuse_ino_t ino, size_t size, off_t offset, struct fuse_file_info* fi) {
+    (void) fi;
+
+    reply_dir(req, ino, size, offset, 1);
+}
+
+static void memefs_ll_release(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info* fi) {
+    uint64_t started;
+
+    if (ino == STATS_INODE) {
+        fuse_reply_err(req, 0);
+        return;
+    }
+
+    // Every close already flushed the file in standard mode, so only the handle is left.
+    started = trace_begin();
+    free_open_file(HANDLE(fi));
+    fuse_reply_err(req, 0);
+    if (ino != ROOT_INODE) {
+        trace_end(TRACE_RELEASE, NULL, -1, 0, 0, 0, started);
+    }
+}
+
+static void memefs_ll_setattr(fuse_req_t req, fuse_ino_t ino, struct stat* attr, int to_set, struct fuse_file_info* fi) {
+    (void) fi;
+    struct stat new_attr;
+    uint64_t started;
+    int i, result;
+
+    if (ino == ROOT_INODE) {
+        if (to_set & FUSE_SET_ATTR_SIZE) {
+            // Can't truncate a directory.
+            fuse_reply_err(req, EISDIR);
+            return;
+        }
+        stat_root(&new_attr);
+        fuse_reply_attr(req, &new_attr, cache_config.attr_timeout);
+        return;
+    }
+    if (ino == STATS_INODE) {
+        if (to_set & FUSE_SET_ATTR_SIZE) {
+            fuse_reply_err(req, EACCES);
+            return;
+        }
+        stat_stats_file(&new_attr);
+        fuse_reply_attr(req, &new_attr, cache_config.attr_timeout);
+        return;
+    }
+
+    // Only the size can change, times and ownership are kept as they are.
+    if (to_set & FUSE_SET_ATTR_SIZE) {
+        started = trace_begin();
+        if ((i = lock_inode(ino)) < 0) {
+            result = i;
+        } else {
+            result = truncate_entry(i, attr->st_size);
+        }
+        trace_end(TRACE_TRUNCATE, NULL, i, (uint64_t)attr->st_size, 0, result, started);
+        if (result != 0) {
+            fuse_reply_err(req, -result);
+            return;
+        }
+    }
+    if ((i = lock_inode(ino)) < 0) {
+        fuse_reply_err(req, -i);
+        return;
+    }
+    stat_entry(i, &new_attr);
+    fuse_reply_attr(req, &new_attr, cache_config.attr_timeout);
+}
+
+static void memefs_ll_statfs(fuse_req_t req, fuse_ino_t ino) {
+    (void) ino;
+    struct statvfs stbuf;
+    uint64_t started;
+
+    started = trace_begin();
+    stat_filesystem(&stbuf);
+    fuse_reply_statfs(req, &stbuf);
+    trace_end(TRACE_STATFS, NULL, -1, 0, 0, 0, started);
+}
+
+static void memefs_ll_unlink(fuse_req_t req, fuse_ino_t parent, const char* name) {
+    uint64_t started;
+    int result;
+
+    if (parent != ROOT_INODE) {
+        fuse_reply_err(req, ENOENT);
+        return;
+    }
+    started = trace_begin();
+    result = unlink_entry(name);
+    fuse_reply_err(req, -result);
+    trace_end(TRACE_UNLINK, name, -1, 0, 0, result, started);
+}
+
+static void memefs_ll_write_buf(fuse_req_t req, fuse_ino_t ino, struct fuse_bufvec* bufv, off_t offset, struct fuse_file_info* fi) {
+    (void) fi;
+    uint64_t started;
+    size_t size;
+    int i, result;
+
+    started = trace_begin();
+    size = fuse_buf_size(bufv);
+    i = -1;
+    if (offset < 0) {
+        result = -EINVAL;
+    } else if ((i = lock_inode(ino)) < 0) {
+        result = i;
+    } else {
+        result = write_entry(i, bufv, offset);
+    }
+    if (result < 0) {
+        fuse_reply_err(req, -result);
+    } else {
+        fuse_reply_write(req, (size_t)result);
+    }
+    trace_end(TRACE_WRITE, NULL, i, (uint64_t)MAX(offset, 0), size, result, started);
+}
+
+#pragma endregion FUSE Implementations
+
+#pragma region Implementations
+
+static size_t add_dir_entry(fuse_req_t req, char* buf, size_t size, const char* name, const struct stat* attr, off_t offset, int plus) {
+    struct fuse_entry_param entry;
+
+    if (!plus) {
+        return fuse_add_direntry(req, buf, size, name, attr, offset);
+    }
+    fill_entry_param(&entry, attr);
+    return fuse_add_direntry_plus(req, buf, size, name, &entry, offset);
+}
+
+static void fill_entry_param(struct fuse_entry_param* entry, const struct stat* attr) {
+    memset(entry, 0, sizeof(struct fuse_entry_param));
+    entry->ino = (fuse_ino_t)attr->st_ino;
+    entry->generation = (uint64_t)attr->st_ino >> 32;
+    entry->attr = *attr;
+    entry->attr_timeout = cache_config.attr_timeout;
+    entry->entry_timeout = (entry->ino == 0) ? cache_config.negative_timeout : cache_config.entry_timeout;
+}
+
+static void invalidate_inode(uint64_t inode, const char* readable_name, int changes) {
+    if (changes & CHANGED_NAME) {
+        fuse_lowlevel_notify_inval_entry(session, ROOT_INODE, readable_name, strlen(readable_name));
+    }
+    if (changes & CHANGED_DATA) {
+        // Offset 0 and length 0 drop every cached page along with the attributes.
+        fuse_lowlevel_notify_inval_inode(session, (fuse_ino_t)inode, 0, 0);
+    } else if (changes & CHANGED_ATTRS) {
+        // A negative offset drops only the attributes.
+        fuse_lowlevel_notify_inval_inode(session, (fuse_ino_t)inode, -1, 0);
+    }
+}
+
+static int lock_inode(fuse_ino_t ino) {
+    int i;
+
+    lock_namespace_read();
+    if ((i = inode_entry((uint64_t)ino)) < 0) {
+        unlock_namespace();
+    }
+    return i;
+}
+
+static void reply_data(void* req, struct fuse_bufvec* bufv) {
+    fuse_reply_data((fuse_req_t)req, bufv, 0);
+}
+
+static void reply_dir(fuse_req_t req, fuse_ino_t ino, size_t size, off_t offset, int plus) {
+    const char* readable_filename;
+    struct stat attr;
+    size_t used, entry_size;
+    uint64_t started;
+    char* buf;
+    int i, full, listed;
+
+    if (ino != ROOT_INODE) {
+        fuse_reply_err(req, ENOTDIR);
+        return;
+    }
+    if ((buf = malloc(size)) == NULL) {
+        fuse_reply_err(req, ENOMEM);
+        return;
+    }
+
+    // Offsets 0 and 1 are "." and "..", then each file's offset follows from its directory entry,
+    // so a listing resumes in the right place even if files come and go in between.
+    started = trace_begin();
+    used = 0;
+    full = 0;
+    listed = 0;
+    stat_root(&attr);
+    for (i = (int)MAX(offset, 0); (i < FIRST_DIR_OFFSET) && !full; i++) {
+        entry_size = add_dir_entry(req, buf + used, size - used, (i == 0) ? "." : "..", &attr, i + 1, plus);
+        full = (entry_size > size - used);
+        used += full ? 0 : entry_size;
+    }
+
+    lock_namespace_read();
+    for (i = next_listed_entry((int)MIN(MAX(offset, FIRST_DIR_OFFSET) - FIRST_DIR_OFFSET, (off_t)INT32_MAX), &readable_filename, plus ? &attr : NULL); (i >= 0) && !full; i = next_listed_entry(i + 1, &readable_filename, plus ? &attr : NULL)) {
+        if (!plus) {
+            // A plain listing only gives the inode and type, so the file needn't be locked.
+            attr.st_ino = (ino_t)entry_inode(i);
+            attr.st_mode = S_IFREG;
+        }
+        entry_size = add_dir_entry(req, buf + used, size - used, readable_filename, &attr, i + FIRST_DIR_OFFSET + 1, plus);
+        // Out of room, the kernel asks again from this entry.
+        full = (entry_size > size - used);
+        used += full ? 0 : entry_size;
+        listed += !full;
+    }
+    unlock_namespace();
+
+    fuse_reply_buf(req, buf, used);
+    free(buf);
+    trace_end(TRACE_READDIR, NULL, -1, (uint64_t)MAX(offset, 0), (uint64_t)listed, 0, started);
+}
+
+static void reply_entry(fuse_req_t req, const struct stat* attr, struct fuse_file_info* fi) {
+    struct fuse_entry_param entry;
+
+    fill_entry_param(&entry, attr);
+    if (fi != NULL) {
+        fi->keep_cache = cache_config.kernel_cache;
+        fuse_reply_create(req, &entry, fi);
+    } else {
+        fuse_reply_entry(req, &entry);
+    }
+}
+
+static void reply_stats(fuse_req_t req, size_t size, off_t offset) {
+    char* buf;
+    int result;
+
+    if (offset < 0) {
+        fuse_reply_err(req, EINVAL);
+        return;
+    }
+    if ((buf = malloc(MAX(size, (size_t)1))) == NULL) {
+        fuse_reply_err(req, ENOMEM);
+        return;
+    }
+    if ((result = read_stats(buf, size, offset)) < 0) {
+        fuse_reply_err(req, -result);
+    } else {
+        fuse_reply_buf(req, buf, (size_t)result);
+    }
+    free(buf);
+}
+
+static void reply_sync(fuse_req_t req, fuse_ino_t ino, int datasync, trace_op_t op, uint64_t started) {
+    int i, result;
+
+    if ((ino == ROOT_INODE) || (ino == STATS_INODE)) {
+        fuse_reply_err(req, 0);
+        return;
+    }
+    if ((i = lock_inode(ino)) < 0) {
+        result = i;
+    } else {
+        result = sync_entry(i, datasync);
+    }
+    fuse_reply_err(req, -result);
+    trace_end(op, NULL, i, 0, 0, result, started);
+}
+
+int run_lowlevel(struct fuse_args* args, const kernel_cache_config_t* cache) {
+    struct fuse_cmdline_opts opts;
+    struct fuse_loop_config config;
+    int result;
+
+    cache_config = *cache;
+
+    if (fuse_parse_cmdline(args, &opts) != 0) {
+        return 1;
+    }
+    if (opts.show_help) {
+        fuse_cmdline_help();
+        fuse_lowlevel_help();
+        free(opts.mountpoint);
+        return 0;
+    }
+    if (opts.mountpoint == NULL) {
+        fprintf(stderr, "No mount point given\n");
+        return 1;
+    }
+
+    result = 1;
+    if ((session = fuse_session_new(args, &memefs_ll_oper, sizeof(memefs_ll_oper), NULL)) == NULL) {
+        free(opts.mountpoint);
+        return 1;
+    }
+    if (fuse_set_signal_handlers(session) == 0) {
+        if (fuse_session_mount(session, opts.mountpoint) == 0) {
+            fuse_daemonize(opts.foreground);
+            set_change_notifier(invalidate_inode);
+            if (opts.singlethread) {
+                result = fuse_session_loop(session);
+            } else {
+                config.clone_fd = opts.clone_fd;
+                config.max_idle_threads = opts.max_idle_threads;
+                result = fuse_session_loop_mt(session, &config);
+            }
+            fuse_session_unmount(session);
+        }
+        fuse_remove_signal_handlers(session);
+    }
+    set_change_notifier(NULL);
+    fuse_session_destroy(session);
+    session = NULL;
+    free(opts.mountpoint);
+    return (result == 0) ? 0 : 1;
+}
+
+#pragma endregion Implementations
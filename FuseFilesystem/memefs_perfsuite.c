@@ -0,0 +1,577 @@
+// File:    memefs_perfsuite.c
+// Author:  Eric Ekey
+// Date:    10/16/2026
+// Desc:    Multithreaded workload generator for a mounted memefs, reporting throughput, latency and thread scaling.
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "timing.h"
+
+#define DEFAULT_SECONDS 2       // How long each workload runs at each thread count.
+#define DEFAULT_MAX_THREADS 8   // Thread counts run are powers of two up to this, and this.
+#define DEFAULT_STREAM_MIB 8    // Size of each thread's file in the streaming workload.
+#define MAX_THREADS 64
+#define APPEND_SIZE 256         // Bytes per log append.
+#define APPEND_LOG_LIMIT (4 * 1024 * 1024) // A log is truncated once it grows past this.
+#define CHURN_MAX 4096          // Largest file written by the churn workload.
+#define OVERWRITE_FILE_MIB 16   // Size of the file shared by the overwrite workload.
+#define OVERWRITE_SIZE 4096     // Bytes per random overwrite.
+#define STAT_FILES 64           // Files the stat storm picks from.
+#define STREAM_CHUNK (128 * 1024) // Bytes per streaming read or write, the most FUSE sends at once.
+#define PATH_LENGTH 4096
+
+#pragma region Globals
+
+// State of one thread running a workload.
+typedef struct worker {
+    int id;
+    int fd;            // File the workload keeps open, or -1.
+    uint32_t rng;      // xorshift state, seeded per thread.
+    uint64_t seq;      // Operations started, used to name and place the next one.
+    uint64_t offset;   // Next streaming or append offset.
+    int reading;       // Whether the streaming workload is on its read pass.
+    uint64_t* latencies; // Nanoseconds per operation.
+    size_t count;
+    size_t capacity;
+    uint64_t bytes;    // Bytes read or written.
+    uint64_t errors;   // Operations that failed.
+    char* buf;
+} worker_t;
+
+// A workload: setup runs before the clock starts, step is one timed operation.
+typedef struct workload {
+    const char* name;
+    const char* summary;
+    int (*setup)(worker_t* worker);
+    int (*step)(worker_t* worker, size_t* bytes);
+    void (*cleanup)(worker_t* worker);
+} workload_t;
+
+static const char* root;          // Directory the workloads run in, normally the mount point.
+static uint64_t stream_bytes = (uint64_t)DEFAULT_STREAM_MIB * 1024 * 1024;
+static int stop_running;          // Set when the measured interval ends.
+static pthread_barrier_t start_line;
+static const workload_t* current; // Workload the threads are running.
+
+#pragma endregion Globals
+
+#pragma region Prototypes
+
+// static int append_setup(worker_t*)
+// Description: Opens a thread's own log file for appending.
+// Preconditions: None.
+// Postconditions: worker->fd is the empty log.
+// Returns: 0 on success, -errno on failure.
+static int append_setup(worker_t* worker);
+
+// static int append_step(worker_t*, size_t*)
+// Description: Appends one record to the thread's log, truncating it first once it passes APPEND_LOG_LIMIT.
+// Preconditions: append_setup succeeded.
+// Postconditions: Record is in the log.
+// Returns: 0 on success, -errno on failure.
+static int append_step(worker_t* worker, size_t* bytes);
+
+// static int churn_step(worker_t*, size_t*)
+// Description: Creates a small file, writes it, closes it and unlinks it.
+// Preconditions: None.
+// Postconditions: File is gone again.
+// Returns: 0 on success, -errno on failure.
+static int churn_step(worker_t* worker, size_t* bytes);
+
+// static void close_cleanup(worker_t*)
+// Description: Closes the file a workload kept open.
+// Preconditions: None.
+// Postconditions: worker->fd is -1.
+// Returns: None.
+static void close_cleanup(worker_t* worker);
+
+// static int make_fixtures()
+// Description: Creates the files shared by the overwrite and stat workloads.
+// Preconditions: root is writable.
+// Postconditions: Shared file and stat files exist.
+// Returns: 0 on success, -1 on failure.
+static int make_fixtures();
+
+// static uint32_t next_random(worker_t*)
+// Description: Steps a thread's xorshift generator.
+// Preconditions: None.
+// Postconditions: Generator has advanced.
+// Returns: Next pseudo random number.
+static uint32_t next_random(worker_t* worker);
+
+// static int overwrite_setup(worker_t*)
+// Description: Opens the shared file for random overwrites.
+// Preconditions: make_fixtures succeeded.
+// Postconditions: worker->fd is the shared file.
+// Returns: 0 on success, -errno on failure.
+static int overwrite_setup(worker_t* worker);
+
+// static int overwrite_step(worker_t*, size_t*)
+// Description: Overwrites one aligned block at a random offset of the shared file.
+// Preconditions: overwrite_setup succeeded.
+// Postconditions: Block is written.
+// Returns: 0 on success, -errno on failure.
+static int overwrite_step(worker_t* worker, size_t* bytes);
+
+// static void remove_fixtures()
+// Description: Removes the files made by make_fixtures.
+// Preconditions: None.
+// Postconditions: Fixtures are gone.
+// Returns: None.
+static void remove_fixtures();
+
+// static double run_workload(const workload_t*, int, int, double)
+// Description: Runs a workload on a number of threads for a while and prints its row of the table.
+// Preconditions: Fixtures exist.
+// Postconditions: Row is printed. Files the workload made are removed.
+// Returns: Operations per second, or 0 if the workload could not start.
+static double run_workload(const workload_t* workload, int num_threads, int seconds, double base_rate);
+
+// static void* run_worker(void*)
+// Description: Thread body, sets up, waits for the start, then times steps until stopped.
+// Preconditions: current is set.
+// Postconditions: worker holds the latencies, bytes and errors of its steps.
+// Returns: NULL.
+static void* run_worker(void* arg);
+
+// static int stat_step(worker_t*, size_t*)
+// Description: Stats one of the stat files at random.
+// Preconditions: make_fixtures succeeded.
+// Postconditions: None.
+// Returns: 0 on success, -errno on failure.
+static int stat_step(worker_t* worker, size_t* bytes);
+
+// static int stream_setup(worker_t*)
+// Description: Creates a thread's own file for streaming.
+// Preconditions: None.
+// Postconditions: worker->fd is the empty file, on its write pass.
+// Returns: 0 on success, -errno on failure.
+static int stream_setup(worker_t* worker);
+
+// static int stream_step(worker_t*, size_t*)
+// Description: Writes or reads the next chunk of the thread's file, switching passes at its end.
+// Preconditions: stream_setup succeeded.
+// Postconditions: Chunk is written or read.
+// Returns: 0 on success, -errno on failure.
+static int stream_step(worker_t* worker, size_t* bytes);
+
+// static void unlink_cleanup(worker_t*)
+// Description: Closes and removes the file a workload kept open.
+// Preconditions: None.
+// Postconditions: Thread's file is gone.
+// Returns: None.
+static void unlink_cleanup(worker_t* worker);
+
+// static void usage(const char*)
+// Description: Prints the command line usage.
+// Preconditions: None.
+// Postconditions: None.
+// Returns: None.
+static void usage(const char* prog);
+
+// static void worker_path(const worker_t*, const char*, char*)
+// Description: Builds the path of a thread's own file, an 8.3 name with the thread number in it.
+// Preconditions: path holds PATH_LENGTH bytes.
+// Postconditions: path is set.
+// Returns: None.
+static void worker_path(const worker_t* worker, const char* prefix, char* path);
+
+#pragma endregion Prototypes
+
+static const workload_t workloads[] = {
+    { "churn", "create, write 1-4 KiB, close, unlink", NULL, churn_step, NULL },
+    { "append", "256 byte appends to a log per thread", append_setup, append_step, unlink_cleanup },
+    { "stream", "128 KiB sequential writes, then reads, of a file per thread", stream_setup, stream_step, unlink_cleanup },
+    { "overwrite", "4 KiB writes at random offsets of one shared file", overwrite_setup, overwrite_step, close_cleanup },
+    { "stat", "stat of random files among 64", NULL, stat_step, NULL },
+};
+
+#define NUM_WORKLOADS (sizeof(workloads) / sizeof(workloads[0]))
+
+#pragma region Implementations
+
+static int append_setup(worker_t* worker) {
+    char path[PATH_LENGTH];
+
+    worker_path(worker, "a", path);
+    worker->fd = open(path, O_CREAT | O_WRONLY | O_TRUNC | O_APPEND, 0644);
+    return (worker->fd < 0) ? -errno : 0;
+}
+
+static int append_step(worker_t* worker, size_t* bytes) {
+    if (worker->offset >= APPEND_LOG_LIMIT) {
+        // Rotate, so a long run can't fill the image.
+        if (ftruncate(worker->fd, 0) != 0) {
+            return -errno;
+        }
+        worker->offset = 0;
+    }
+    if (write(worker->fd, worker->buf, APPEND_SIZE) != APPEND_SIZE) {
+        return -errno;
+    }
+    worker->offset += APPEND_SIZE;
+    *bytes = APPEND_SIZE;
+    return 0;
+}
+
+static int churn_step(worker_t* worker, size_t* bytes) {
+    char path[PATH_LENGTH];
+    size_t size;
+    int fd, result;
+
+    snprintf(path, sizeof(path), "%s/c%02d%05u.dat", root, worker->id, (unsigned)(worker->seq % 100000));
+    size = 1024 + (next_random(worker) % (CHURN_MAX - 1024 + 1));
+    if ((fd = open(path, O_CREAT | O_WRONLY | O_TRUNC, 0644)) < 0) {
+        return -errno;
+    }
+    result = (write(fd, worker->buf, size) == (ssize_t)size) ? 0 : -errno;
+    if (close(fd) != 0 && result == 0) {
+        result = -errno;
+    }
+    if (unlink(path) != 0 && result == 0) {
+        result = -errno;
+    }
+    *bytes = size;
+    return result;
+}
+
+static void close_cleanup(worker_t* worker) {
+    if (worker->fd >= 0) {
+        close(worker->fd);
+        worker->fd = -1;
+    }
+}
+
+static int make_fixtures() {
+    char path[PATH_LENGTH];
+    char* block;
+    uint64_t off;
+    int fd, i, result;
+
+    if ((block = calloc(1, STREAM_CHUNK)) == NULL) {
+        return -1;
+    }
+    snprintf(path, sizeof(path), "%s/shared.dat", root);
+    if ((fd = open(path, O_CREAT | O_WRONLY | O_TRUNC, 0644)) < 0) {
+        perror(path);
+        free(block);
+        return -1;
+    }
+    result = 0;
+    for (off = 0; (off < (uint64_t)OVERWRITE_FILE_MIB * 1024 * 1024) && (result == 0); off += STREAM_CHUNK) {
+        result = (pwrite(fd, block, STREAM_CHUNK, (off_t)off) == STREAM_CHUNK) ? 0 : -1;
+    }
+    close(fd);
+    free(block);
+    for (i = 0; (i < STAT_FILES) && (result == 0); i++) {
+        snprintf(path, sizeof(path), "%s/st%03d.dat", root, i);
+        if ((fd = open(path, O_CREAT | O_WRONLY | O_TRUNC, 0644)) < 0) {
+            result = -1;
+        } else {
+            close(fd);
+        }
+    }
+    if (result != 0) {
+        perror("Failed to create fixtures");
+    }
+    return result;
+}
+
+static uint32_t next_random(worker_t* worker) {
+    worker->rng ^= worker->rng << 13;
+    worker->rng ^= worker->rng >> 17;
+    worker->rng ^= worker->rng << 5;
+    return worker->rng;
+}
+
+static int overwrite_setup(worker_t* worker) {
+    char path[PATH_LENGTH];
+
+    snprintf(path, sizeof(path), "%s/shared.dat", root);
+    worker->fd = open(path, O_RDWR);
+    return (worker->fd < 0) ? -errno : 0;
+}
+
+static int overwrite_step(worker_t* worker, size_t* bytes) {
+    uint64_t off;
+
+    off = (uint64_t)(next_random(worker) % ((uint64_t)OVERWRITE_FILE_MIB * 1024 * 1024 / OVERWRITE_SIZE)) * OVERWRITE_SIZE;
+    if (pwrite(worker->fd, worker->buf, OVERWRITE_SIZE, (off_t)off) != OVERWRITE_SIZE) {
+        return -errno;
+    }
+    *bytes = OVERWRITE_SIZE;
+    return 0;
+}
+
+static void remove_fixtures() {
+    char path[PATH_LENGTH];
+    int i;
+
+    snprintf(path, sizeof(path), "%s/shared.dat", root);
+    unlink(path);
+    for (i = 0; i < STAT_FILES; i++) {
+        snprintf(path, sizeof(path), "%s/st%03d.dat", root, i);
+        unlink(path);
+    }
+}
+
+static double run_workload(const workload_t* workload, int num_threads, int seconds, double base_rate) {
+    worker_t workers[MAX_THREADS];
+    pthread_t threads[MAX_THREADS];
+    uint64_t* merged;
+    uint64_t start, elapsed, bytes, errors;
+    size_t total, n;
+    double rate;
+    int i;
+
+    current = workload;
+    __atomic_store_n(&stop_running, 0, __ATOMIC_RELAXED);
+    pthread_barrier_init(&start_line, NULL, (unsigned)num_threads + 1);
+    memset(workers, 0, sizeof(workers));
+    for (i = 0; i < num_threads; i++) {
+        workers[i].id = i;
+        workers[i].fd = -1;
+        workers[i].rng = 0x9E3779B9u ^ ((uint32_t)(i + 1) * 2654435761u);
+        pthread_create(&threads[i], NULL, run_worker, &workers[i]);
+    }
+
+    // Setup is done once every thread reaches the start line.
+    pthread_barrier_wait(&start_line);
+    start = monotonic_ns();
+    sleep((unsigned)seconds);
+    __atomic_store_n(&stop_running, 1, __ATOMIC_RELAXED);
+    for (i = 0; i < num_threads; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    elapsed = monotonic_ns() - start;
+    pthread_barrier_destroy(&start_line);
+
+    total = 0;
+    bytes = 0;
+    errors = 0;
+    for (i = 0; i < num_threads; i++) {
+        total += workers[i].count;
+        bytes += workers[i].bytes;
+        errors += workers[i].errors;
+    }
+    if ((merged = malloc((total > 0 ? total : 1) * sizeof(uint64_t))) == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        exit(1);
+    }
+    for (i = 0, n = 0; i < num_threads; i++) {
+        memcpy(merged + n, workers[i].latencies, workers[i].count * sizeof(uint64_t));
+        n += workers[i].count;
+        free(workers[i].latencies);
+    }
+
+    rate = (double)total / ((double)elapsed / 1e9);
+    printf("%7d %10zu %11.1f %9.1f %8llu ", num_threads, total, rate, (double)bytes / (1024.0 * 1024.0) / ((double)elapsed / 1e9),
+           (unsigned long long)errors);
+    if (total > 0) {
+        qsort(merged, total, sizeof(uint64_t), compare_ns);
+        printf("%9.1f %9.1f %9.1f ", merged[total / 2] / 1e3, merged[(total * 99) / 100] / 1e3, merged[(total * 999) / 1000] / 1e3);
+    } else {
+        printf("%9s %9s %9s ", "-", "-", "-");
+    }
+    printf("%8.2fx\n", (base_rate > 0) ? rate / base_rate : 1.0);
+    fflush(stdout);
+    free(merged);
+    return rate;
+}
+
+static void* run_worker(void* arg) {
+    worker_t* worker = (worker_t*)arg;
+    uint64_t op_start;
+    size_t bytes, i;
+    int setup_ok;
+
+    worker->capacity = 4096;
+    worker->latencies = malloc(worker->capacity * sizeof(uint64_t));
+    worker->buf = malloc(STREAM_CHUNK);
+    setup_ok = (worker->latencies != NULL) && (worker->buf != NULL);
+    if (setup_ok) {
+        for (i = 0; i < STREAM_CHUNK; i++) {
+            worker->buf[i] = (char)(i * 7 + worker->id);
+        }
+    }
+    if (setup_ok && current->setup != NULL && current->setup(worker) != 0) {
+        fprintf(stderr, "%s setup failed on thread %d: %s\n", current->name, worker->id, strerror(errno));
+        setup_ok = 0;
+    }
+    pthread_barrier_wait(&start_line);
+
+    while (setup_ok && !__atomic_load_n(&stop_running, __ATOMIC_RELAXED)) {
+        if (worker->count == worker->capacity) {
+            uint64_t* grown = realloc(worker->latencies, 2 * worker->capacity * sizeof(uint64_t));
+
+            if (grown == NULL) {
+                break;
+            }
+            worker->latencies = grown;
+            worker->capacity *= 2;
+        }
+        bytes = 0;
+        op_start = monotonic_ns();
+        if (current->step(worker, &bytes) != 0) {
+            worker->errors++;
+        } else {
+            worker->bytes += bytes;
+        }
+        worker->latencies[worker->count++] = monotonic_ns() - op_start;
+        worker->seq++;
+    }
+
+    if (current->cleanup != NULL) {
+        current->cleanup(worker);
+    }
+    free(worker->buf);
+    return NULL;
+}
+
+static int stat_step(worker_t* worker, size_t* bytes) {
+    char path[PATH_LENGTH];
+    struct stat stbuf;
+
+    (void) bytes;
+    snprintf(path, sizeof(path), "%s/st%03u.dat", root, next_random(worker) % STAT_FILES);
+    return (stat(path, &stbuf) != 0) ? -errno : 0;
+}
+
+static int stream_setup(worker_t* worker) {
+    char path[PATH_LENGTH];
+
+    worker_path(worker, "s", path);
+    worker->fd = open(path, O_CREAT | O_RDWR | O_TRUNC, 0644);
+    return (worker->fd < 0) ? -errno : 0;
+}
+
+static int stream_step(worker_t* worker, size_t* bytes) {
+    ssize_t done;
+
+    if (worker->reading) {
+        done = pread(worker->fd, worker->buf, STREAM_CHUNK, (off_t)worker->offset);
+    } else {
+        done = pwrite(worker->fd, worker->buf, STREAM_CHUNK, (off_t)worker->offset);
+    }
+    if (done != STREAM_CHUNK) {
+        return (done < 0) ? -errno : -EIO;
+    }
+    worker->offset += STREAM_CHUNK;
+    if (worker->offset >= stream_bytes) {
+        // End of the file, stream the other way.
+        worker->offset = 0;
+        worker->reading = !worker->reading;
+    }
+    *bytes = STREAM_CHUNK;
+    return 0;
+}
+
+static void unlink_cleanup(worker_t* worker) {
+    char path[PATH_LENGTH];
+
+    close_cleanup(worker);
+    worker_path(worker, (current->setup == append_setup) ? "a" : "s", path);
+    unlink(path);
+}
+
+static void usage(const char* prog) {
+    fprintf(stderr, "Usage: %s [-t max_threads] [-d seconds] [-s stream_MiB] [-w workload,...] <mount point>\n"
+            "Workloads: churn, append, stream, overwrite, stat (default all)\n", prog);
+}
+
+static void worker_path(const worker_t* worker, const char* prefix, char* path) {
+    snprintf(path, PATH_LENGTH, "%s/%s%02d.dat", root, prefix, worker->id);
+}
+
+#pragma endregion Implementations
+
+int main(int argc, char* argv[]) {
+    double rates[NUM_WORKLOADS][MAX_THREADS + 1];
+    int thread_counts[MAX_THREADS + 1];
+    int selected[NUM_WORKLOADS];
+    int opt, seconds, max_threads, num_counts, i, w, any;
+    char* list;
+    char* name;
+
+    seconds = DEFAULT_SECONDS;
+    max_threads = DEFAULT_MAX_THREADS;
+    list = NULL;
+    while ((opt = getopt(argc, argv, "t:d:s:w:")) != -1) {
+        switch (opt) {
+            case 't': max_threads = atoi(optarg); break;
+            case 'd': seconds = atoi(optarg); break;
+            case 's': stream_bytes = strtoull(optarg, NULL, 10) * 1024 * 1024; break;
+            case 'w': list = optarg; break;
+            default: usage(argv[0]); return 1;
+        }
+    }
+    if (optind != argc - 1 || max_threads < 1 || max_threads > MAX_THREADS || seconds < 1 || stream_bytes < STREAM_CHUNK) {
+        usage(argv[0]);
+        return 1;
+    }
+    root = argv[optind];
+
+    memset(selected, 0, sizeof(selected));
+    any = 0;
+    for (name = (list != NULL) ? strtok(list, ",") : NULL; name != NULL; name = strtok(NULL, ",")) {
+        for (w = 0; (w < (int)NUM_WORKLOADS) && (strcmp(workloads[w].name, name) != 0); w++);
+        if (w == (int)NUM_WORKLOADS) {
+            fprintf(stderr, "Unknown workload: %s\n", name);
+            return 1;
+        }
+        selected[w] = 1;
+        any = 1;
+    }
+    for (w = 0; (w < (int)NUM_WORKLOADS) && !any; w++) {
+        selected[w] = 1;
+    }
+
+    // 1, 2, 4, ... and the maximum itself.
+    num_counts = 0;
+    for (i = 1; i < max_threads; i *= 2) {
+        thread_counts[num_counts++] = i;
+    }
+    thread_counts[num_counts++] = max_threads;
+
+    if (make_fixtures() != 0) {
+        remove_fixtures();
+        return 1;
+    }
+    for (w = 0; w < (int)NUM_WORKLOADS; w++) {
+        if (!selected[w]) {
+            continue;
+        }
+        printf("\n== %s: %s, %d s per run\n", workloads[w].name, workloads[w].summary, seconds);
+        printf("%7s %10s %11s %9s %8s %9s %9s %9s %9s\n", "threads", "ops", "ops/s", "MiB/s", "errors", "p50 us", "p99 us", "p999 us", "scaling");
+        for (i = 0; i < num_counts; i++) {
+            rates[w][i] = run_workload(&workloads[w], thread_counts[i], seconds, (i > 0) ? rates[w][0] : 0);
+        }
+    }
+    remove_fixtures();
+
+    printf("\n== thread scaling, ops/s\n%-10s", "workload");
+    for (i = 0; i < num_counts; i++) {
+        printf(" %10d", thread_counts[i]);
+    }
+    printf("\n");
+    for (w = 0; w < (int)NUM_WORKLOADS; w++) {
+        if (!selected[w]) {
+            continue;
+        }
+        printf("%-10s", workloads[w].name);
+        for (i = 0; i < num_counts; i++) {
+            printf(" %10.0f", rates[w][i]);
+        }
+        printf("\n");
+    }
+    return 0;
+}
@@ -0,0 +1,410 @@
+// File:    memefs_replay.c
+// Author:  Eric Ekey
+// Date:    10/16/2026
+// Desc:    Replays a trace recorded with -o trace against an image, in process, and compares op latencies.
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "allocator.h"
+#include "block_cache.h"
+#include "define.h"
+#include "file_ops.h"
+#include "geometry.h"
+#include "loaders.h"
+#include "locks.h"
+#include "timing.h"
+#include "trace.h"
+#include "writeback.h"
+
+#define MIN_BUFFER (128 * 1024) // Smallest read and write buffer, the most FUSE sends at once.
+
+#pragma region Globals
+
+extern int img_fd;
+extern int use_mmap;
+extern memefs_geometry_t geometry;
+
+// Latencies of every replayed op of one type.
+typedef struct op_stats {
+    uint64_t* recorded; // ns the op took when traced
+    uint64_t* replayed; // ns the op took here
+    size_t count;
+    size_t errors;      // Ops that failed here
+    size_t mismatches;  // Ops that failed here but not when traced, or the other way around
+} op_stats_t;
+
+static char (*slot_names)[TRACE_NAME_LENGTH]; // Name of the file in each traced directory entry.
+static uint32_t num_slots;                     // Directory entries of the traced image.
+static open_file_t** handles;                  // Handle of each file opened here, by directory entry.
+static char* buffer;                           // Data for reads and writes.
+
+#pragma endregion Globals
+
+#pragma region Prototypes
+
+// static int compare_records(const void*, const void*)
+// Description: qsort comparator putting trace records in the order their ops started.
+// Preconditions: None.
+// Postconditions: None.
+// Returns: < 0, 0 or > 0 as a started before, with or after b.
+static int compare_records(const void* a, const void* b);
+
+// static memefs_trace_record_t* load_trace(const char*, size_t*)
+// Description: Reads a trace file and sorts its records by start time.
+// Preconditions: None.
+// Postconditions: num_slots and slot_names are sized for the traced directory.
+// Returns: Records, or NULL if the trace can't be read.
+static memefs_trace_record_t* load_trace(const char* path, size_t* num_records);
+
+// static double percentile(uint64_t*, size_t, int)
+// Description: Gets a percentile of sorted latencies in microseconds.
+// Preconditions: latencies is sorted and holds count > 0 values.
+// Postconditions: None.
+// Returns: Latency at the percentile.
+static double percentile(const uint64_t* latencies, size_t count, int pct);
+
+// static int replay_record(const memefs_trace_record_t*, const char*)
+// Description: Runs one traced op against the loaded image.
+// Preconditions: Image is loaded and the filesystem started.
+// Postconditions: Op ran. Handles of unlinked files are freed.
+// Returns: >= 0 on success, < 0 on failure.
+static int replay_record(const memefs_trace_record_t* record, const char* readable_name);
+
+// static void restore_files(const memefs_trace_record_t*, size_t)
+// Description: Creates the files that existed when tracing started, zero filled to their sizes.
+// Preconditions: Image is loaded and the filesystem started.
+// Postconditions: Files exist, unless the image already had them or has no room.
+// Returns: None.
+static void restore_files(const memefs_trace_record_t* records, size_t num_records);
+
+// static void usage(const char*)
+// Description: Prints the command line usage.
+// Preconditions: None.
+// Postconditions: None.
+// Returns: None.
+static void usage(const char* prog);
+
+#pragma endregion Prototypes
+
+#pragma region Implementations
+
+static int compare_records(const void* a, const void* b) {
+    const memefs_trace_record_t* x = (const memefs_trace_record_t*)a;
+    const memefs_trace_record_t* y = (const memefs_trace_record_t*)b;
+
+    return (x->timestamp > y->timestamp) - (x->timestamp < y->timestamp);
+}
+
+static memefs_trace_record_t* load_trace(const char* path, size_t* num_records) {
+    memefs_trace_header_t header;
+    memefs_trace_record_t* records;
+    FILE* file;
+    long length;
+
+    if ((file = fopen(path, "rb")) == NULL) {
+        perror("Failed to open trace");
+        return NULL;
+    }
+    if ((fread(&header, sizeof(header), 1, file) != 1) || (memcmp(header.magic, TRACE_MAGIC, sizeof(header.magic)) != 0)
+        || (header.record_size != sizeof(memefs_trace_record_t))) {
+        fprintf(stderr, "%s is not a memefs trace\n", path);
+        fclose(file);
+        return NULL;
+    }
+
+    fseek(file, 0, SEEK_END);
+    length = ftell(file) - (long)sizeof(header);
+    fseek(file, (long)sizeof(header), SEEK_SET);
+    *num_records = (size_t)MAX(length, 0L) / sizeof(memefs_trace_record_t);
+    num_slots = header.max_file_entries;
+    records = malloc(MAX(*num_records, (size_t)1) * sizeof(memefs_trace_record_t));
+    slot_names = calloc(MAX(num_slots, 1u), sizeof(*slot_names));
+    if ((records == NULL) || (slot_names == NULL) || (fread(records, sizeof(memefs_trace_record_t), *num_records, file) != *num_records)) {
+        fprintf(stderr, "Failed to read %s\n", path);
+        free(records);
+        fclose(file);
+        return NULL;
+    }
+    fclose(file);
+
+    // Records are written as ops finish, replay them as they started.
+    qsort(records, *num_records, sizeof(memefs_trace_record_t), compare_records);
+    printf("Trace of %zu ops over %.3f s, from a mount with %u byte blocks and %u directory entries\n", *num_records,
+           (*num_records > 0) ? records[*num_records - 1].timestamp / 1e9 : 0.0, header.block_size, header.max_file_entries);
+    return records;
+}
+
+static double percentile(const uint64_t* latencies, size_t count, int pct) {
+    return latencies[(count * (size_t)pct) / 100] / 1e3;
+}
+
+static int replay_record(const memefs_trace_record_t* record, const char* readable_name) {
+    struct fuse_bufvec src = FUSE_BUFVEC_INIT(record->size);
+    const char* listed_name;
+    struct statvfs fs;
+    struct stat stbuf;
+    int i, listed;
+
+    if ((readable_name[0] == '\0') && (record->result < 0)) {
+        // The op named no file that still existed when traced, e.g. a stale inode, so there is nothing to find.
+        return record->result;
+    }
+
+    switch (record->op) {
+        case TRACE_CREATE:
+            if ((i = create_entry(readable_name, &stbuf)) >= 0 && handles[i] == NULL) {
+                handles[i] = new_open_file((uint64_t)stbuf.st_ino);
+            }
+            return i;
+        case TRACE_GETATTR:
+            if (readable_name[0] == '\0') {
+                stat_root(&stbuf);
+                return 0;
+            }
+            // fallthrough
+        case TRACE_LOOKUP:
+            if ((i = lock_named_entry(readable_name)) < 0) {
+                return i;
+            }
+            return stat_entry(i, &stbuf);
+        case TRACE_OPEN:
+            if ((i = lock_named_entry(readable_name)) < 0) {
+                return i;
+            }
+            if (handles[i] == NULL) {
+                handles[i] = new_open_file(entry_inode(i));
+            }
+            unlock_namespace();
+            return 0;
+        case TRACE_READ:
+            if ((i = lock_named_entry(readable_name)) < 0) {
+                return i;
+            }
+            return read_entry(i, handles[i], buffer, record->size, (off_t)record->offset);
+        case TRACE_READDIR:
+            lock_namespace_read();
+            listed = 0;
+            for (i = next_listed_entry((int)(MAX(record->offset, (uint64_t)FIRST_DIR_OFFSET) - FIRST_DIR_OFFSET), &listed_name, NULL);
+                 (i >= 0) && (listed < (int)record->size); i = next_listed_entry(i + 1, &listed_name, NULL)) {
+                listed++;
+            }
+            unlock_namespace();
+            return listed;
+        case TRACE_RELEASE:
+            // The close before it already flushed, as in the frontends.
+            return 0;
+        case TRACE_FLUSH:
+            if (get_durability() != DURABILITY_STANDARD) {
+                // Nothing to force out, as in the frontends.
+                return 0;
+            }
+            // fallthrough
+        case TRACE_FSYNC:
+            if ((i = lock_named_entry(readable_name)) < 0) {
+                return i;
+            }
+            return sync_entry(i, record->op != TRACE_FSYNC);
+        case TRACE_STATFS:
+            stat_filesystem(&fs);
+            return 0;
+        case TRACE_TRUNCATE:
+            if ((i = lock_named_entry(readable_name)) < 0) {
+                return i;
+            }
+            return truncate_entry(i, (off_t)record->offset);
+        case TRACE_UNLINK:
+            if ((i = lock_named_entry(readable_name)) >= 0) {
+                free_open_file(handles[i]);
+                handles[i] = NULL;
+                unlock_namespace();
+            }
+            return unlink_entry(readable_name);
+        case TRACE_WRITE:
+            if ((i = lock_named_entry(readable_name)) < 0) {
+                return i;
+            }
+            src.buf[0].mem = buffer;
+            return write_entry(i, &src, (off_t)record->offset);
+        default:
+            return -EINVAL;
+    }
+}
+
+static void restore_files(const memefs_trace_record_t* records, size_t num_records) {
+    size_t k;
+    int i;
+
+    for (k = 0; k < num_records; k++) {
+        if (records[k].op != TRACE_FILE) {
+            continue;
+        }
+        if ((i = create_entry(records[k].name, NULL)) < 0) {
+            fprintf(stderr, "Failed to restore %s: %s\n", records[k].name, strerror(-i));
+            continue;
+        }
+        if (records[k].offset > 0 && (i = lock_named_entry(records[k].name)) >= 0 && (i = truncate_entry(i, (off_t)records[k].offset)) < 0) {
+            fprintf(stderr, "Failed to restore %s: %s\n", records[k].name, strerror(-i));
+        }
+        if ((records[k].slot >= 0) && ((uint32_t)records[k].slot < num_slots)) {
+            memcpy(slot_names[records[k].slot], records[k].name, TRACE_NAME_LENGTH);
+        }
+    }
+}
+
+static void usage(const char* prog) {
+    fprintf(stderr, "Usage: %s [-t] [-a first|next|best] [-D sync|standard|relaxed] [-c cache_MiB] [-r readahead] [-l] [-m] "
+            "<trace> <filesystem image>\n", prog);
+}
+
+#pragma endregion Implementations
+
+int main(int argc, char* argv[]) {
+    op_stats_t stats[NUM_TRACE_OPS];
+    memefs_trace_record_t* records;
+    const memefs_trace_record_t* record;
+    const char* readable_name;
+    uint64_t replay_start, op_start, latency, wait;
+    size_t num_records, buffer_size, k;
+    struct timespec pause;
+    int opt, lazy, timed, result, op;
+
+    lazy = 0;
+    timed = 0;
+    while ((opt = getopt(argc, argv, "ta:D:c:r:lm")) != -1) {
+        switch (opt) {
+            case 't': timed = 1; break;
+            case 'a':
+                if (set_alloc_policy(optarg) != 0) {
+                    fprintf(stderr, "Unknown allocation policy: %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'D':
+                if (set_durability(optarg) != 0) {
+                    fprintf(stderr, "Unknown durability mode: %s\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'c': set_cache_size(strtoull(optarg, NULL, 10) * 1024 * 1024); break;
+            case 'r': set_readahead((uint32_t)strtoul(optarg, NULL, 10)); break;
+            case 'l': lazy = 1; break;
+            case 'm': use_mmap = 1; break;
+            default: usage(argv[0]); return 1;
+        }
+    }
+    if (optind != argc - 2) {
+        usage(argv[0]);
+        return 1;
+    }
+    set_lazy_loading(lazy && !use_mmap);
+
+    if ((records = load_trace(argv[optind], &num_records)) == NULL) {
+        return 1;
+    }
+    buffer_size = MIN_BUFFER;
+    memset(stats, 0x00, sizeof(stats));
+    for (k = 0; k < num_records; k++) {
+        if (records[k].op >= NUM_TRACE_OPS) {
+            fprintf(stderr, "Unknown op %u in trace\n", records[k].op);
+            return 1;
+        }
+        records[k].name[TRACE_NAME_LENGTH - 1] = '\0';
+        buffer_size = MAX(buffer_size, (size_t)records[k].size);
+        stats[records[k].op].count++;
+    }
+    for (op = 0; op < NUM_TRACE_OPS; op++) {
+        stats[op].recorded = malloc(MAX(stats[op].count, (size_t)1) * sizeof(uint64_t));
+        stats[op].replayed = malloc(MAX(stats[op].count, (size_t)1) * sizeof(uint64_t));
+        if (stats[op].recorded == NULL || stats[op].replayed == NULL) {
+            fprintf(stderr, "Out of memory\n");
+            return 1;
+        }
+        stats[op].count = 0;
+    }
+
+    if ((img_fd = open(argv[optind + 1], O_RDWR)) < 0) {
+        perror("Failed to open filesystem image");
+        return 1;
+    }
+    if (load_image() != 0) {
+        return 1;
+    }
+    handles = calloc(geometry.max_file_entries, sizeof(open_file_t*));
+    if ((buffer = calloc(1, buffer_size)) == NULL || handles == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+    start_filesystem();
+    restore_files(records, num_records);
+
+    replay_start = monotonic_ns();
+    for (k = 0; k < num_records; k++) {
+        record = &records[k];
+        if (record->op == TRACE_FILE) {
+            continue;
+        }
+
+        // Ops the low level frontend traced name their file by directory entry only.
+        if ((record->name[0] != '\0') && (record->slot >= 0) && ((uint32_t)record->slot < num_slots)) {
+            memcpy(slot_names[record->slot], record->name, TRACE_NAME_LENGTH);
+        }
+        readable_name = record->name;
+        if ((readable_name[0] == '\0') && (record->slot >= 0) && ((uint32_t)record->slot < num_slots)) {
+            readable_name = slot_names[record->slot];
+        }
+
+        if (timed && ((wait = replay_start + record->timestamp) > monotonic_ns())) {
+            wait -= monotonic_ns();
+            pause.tv_sec = (time_t)(wait / 1000000000ull);
+            pause.tv_nsec = (long)(wait % 1000000000ull);
+            nanosleep(&pause, NULL);
+        }
+        op_start = monotonic_ns();
+        result = replay_record(record, readable_name);
+        latency = monotonic_ns() - op_start;
+
+        op = record->op;
+        stats[op].recorded[stats[op].count] = record->latency;
+        stats[op].replayed[stats[op].count] = latency;
+        stats[op].count++;
+        stats[op].errors += (result < 0);
+        stats[op].mismatches += ((result < 0) != (record->result < 0));
+    }
+    latency = monotonic_ns() - replay_start;
+
+    printf("Replayed in %.3f s, %s\n", latency / 1e9, timed ? "with the original timing" : "as fast as possible");
+    printf("%-9s %9s %7s %9s %11s %11s %11s %11s\n", "op", "ops", "errors", "mismatch", "traced p50", "traced p99", "replay p50", "replay p99");
+    for (op = TRACE_FILE + 1; op < NUM_TRACE_OPS; op++) {
+        if (stats[op].count == 0) {
+            continue;
+        }
+        qsort(stats[op].recorded, stats[op].count, sizeof(uint64_t), compare_ns);
+        qsort(stats[op].replayed, stats[op].count, sizeof(uint64_t), compare_ns);
+        printf("%-9s %9zu %7zu %9zu %11.1f %11.1f %11.1f %11.1f\n", trace_op_name((trace_op_t)op), stats[op].count, stats[op].errors, stats[op].mismatches,
+               percentile(stats[op].recorded, stats[op].count, 50), percentile(stats[op].recorded, stats[op].count, 99),
+               percentile(stats[op].replayed, stats[op].count, 50), percentile(stats[op].replayed, stats[op].count, 99));
+    }
+    printf("Latencies in us. A mismatch is an op that failed in only one of the trace and the replay.\n");
+
+    for (op = 0; op < NUM_TRACE_OPS; op++) {
+        free(stats[op].recorded);
+        free(stats[op].replayed);
+    }
+    for (k = 0; k < geometry.max_file_entries; k++) {
+        free_open_file(handles[k]);
+    }
+    free(handles);
+    free(buffer);
+    free(slot_names);
+    free(records);
+    stop_filesystem();
+    return 0;
+}
@@ -0,0 +1,417 @@
+// File:    memefs_tool.c
+// Author:  Eric Ekey
+// Date:    10/16/2026
+// Desc:    Lists, reads and writes the files of an image without mounting it, writing the image back once at the end.
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "block_cache.h"
+#include "define.h"
+#include "file_ops.h"
+#include "geometry.h"
+#include "loaders.h"
+#include "locks.h"
+#include "writeback.h"
+
+#define TOOL_BUFFER (1024 * 1024) // Bytes moved per read or write.
+
+#pragma region Globals
+
+extern int img_fd;
+extern memefs_geometry_t geometry;
+
+static char* buffer; // Data on its way in or out of the image.
+
+#pragma endregion Globals
+
+#pragma region Prototypes
+
+// static int copy_in(const char*, const char*)
+// Description: Copies a local file into the image, replacing a file of the same name.
+// Preconditions: Image is loaded. Namespace lock is not held.
+// Postconditions: Image holds the file, in memory until the image is written back. A file it created is removed on failure.
+// Returns: 0 on success, < 0 on failure.
+static int copy_in(const char* local_path, const char* readable_name);
+
+// static int copy_out(const char*, int)
+// Description: Writes a file of the image to a descriptor.
+// Preconditions: Image is loaded. Namespace lock is not held.
+// Postconditions: fd holds the file's bytes.
+// Returns: 0 on success, < 0 on failure.
+static int copy_out(const char* readable_name, int fd);
+
+// static int export_files(const char*)
+// Description: Copies every file of the image into a local directory, creating it if needed.
+// Preconditions: Image is loaded. Namespace lock is not held.
+// Postconditions: Directory holds a copy of each file, failures are reported.
+// Returns: 0 if every file was copied, -1 otherwise.
+static int export_files(const char* dir_path);
+
+// static int get_file(const char*, const char*)
+// Description: Copies a file of the image to a local path.
+// Preconditions: Image is loaded. Namespace lock is not held.
+// Postconditions: Local file holds the file's bytes.
+// Returns: 0 on success, < 0 on failure.
+static int get_file(const char* readable_name, const char* local_path);
+
+// static int import_files(const char*)
+// Description: Copies every regular file of a local directory into the image.
+// Preconditions: Image is loaded. Namespace lock is not held.
+// Postconditions: Image holds each file whose name is legal, failures are reported.
+// Returns: 0 if every file was copied, -1 otherwise.
+static int import_files(const char* dir_path);
+
+// static void list_files()
+// Description: Prints each file's size, time and name, then the free space.
+// Preconditions: Image is loaded. Namespace lock is not held.
+// Postconditions: None.
+// Returns: None.
+static void list_files();
+
+// static void usage(const char*)
+// Description: Prints the command line usage.
+// Preconditions: None.
+// Postconditions: None.
+// Returns: None.
+static void usage(const char* prog);
+
+// static int write_all(int, const char*, size_t)
+// Description: Writes a buffer to a descriptor, retrying short writes.
+// Preconditions: None.
+// Postconditions: fd holds the whole buffer on success.
+// Returns: 0 on success, -errno on failure.
+static int write_all(int fd, const char* buf, size_t size);
+
+#pragma endregion Prototypes
+
+#pragma region Implementations
+
+static int copy_in(const char* local_path, const char* readable_name) {
+    open_file_t* handle;
+    struct stat stbuf;
+    ssize_t bytes;
+    off_t offset;
+    int fd, i, existed, result;
+
+    if ((fd = open(local_path, O_RDONLY)) < 0) {
+        return -errno;
+    }
+
+    existed = 0;
+    if ((i = lock_named_entry(readable_name)) >= 0) {
+        existed = stat_entry(i, &stbuf) == 0;
+    } else if (i == -ENOENT) {
+        i = create_entry(readable_name, &stbuf);
+    }
+    if (i < 0) {
+        close(fd);
+        return i;
+    }
+    if ((handle = new_open_file((uint64_t)stbuf.st_ino)) == NULL) {
+        close(fd);
+        return -ENOMEM;
+    }
+
+    // A file already there is overwritten, as cp would.
+    result = 0;
+    if (existed && ((i = lock_open_file(handle)) >= 0)) {
+        result = truncate_entry(i, 0);
+    } else if (existed) {
+        result = i;
+    }
+    for (offset = 0; (result == 0) && ((bytes = read(fd, buffer, TOOL_BUFFER)) != 0); offset += bytes) {
+        if (bytes < 0) {
+            result = -errno;
+        } else if ((i = lock_open_file(handle)) < 0) {
+            result = i;
+        } else {
+            struct fuse_bufvec src = FUSE_BUFVEC_INIT((size_t)bytes);
+
+            src.buf[0].mem = buffer;
+            if ((i = write_entry(i, &src, offset)) < 0) {
+                result = i;
+            }
+        }
+    }
+    free_open_file(handle);
+    close(fd);
+    if ((result != 0) && !existed) {
+        // Don't leave a partial copy behind under the name.
+        unlink_entry(readable_name);
+    }
+    return result;
+}
+
+static int copy_out(const char* readable_name, int fd) {
+    open_file_t* handle;
+    off_t offset;
+    int i, bytes, result;
+
+    if ((i = lock_named_entry(readable_name)) < 0) {
+        return i;
+    }
+    handle = new_open_file(entry_inode(i));
+    unlock_namespace();
+    if (handle == NULL) {
+        return -ENOMEM;
+    }
+
+    // The handle sees sequential reads, so lazily loaded blocks are read ahead.
+    result = 0;
+    for (offset = 0; result == 0; offset += bytes) {
+        if ((i = lock_open_file(handle)) < 0) {
+            result = i;
+        } else if ((bytes = read_entry(i, handle, buffer, TOOL_BUFFER, offset)) <= 0) {
+            result = MIN(bytes, 0);
+            break;
+        } else {
+            result = write_all(fd, buffer, (size_t)bytes);
+        }
+    }
+    free_open_file(handle);
+    return result;
+}
+
+static int export_files(const char* dir_path) {
+    char (*names)[MAX_READABLE_FILENAME_LENGTH];
+    char local_path[PATH_MAX];
+    const char* readable_name;
+    uint32_t num_names, k;
+    int i, result, failed;
+
+    if ((mkdir(dir_path, 0755) != 0) && (errno != EEXIST)) {
+        fprintf(stderr, "%s: %s\n", dir_path, strerror(errno));
+        return -1;
+    }
+    if ((names = malloc((size_t)geometry.max_file_entries * MAX_READABLE_FILENAME_LENGTH)) == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        return -1;
+    }
+
+    // Names first, copying a file takes the namespace lock again.
+    num_names = 0;
+    lock_namespace_read();
+    for (i = next_listed_entry(0, &readable_name, NULL); i >= 0; i = next_listed_entry(i + 1, &readable_name, NULL)) {
+        snprintf(names[num_names++], MAX_READABLE_FILENAME_LENGTH, "%s", readable_name);
+    }
+    unlock_namespace();
+
+    failed = 0;
+    for (k = 0; k < num_names; k++) {
+        snprintf(local_path, sizeof(local_path), "%s/%s", dir_path, names[k]);
+        if ((result = get_file(names[k], local_path)) != 0) {
+            fprintf(stderr, "%s: %s\n", names[k], strerror(-result));
+            failed = 1;
+        }
+    }
+    free(names);
+    return failed ? -1 : 0;
+}
+
+static int get_file(const char* readable_name, const char* local_path) {
+    int fd, result;
+
+    if ((fd = open(local_path, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0) {
+        return -errno;
+    }
+    result = copy_out(readable_name, fd);
+    if ((close(fd) != 0) && (result == 0)) {
+        result = -errno;
+    }
+    return result;
+}
+
+static int import_files(const char* dir_path) {
+    char local_path[PATH_MAX];
+    struct dirent* dir_entry;
+    struct stat stbuf;
+    DIR* dir;
+    int result, failed;
+
+    if ((dir = opendir(dir_path)) == NULL) {
+        fprintf(stderr, "%s: %s\n", dir_path, strerror(errno));
+        return -1;
+    }
+
+    failed = 0;
+    while ((dir_entry = readdir(dir)) != NULL) {
+        snprintf(local_path, sizeof(local_path), "%s/%s", dir_path, dir_entry->d_name);
+        if ((stat(local_path, &stbuf) != 0) || !S_ISREG(stbuf.st_mode)) {
+            // memefs has only the root directory.
+            continue;
+        }
+        if ((result = copy_in(local_path, dir_entry->d_name)) != 0) {
+            fprintf(stderr, "%s: %s\n", local_path, strerror(-result));
+            failed = 1;
+        }
+    }
+    closedir(dir);
+    return failed ? -1 : 0;
+}
+
+static void list_files() {
+    const char* readable_name;
+    struct statvfs fs;
+    struct stat stbuf;
+    char when[32];
+    uint32_t num_files;
+    int i;
+
+    num_files = 0;
+    lock_namespace_read();
+    for (i = next_listed_entry(0, &readable_name, &stbuf); i >= 0; i = next_listed_entry(i + 1, &readable_name, &stbuf)) {
+        strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S", localtime(&stbuf.st_mtime));
+        printf("%10lld  %s  %s\n", (long long)stbuf.st_size, when, readable_name);
+        num_files++;
+    }
+    unlock_namespace();
+
+    stat_filesystem(&fs);
+    printf("%u files, %llu of %llu entries free, %llu of %llu blocks free\n", num_files, (unsigned long long)fs.f_ffree,
+           (unsigned long long)fs.f_files, (unsigned long long)fs.f_bfree, (unsigned long long)fs.f_blocks);
+}
+
+static void usage(const char* prog) {
+    fprintf(stderr, "Usage: %s [-f] <filesystem image> <command> [arguments]\n"
+            "  -f                          open an image that was not cleanly unmounted, replaying its journal\n"
+            "  ls                          list files\n"
+            "  cat <name>...               write files to stdout\n"
+            "  get <name> [<local file>]   copy a file out, to its own name by default\n"
+            "  put <local file> [<name>]   copy a file in, under its own name by default\n"
+            "  rm <name>...                remove files\n"
+            "  import <local dir>          copy in every regular file of a directory\n"
+            "  export <local dir>          copy out every file into a directory\n", prog);
+}
+
+static int write_all(int fd, const char* buf, size_t size) {
+    ssize_t written;
+
+    while (size > 0) {
+        if ((written = write(fd, buf, size)) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -errno;
+        }
+        buf += written;
+        size -= (size_t)written;
+    }
+    return 0;
+}
+
+#pragma endregion Implementations
+
+int main(int argc, char* argv[]) {
+    const char* command;
+    const char* name;
+    int k, min_args, max_args, result, failed, force;
+
+    // -f takes over an image that looks mounted, to recover one left behind by a crash.
+    force = 0;
+    if ((argc > 1) && (strcmp(argv[1], "-f") == 0)) {
+        force = 1;
+        argv[1] = argv[0];
+        argv++;
+        argc--;
+    }
+    if (argc < 3) {
+        usage(argv[0]);
+        return 1;
+    }
+    command = argv[2];
+    if (strcmp(command, "ls") == 0) {
+        min_args = 0;
+        max_args = 0;
+    } else if ((strcmp(command, "cat") == 0) || (strcmp(command, "rm") == 0)) {
+        min_args = 1;
+        max_args = INT_MAX;
+    } else if ((strcmp(command, "get") == 0) || (strcmp(command, "put") == 0)) {
+        min_args = 1;
+        max_args = 2;
+    } else if ((strcmp(command, "import") == 0) || (strcmp(command, "export") == 0)) {
+        min_args = 1;
+        max_args = 1;
+    } else {
+        usage(argv[0]);
+        return 1;
+    }
+    if ((argc - 3 < min_args) || (argc - 3 > max_args)) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    // Blocks are read as they are needed, and every change stays in memory until the image is closed.
+    // Without a flusher, and with no dirty limit to reach, nothing is written back before then.
+    set_lazy_loading(1);
+    set_durability("relaxed");
+    set_dirty_limit(UINT32_MAX);
+    set_refuse_unclean(!force);
+    if ((img_fd = open(argv[1], O_RDWR)) < 0) {
+        perror("Failed to open filesystem image");
+        return 1;
+    }
+    if ((result = load_image()) != 0) {
+        if (result == 2) {
+            fprintf(stderr, "Unmount it first, or pass -f if it was left behind by a crash\n");
+        }
+        return 1;
+    }
+    if ((buffer = malloc(TOOL_BUFFER)) == NULL) {
+        fprintf(stderr, "Out of memory\n");
+        stop_filesystem();
+        return 1;
+    }
+
+    failed = 0;
+    if (strcmp(command, "ls") == 0) {
+        list_files();
+    } else if (strcmp(command, "cat") == 0) {
+        for (k = 3; k < argc; k++) {
+            if ((result = copy_out(argv[k], STDOUT_FILENO)) != 0) {
+                fprintf(stderr, "%s: %s\n", argv[k], strerror(-result));
+                failed = 1;
+            }
+        }
+    } else if (strcmp(command, "get") == 0) {
+        if ((result = get_file(argv[3], (argc > 4) ? argv[4] : argv[3])) != 0) {
+            fprintf(stderr, "%s: %s\n", argv[3], strerror(-result));
+            failed = 1;
+        }
+    } else if (strcmp(command, "put") == 0) {
+        // Named after the local file, without its directory, unless a name is given.
+        name = (argc > 4) ? argv[4] : ((strrchr(argv[3], '/') != NULL) ? strrchr(argv[3], '/') + 1 : argv[3]);
+        if ((result = copy_in(argv[3], name)) != 0) {
+            fprintf(stderr, "%s: %s\n", argv[3], strerror(-result));
+            failed = 1;
+        }
+    } else if (strcmp(command, "rm") == 0) {
+        for (k = 3; k < argc; k++) {
+            if ((result = unlink_entry(argv[k])) != 0) {
+                fprintf(stderr, "%s: %s\n", argv[k], strerror(-result));
+                failed = 1;
+            }
+        }
+    } else if (strcmp(command, "import") == 0) {
+        failed = (import_files(argv[3]) != 0);
+    } else {
+        failed = (export_files(argv[3]) != 0);
+    }
+
+    free(buffer);
+    // The one writeback, through the journal if the changes fit in it. Nothing is on the image until it succeeds.
+    if (stop_filesystem() != 0) {
+        failed = 1;
+    }
+    return failed ? 1 : 0;
+}
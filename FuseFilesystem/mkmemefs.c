@@ -33,6 +33,7 @@
 
 #include <stdio.h>
 #include <errno.h>
+#include <getopt.h>
 #include <stdint.h>
 #include <string.h>
 #include <stdlib.h>
@@ -59,9 +60,43 @@
     uint16_t num_user_blocks;  // Number of user data blocks
     uint16_t first_user_block; // First user data block
     char volume_label[16];     // Volume label
-    uint8_t unused[448];       // Unused space for alignment
+    uint32_t block_size;       // Bytes per block (v2)
+    uint32_t total_blocks;     // Blocks in the image (v2)
+    uint32_t journal_start;    // Starting block for the metadata journal (v2)
+    uint32_t journal_size;     // Journal size in blocks (v2)
+    uint32_t main_fat32;       // Starting block for main FAT (v2)
+    uint32_t backup_fat32;     // Starting block for backup FAT (v2)
+    uint32_t fat_size32;       // Size of each FAT in blocks (v2)
+    uint32_t directory_start32; // Starting block for directory (v2)
+    uint32_t directory_size32; // Directory size in blocks (v2)
+    uint32_t first_user_block32; // First user data block (v2)
+    uint32_t num_user_blocks32; // Number of user data blocks (v2)
+    uint8_t fat_entry_size;    // Bytes per FAT entry (v2)
+    uint8_t unused[403];       // Unused space for alignment
 } __attribute__((packed)) memefs_superblock_t;
 
+// Layout of a version 2 image, in blocks.
+typedef struct v2_layout
+{
+    uint32_t block_size;
+    uint32_t total_blocks;
+    uint32_t journal_start;
+    uint32_t journal_size;
+    uint32_t main_fat;
+    uint32_t backup_fat;
+    uint32_t fat_size;
+    uint32_t directory_start;
+    uint32_t directory_size;
+    uint32_t first_user_block;
+    uint32_t num_user_blocks;
+} v2_layout_t;
+
+#define V2_DEFAULT_BLOCK_SIZE 4096
+#define V2_DEFAULT_USER_BLOCKS 4096
+#define V2_DEFAULT_DIR_ENTRIES 1024
+#define V2_MAX_USER_BLOCKS 0x00FFFFFF // Start blocks are 24 bits in directory entries.
+#define V2_MAX_DIR_ENTRIES 32767
+
 // Buffer for holding data blocks to be written to the filesystem image.
 static uint8_t block_buf[512];
 
@@ -204,6 +239,126 @@ static int write_superblock(int fd, const char *volname)
     return 0;
 }
 
+// Works out where each region of a version 2 image goes. Returns nonzero if the
+// requested geometry is not supported.
+static int plan_v2_layout(v2_layout_t *l, uint32_t block_size,
+                          uint32_t user_blocks, uint32_t dir_entries,
+                          uint32_t journal_blocks)
+{
+    uint64_t total;
+
+    if (block_size < 512 || block_size > 65536 ||
+        (block_size & (block_size - 1)))
+    {
+        fprintf(stderr, "Block size must be a power of two from 512 to "
+                "65536\n");
+        return -1;
+    }
+
+    if (user_blocks == 0 || user_blocks > V2_MAX_USER_BLOCKS)
+    {
+        fprintf(stderr, "User block count must be from 1 to %u\n",
+                V2_MAX_USER_BLOCKS);
+        return -1;
+    }
+
+    l->block_size = block_size;
+    l->num_user_blocks = user_blocks;
+    l->fat_size = (uint32_t)(((uint64_t)user_blocks * 4 + block_size - 1) /
+                             block_size);
+    l->directory_size = (uint32_t)(((uint64_t)dir_entries * 32 +
+                                    block_size - 1) / block_size);
+
+    // The directory is rounded up to whole blocks, so check what it holds.
+    if (dir_entries == 0 ||
+        (uint64_t)l->directory_size * block_size / 32 > V2_MAX_DIR_ENTRIES)
+    {
+        fprintf(stderr, "Directory must hold from 1 to %u entries\n",
+                V2_MAX_DIR_ENTRIES);
+        return -1;
+    }
+
+    // By default the journal can log the whole directory and FAT at once, or
+    // as many blocks as its header can name.
+    if (journal_blocks == 0)
+    {
+        journal_blocks = l->directory_size + l->fat_size;
+        if (journal_blocks > (block_size - 18) / 4)
+            journal_blocks = (block_size - 18) / 4;
+        journal_blocks++;
+    }
+    if (journal_blocks < 2)
+    {
+        fprintf(stderr, "Journal needs at least 2 blocks\n");
+        return -1;
+    }
+
+    l->journal_start = 1;
+    l->journal_size = journal_blocks;
+    l->main_fat = l->journal_start + l->journal_size;
+    l->backup_fat = l->main_fat + l->fat_size;
+    l->directory_start = l->backup_fat + l->fat_size;
+    l->first_user_block = l->directory_start + l->directory_size;
+
+    total = (uint64_t)l->first_user_block + user_blocks + 1;
+    if (total > UINT32_MAX)
+    {
+        fprintf(stderr, "Image would have too many blocks\n");
+        return -1;
+    }
+
+    l->total_blocks = (uint32_t)total;
+    return 0;
+}
+
+// Writes the version 2 superblock to the first and last blocks of the image.
+// Everything else in a fresh v2 image is zero, which ftruncate already gives.
+static int write_superblock_v2(int fd, const char *volname,
+                               const v2_layout_t *l)
+{
+    memefs_superblock_t *sb = (memefs_superblock_t *)block_buf;
+
+    fill_superblock(volname);
+    sb->fs_version = htonl(2);
+
+    // The 16-bit fields stay for v1 tools, clamped where they can't fit.
+    sb->main_fat = htons(l->main_fat > 0xFFFF ? 0xFFFF : l->main_fat);
+    sb->main_fat_size = htons(l->fat_size > 0xFFFF ? 0xFFFF : l->fat_size);
+    sb->backup_fat = htons(l->backup_fat > 0xFFFF ? 0xFFFF : l->backup_fat);
+    sb->backup_fat_size = sb->main_fat_size;
+    sb->directory_start = htons(l->directory_start > 0xFFFF ? 0xFFFF :
+                                l->directory_start);
+    sb->directory_size = htons(l->directory_size > 0xFFFF ? 0xFFFF :
+                               l->directory_size);
+    sb->num_user_blocks = htons(l->num_user_blocks > 0xFFFF ? 0xFFFF :
+                                l->num_user_blocks);
+    sb->first_user_block = htons(l->first_user_block > 0xFFFF ? 0xFFFF :
+                                 l->first_user_block);
+
+    sb->block_size = htonl(l->block_size);
+    sb->total_blocks = htonl(l->total_blocks);
+    sb->journal_start = htonl(l->journal_start);
+    sb->journal_size = htonl(l->journal_size);
+    sb->main_fat32 = htonl(l->main_fat);
+    sb->backup_fat32 = htonl(l->backup_fat);
+    sb->fat_size32 = htonl(l->fat_size);
+    sb->directory_start32 = htonl(l->directory_start);
+    sb->directory_size32 = htonl(l->directory_size);
+    sb->first_user_block32 = htonl(l->first_user_block);
+    sb->num_user_blocks32 = htonl(l->num_user_blocks);
+    sb->fat_entry_size = 4;
+
+    if (pwrite(fd, block_buf, 512, 0) != 512 ||
+        pwrite(fd, block_buf, 512, (off_t)(l->total_blocks - 1) *
+               l->block_size) != 512)
+    {
+        perror("pwrite");
+        return -1;
+    }
+
+    return 0;
+}
+
 // Copies a file from source to destination in 512-byte chunks.
 static int copy_file(const char *src, const char *dst)
 {
@@ -239,22 +394,87 @@ static int copy_file(const char *src, const char *dst)
     return 0;
 }
 
+// Prints the command line usage.
+static void usage(const char *prog)
+{
+    printf("Usage: %s [-b block_size] [-n user_blocks] [-d dir_entries] "
+           "[-j journal_blocks] image_filename [vol_name]\n", prog);
+    printf("Any of -b, -n, -d or -j makes a version 2 image, otherwise a "
+           "version 1 image is made.\n");
+}
+
+// Parses a positive number from a command line option.
+static int parse_count(const char *arg, uint32_t *out)
+{
+    char *end;
+    unsigned long val;
+
+    errno = 0;
+    val = strtoul(arg, &end, 0);
+    if (errno || *end != '\0' || val == 0 || val > UINT32_MAX)
+    {
+        fprintf(stderr, "Invalid number: %s\n", arg);
+        return -1;
+    }
+
+    *out = (uint32_t)val;
+    return 0;
+}
+
 // Main function for creating a filesystem image file.
 int main(int argc, char *argv[])
 {
-    int fd;
+    int fd, opt, v2 = 0;
     char tmpfn[64];
+    const char *prog = argc > 0 ? argv[0] : "mkmemefs";
+    const char *imgfn, *volname;
+    uint32_t block_size = V2_DEFAULT_BLOCK_SIZE;
+    uint32_t user_blocks = V2_DEFAULT_USER_BLOCKS;
+    uint32_t dir_entries = V2_DEFAULT_DIR_ENTRIES;
+    uint32_t journal_blocks = 0;
+    v2_layout_t layout;
+
+    while ((opt = getopt(argc, argv, "b:n:d:j:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'b':
+            if (parse_count(optarg, &block_size))
+                return 1;
+            break;
+        case 'n':
+            if (parse_count(optarg, &user_blocks))
+                return 1;
+            break;
+        case 'd':
+            if (parse_count(optarg, &dir_entries))
+                return 1;
+            break;
+        case 'j':
+            if (parse_count(optarg, &journal_blocks))
+                return 1;
+            break;
+        default:
+            usage(prog);
+            return 1;
+        }
+        v2 = 1;
+    }
 
     // Ensures the correct number of arguments are provided.
-    if (argc < 2 || argc > 3)
+    if (argc - optind < 1 || argc - optind > 2)
     {
-        if (argc > 0)
-            printf("Usage: %s image_filename [vol_name]\n", argv[0]);
-        else
-            printf("Usage: mkmemefs image_filename [vol_name]\n");
+        usage(prog);
         return 1;
     }
 
+    imgfn = argv[optind];
+    volname = argc - optind == 2 ? argv[optind + 1] : NULL;
+
+    if (v2 && plan_v2_layout(&layout, block_size, user_blocks, dir_entries,
+                             journal_blocks))
+        return 1;
+
     strcpy(tmpfn, "/tmp/mkmemefsXXXXXX");
 
     // Creates a temporary file.
@@ -264,8 +484,10 @@ int main(int argc, char *argv[])
         return 1;
     }
 
-    // Sets the size of the file to 256 blocks (512 bytes each).
-    if (ftruncate(fd, 256 * 512))
+    // Sets the size of the file to 256 blocks (512 bytes each), or to the
+    // whole v2 layout. The image starts out sparse and zeroed.
+    if (ftruncate(fd, v2 ? (off_t)layout.total_blocks * layout.block_size :
+                  256 * 512))
     {
         perror("ftruncate");
         close(fd);
@@ -273,31 +495,44 @@ int main(int argc, char *argv[])
         return 1;
     }
 
-    // Writes the superblock data to the image file.
-    if (write_superblock(fd, argc == 3 ? argv[2] : NULL))
+    if (v2)
     {
-        close(fd);
-        unlink(tmpfn);
-        return 1;
+        // A zeroed FAT is all free and a zeroed directory is all empty.
+        if (write_superblock_v2(fd, volname, &layout))
+        {
+            close(fd);
+            unlink(tmpfn);
+            return 1;
+        }
     }
-
-    // Writes the FAT to the image file.
-    if (write_fat(fd))
+    else
     {
-        close(fd);
-        unlink(tmpfn);
-        return -1;
+        // Writes the superblock data to the image file.
+        if (write_superblock(fd, volname))
+        {
+            close(fd);
+            unlink(tmpfn);
+            return 1;
+        }
+
+        // Writes the FAT to the image file.
+        if (write_fat(fd))
+        {
+            close(fd);
+            unlink(tmpfn);
+            return -1;
+        }
     }
 
     close(fd);
 
     // Renames the temporary file to the desired output filename.
-    if (rename(tmpfn, argv[1]))
+    if (rename(tmpfn, imgfn))
     {
         if (errno == EXDEV)
         {
             // If rename fails, attempts to copy the file instead.
-            if (!copy_file(tmpfn, argv[1]))
+            if (!copy_file(tmpfn, imgfn))
             {
                 unlink(tmpfn);
                 return 0;
@@ -0,0 +1,331 @@
+// File:    allocator.c
+// Author:  Eric Ekey
+// Date:    10/16/2026
+// Desc:    Free block bitmap allocator for memefs user data blocks.
+
+#include "allocator.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "define.h"
+#include "dirty.h"
+#include "events.h"
+#include "geometry.h"
+#include "stats.h"
+
+#define FREE_MAP_WORD_BITS 64
+
+extern memefs_geometry_t geometry;
+extern uint32_t* main_fat;
+
+static pthread_mutex_t fat_lock = PTHREAD_MUTEX_INITIALIZER; // Guards the FAT and everything below.
+
+static uint64_t* free_map;                       // One bit per user data block, set when free.
+static uint32_t free_map_words;                  // Length of free_map.
+static uint32_t num_free_blocks;                 // Number of bits set in free_map.
+static alloc_policy_t policy = ALLOC_BEST_FIT;   // Policy used by allocate_blocks.
+static uint32_t next_fit_rover;                  // Where next fit resumes when given no hint.
+
+#pragma region Prototypes
+
+// static int find_best_run(uint32_t, uint32_t*)
+// Description: Finds the shortest free run holding at least count blocks.
+// Preconditions: None.
+// Postconditions: run_start holds the first block of the run if one was found.
+// Returns: 1 if a run was found, 0 otherwise.
+static int find_best_run(uint32_t count, uint32_t* run_start);
+
+// static uint32_t find_next_bit(uint32_t, int)
+// Description: Finds the first free (or in use) block at or after a block, a word at a time.
+// Preconditions: None.
+// Postconditions: None.
+// Returns: Block number, or the number of user data blocks if there is none.
+static uint32_t find_next_bit(uint32_t from, int want_free);
+
+// static void set_block_free(uint32_t, int)
+// Description: Updates a block's bit in the free map and the free count.
+// Preconditions: Block is a user data block.
+// Postconditions: Block is marked free or in use.
+// Returns: None.
+static void set_block_free(uint32_t block, int is_free);
+
+// static void store_fat_entry(uint32_t, uint32_t)
+// Description: Sets an entry in the FAT.
+// Preconditions: fat_lock is held. Index is a valid FAT index.
+// Postconditions: FAT holds the value, both on-disk copies are marked dirty.
+// Returns: None.
+static void store_fat_entry(uint32_t index, uint32_t value);
+
+// static void take_first_fit(uint32_t, uint32_t*)
+// Description: Collects the lowest numbered free blocks.
+// Preconditions: At least count blocks are free.
+// Postconditions: blocks holds count free block numbers.
+// Returns: None.
+static void take_first_fit(uint32_t count, uint32_t* blocks);
+
+// static void take_next_fit(uint32_t, uint32_t, uint32_t*)
+// Description: Collects free blocks in order starting at a block, wrapping around.
+// Preconditions: At least count blocks are free.
+// Postconditions: blocks holds count free block numbers.
+// Returns: None.
+static void take_next_fit(uint32_t count, uint32_t start, uint32_t* blocks);
+
+#pragma endregion Prototypes
+
+#pragma region Implementations
+
+int allocate_blocks(uint32_t count, uint32_t hint, uint32_t* blocks) {
+    uint32_t i, start, run_start;
+    uint64_t started;
+
+    if (count == 0) {
+        return 0;
+    }
+
+    started = event_begin();
+    pthread_mutex_lock(&fat_lock);
+    if (count > num_free_blocks) {
+        // Not enough free blocks.
+        pthread_mutex_unlock(&fat_lock);
+        event_end(PHASE_ALLOCATE, started);
+        return -ENOSPC;
+    }
+
+    start = (hint < geometry.user_data_num_blocks) ? (uint32_t)hint + 1 : next_fit_rover;
+    switch (policy) {
+        case ALLOC_FIRST_FIT:
+            take_first_fit(count, blocks);
+            break;
+        case ALLOC_NEXT_FIT:
+            take_next_fit(count, start, blocks);
+            break;
+        case ALLOC_BEST_FIT:
+            if ((hint < geometry.user_data_num_blocks) && (find_next_bit(start, 0) - start >= count)) {
+                // Blocks right after the tail are free, keep the chain contiguous.
+                run_start = start;
+            } else if (!find_best_run(count, &run_start)) {
+                // Too fragmented for one run, fill from the tail onwards.
+                take_next_fit(count, start, blocks);
+                break;
+            }
+            for (i = 0; i < count; i++) {
+                blocks[i] = run_start + i;
+            }
+            break;
+    }
+
+    for (i = 0; i < count; i++) {
+        set_block_free(blocks[i], 0);
+    }
+    next_fit_rover = (blocks[count - 1] + 1) % geometry.user_data_num_blocks;
+    pthread_mutex_unlock(&fat_lock);
+    event_end(PHASE_ALLOCATE, started);
+    add_stat(STAT_ALLOCATIONS, 1);
+    add_stat(STAT_BLOCKS_ALLOCATED, count);
+    return 0;
+}
+
+int allocate_run(uint32_t count, uint32_t* first_block) {
+    uint32_t i, run_start;
+    uint64_t started;
+
+    started = event_begin();
+    pthread_mutex_lock(&fat_lock);
+    if ((count == 0) || (count > num_free_blocks) || !find_best_run(count, &run_start)) {
+        // No free run is long enough.
+        pthread_mutex_unlock(&fat_lock);
+        event_end(PHASE_ALLOCATE, started);
+        return -ENOSPC;
+    }
+
+    for (i = 0; i < count; i++) {
+        set_block_free(run_start + i, 0);
+    }
+    pthread_mutex_unlock(&fat_lock);
+    event_end(PHASE_ALLOCATE, started);
+    add_stat(STAT_ALLOCATIONS, 1);
+    add_stat(STAT_BLOCKS_ALLOCATED, count);
+    *first_block = run_start;
+    return 0;
+}
+
+int build_free_map() {
+    uint32_t block, num_words;
+    uint64_t* new_map;
+
+    num_words = (geometry.user_data_num_blocks + FREE_MAP_WORD_BITS - 1) / FREE_MAP_WORD_BITS;
+    if ((new_map = calloc(num_words, sizeof(uint64_t))) == NULL) {
+        return -ENOMEM;
+    }
+
+    pthread_mutex_lock(&fat_lock);
+    free(free_map);
+    free_map = new_map;
+    free_map_words = num_words;
+    __atomic_store_n(&num_free_blocks, 0, __ATOMIC_RELAXED);
+    next_fit_rover = 0;
+
+    // Only FAT entries backed by a block in user_data can be handed out.
+    for (block = 0; block < geometry.user_data_num_blocks; block++) {
+        if (main_fat[block] == FAT_FREE) {
+            set_block_free(block, 1);
+        }
+    }
+    pthread_mutex_unlock(&fat_lock);
+    return 0;
+}
+
+static int find_best_run(uint32_t count, uint32_t* run_start) {
+    uint32_t start, end, best_length;
+    int found;
+
+    found = 0;
+    best_length = 0;
+    for (start = find_next_bit(0, 1); start < geometry.user_data_num_blocks; start = find_next_bit(end, 1)) {
+        end = find_next_bit(start, 0);
+        if ((end - start >= count) && (!found || (end - start < best_length))) {
+            // Shorter run that still fits.
+            found = 1;
+            best_length = end - start;
+            *run_start = start;
+            if (best_length == count) {
+                // Exact fit, can't do better.
+                break;
+            }
+        }
+    }
+
+    return found;
+}
+
+static uint32_t find_next_bit(uint32_t from, int want_free) {
+    uint32_t word;
+    uint64_t bits;
+
+    if (from >= geometry.user_data_num_blocks) {
+        return geometry.user_data_num_blocks;
+    }
+
+    word = from / FREE_MAP_WORD_BITS;
+    bits = want_free ? free_map[word] : ~free_map[word];
+    bits &= ~(uint64_t)0 << (from % FREE_MAP_WORD_BITS);
+    while (bits == 0) {
+        if (++word >= free_map_words) {
+            return geometry.user_data_num_blocks;
+        }
+        bits = want_free ? free_map[word] : ~free_map[word];
+    }
+
+    return MIN((word * FREE_MAP_WORD_BITS) + (uint32_t)__builtin_ctzll(bits), (uint32_t)geometry.user_data_num_blocks);
+}
+
+void free_chain(uint32_t first_block) {
+    uint32_t curr_block, next_block, steps;
+
+    // Bounded so a corrupt FAT can't loop forever.
+    pthread_mutex_lock(&fat_lock);
+    for (curr_block = first_block, steps = 0; (curr_block != FAT_END_OF_CHAIN) && (curr_block < geometry.fat_num_entries) && (steps < geometry.fat_num_entries); curr_block = next_block, steps++) {
+        next_block = main_fat[curr_block];
+        store_fat_entry(curr_block, FAT_FREE);
+        if (curr_block < geometry.user_data_num_blocks) {
+            set_block_free(curr_block, 1);
+        }
+    }
+    pthread_mutex_unlock(&fat_lock);
+    add_stat(STAT_BLOCKS_FREED, steps);
+}
+
+uint32_t free_block_count() {
+    return __atomic_load_n(&num_free_blocks, __ATOMIC_RELAXED);
+}
+
+uint32_t get_fat_entry(uint32_t index) {
+    uint32_t value;
+
+    pthread_mutex_lock(&fat_lock);
+    value = main_fat[index];
+    pthread_mutex_unlock(&fat_lock);
+    return value;
+}
+
+int set_alloc_policy(const char* name) {
+    if (strcmp(name, "first") == 0) {
+        policy = ALLOC_FIRST_FIT;
+    } else if (strcmp(name, "next") == 0) {
+        policy = ALLOC_NEXT_FIT;
+    } else if (strcmp(name, "best") == 0) {
+        policy = ALLOC_BEST_FIT;
+    } else {
+        return -EINVAL;
+    }
+    return 0;
+}
+
+void set_fat_entry(uint32_t index, uint32_t value) {
+    pthread_mutex_lock(&fat_lock);
+    store_fat_entry(index, value);
+    pthread_mutex_unlock(&fat_lock);
+}
+
+static void set_block_free(uint32_t block, int is_free) {
+    uint64_t mask;
+    int was_free;
+
+    mask = (uint64_t)1 << (block % FREE_MAP_WORD_BITS);
+    was_free = (free_map[block / FREE_MAP_WORD_BITS] & mask) != 0;
+    if (is_free && !was_free) {
+        free_map[block / FREE_MAP_WORD_BITS] |= mask;
+        __atomic_store_n(&num_free_blocks, num_free_blocks + 1, __ATOMIC_RELAXED);
+    } else if (!is_free && was_free) {
+        free_map[block / FREE_MAP_WORD_BITS] &= ~mask;
+        __atomic_store_n(&num_free_blocks, num_free_blocks - 1, __ATOMIC_RELAXED);
+    }
+}
+
+void snapshot_fat(uint32_t first_index, uint32_t num_entries, void* out) {
+    uint16_t* out16;
+    uint32_t* out32;
+    uint32_t i, end;
+
+    // Encodes in the on-disk format so the live FAT is never swapped in place.
+    out16 = (uint16_t*)out;
+    out32 = (uint32_t*)out;
+    end = MIN(first_index + num_entries, geometry.fat_num_entries);
+    pthread_mutex_lock(&fat_lock);
+    for (i = first_index; i < end; i++) {
+        if (geometry.fat_entry_size == sizeof(uint16_t)) {
+            out16[i - first_index] = htons((main_fat[i] == FAT_END_OF_CHAIN) ? 0xFFFF : (uint16_t)main_fat[i]);
+        } else {
+            out32[i - first_index] = htonl(main_fat[i]);
+        }
+    }
+    pthread_mutex_unlock(&fat_lock);
+}
+
+static void store_fat_entry(uint32_t index, uint32_t value) {
+    main_fat[index] = value;
+    mark_fat_dirty(index);
+}
+
+static void take_first_fit(uint32_t count, uint32_t* blocks) {
+    take_next_fit(count, 0, blocks);
+}
+
+static void take_next_fit(uint32_t count, uint32_t start, uint32_t* blocks) {
+    uint32_t found, block;
+
+    start %= geometry.user_data_num_blocks;
+    for (found = 0, block = find_next_bit(start, 1); (found < count) && (block < geometry.user_data_num_blocks); block = find_next_bit(block + 1, 1)) {
+        blocks[found++] = block;
+    }
+    for (block = find_next_bit(0, 1); (found < count) && (block < start); block = find_next_bit(block + 1, 1)) {
+        // Wrap around to the blocks before start.
+        blocks[found++] = block;
+    }
+}
+
+#pragma endregion Implementations
\ No newline at end of file
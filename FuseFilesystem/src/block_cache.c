@@ -0,0 +1,467 @@
+// File:    block_cache.c
+// Author:  Eric Ekey
+// Date:    10/16/2026
+// Desc:    Bounded cache of user data blocks, evicted in CLOCK order.
+
+#include "block_cache.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "define.h"
+#include "dirty.h"
+#include "geometry.h"
+#include "loaders.h"
+
+#define DEFAULT_READAHEAD 16
+#define MAX_READAHEAD_SHIFT 3 // Sequential readers read ahead up to 8 times the setting.
+#define MIN_CACHE_FRAMES 64
+#define NO_FRAME UINT32_MAX
+#define PREFETCH_IOV_MAX 64
+
+// Struct describing one block-sized slot of cache memory.
+typedef struct cache_frame {
+    uint32_t block;     // User data block held, valid only if in_use
+    uint32_t pins;      // Threads using the data
+    uint8_t in_use;     // Whether the frame holds a block
+    uint8_t loading;    // Whether a read from the image is filling the frame
+    uint8_t evicting;   // Whether the frame is being written home before it is reused
+    uint8_t referenced; // Second chance bit for the CLOCK hand
+    uint8_t modified;   // Whether the data changed since writeback last finished with it
+} cache_frame_t;
+
+extern memefs_geometry_t geometry;
+extern int img_fd;
+extern int use_mmap;
+extern uint8_t* user_data;
+
+static int lazy_loading;                       // Whether user data is loaded on first access.
+static uint32_t readahead = DEFAULT_READAHEAD; // Blocks past a fault also read in.
+static uint64_t cache_budget;                  // Bytes of user data held, 0 for the whole region.
+
+static cache_frame_t* frames;
+static uint8_t* frame_data;      // num_frames blocks of data, one per frame.
+static uint32_t* frame_of_block; // Frame holding each user data block, or NO_FRAME.
+static uint32_t num_frames;
+static uint32_t clock_hand;
+static uint32_t num_waiters;     // Threads blocked on cache_changed.
+static memefs_cache_stats_t stats;
+static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER; // Guards everything above. Taken last, after every other lock.
+static pthread_cond_t cache_changed = PTHREAD_COND_INITIALIZER; // Signalled when a load finishes or a frame is unpinned.
+
+#pragma region Prototypes
+
+// static void assign_frame(uint32_t, uint32_t)
+// Description: Makes a free frame hold a user data block.
+// Preconditions: cache_lock is held. Frame is not in use. Block is not in the cache.
+// Postconditions: Frame holds the block, unpinned and unmodified.
+// Returns: None.
+static void assign_frame(uint32_t frame, uint32_t data_block);
+
+// static uint32_t find_victim()
+// Description: Advances the CLOCK hand to a frame that can be reused, writing it home first if it is dirty.
+//              The write happens with cache_lock dropped, so the caller must recheck what it looked up before.
+// Preconditions: cache_lock is held.
+// Postconditions: cache_lock is held. Returned frame is not in use.
+// Returns: Frame number, or NO_FRAME if every frame is pinned, loading or being evicted.
+static uint32_t find_victim();
+
+// static uint8_t* frame_bytes(uint32_t)
+// Description: Gets the memory of a frame.
+// Preconditions: Frame exists.
+// Postconditions: None.
+// Returns: Frame data.
+static uint8_t* frame_bytes(uint32_t frame);
+
+// static void release_frame(uint32_t)
+// Description: Drops the block a frame holds.
+// Preconditions: cache_lock is held. Frame is in use and unpinned by everyone but a failed loader.
+// Postconditions: Frame is free and the block is no longer in the cache.
+// Returns: None.
+static void release_frame(uint32_t frame);
+
+// static void wake_waiters()
+// Description: Wakes threads waiting for a frame to load or be unpinned.
+// Preconditions: cache_lock is held.
+// Postconditions: Waiters recheck the cache.
+// Returns: None.
+static void wake_waiters();
+
+#pragma endregion Prototypes
+
+#pragma region Implementations
+
+static void assign_frame(uint32_t frame, uint32_t data_block) {
+    frames[frame].block = data_block;
+    frames[frame].pins = 0;
+    frames[frame].in_use = 1;
+    frames[frame].loading = 0;
+    frames[frame].evicting = 0;
+    frames[frame].referenced = 0;
+    frames[frame].modified = 0;
+    frame_of_block[data_block] = frame;
+    stats.resident_blocks++;
+}
+
+static uint32_t find_victim() {
+    cache_frame_t* candidate;
+    uint32_t frame, steps;
+    int claimed, result;
+
+    // Two sweeps, so every referenced frame gets its second chance.
+    for (steps = 0; steps < 2 * num_frames; steps++) {
+        frame = clock_hand;
+        candidate = &frames[frame];
+        clock_hand = (clock_hand + 1) % num_frames;
+        if (!candidate->in_use) {
+            return frame;
+        }
+        if (candidate->pins > 0 || candidate->loading || candidate->evicting) {
+            continue;
+        }
+        if (candidate->referenced) {
+            candidate->referenced = 0;
+            continue;
+        }
+        claimed = claim_dirty_block(geometry.user_data_begin + candidate->block);
+        if (claimed || candidate->modified) {
+            // Not written home yet, so write it now instead of waiting for writeback.
+            // A writeback that claimed it but hasn't pinned it yet may itself be waiting on the update
+            // that wants this frame, and skips blocks being evicted.
+            // Other threads only wait on this frame while the write runs, the rest of the cache stays usable.
+            candidate->evicting = 1;
+            pthread_mutex_unlock(&cache_lock);
+            result = write_data_block(candidate->block, frame_bytes(frame));
+            pthread_mutex_lock(&cache_lock);
+            candidate->evicting = 0;
+            if (result != 0) {
+                // A writeback may have skipped it meanwhile, so it is dirty again either way.
+                mark_data_dirty(candidate->block);
+                wake_waiters();
+                continue;
+            }
+            candidate->modified = 0;
+            stats.dirty_evictions++;
+        }
+        release_frame(frame);
+        stats.evictions++;
+        wake_waiters();
+        return frame;
+    }
+    return NO_FRAME;
+}
+
+void finish_block_writeback(uint32_t data_block, int written) {
+    uint32_t frame;
+
+    if (user_data != NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&cache_lock);
+    frame = frame_of_block[data_block];
+    if (frame != NO_FRAME) {
+        if (written) {
+            frames[frame].modified = 0;
+        }
+        frames[frame].pins--;
+        wake_waiters();
+    }
+    pthread_mutex_unlock(&cache_lock);
+}
+
+static uint8_t* frame_bytes(uint32_t frame) {
+    return frame_data + ((size_t)frame * geometry.block_size);
+}
+
+void get_cache_stats(memefs_cache_stats_t* out) {
+    pthread_mutex_lock(&cache_lock);
+    *out = stats;
+    pthread_mutex_unlock(&cache_lock);
+}
+
+int init_block_cache() {
+    uint64_t budget_frames;
+    uint32_t num_blocks;
+
+    free(frames);
+    free(frame_data);
+    free(frame_of_block);
+    frames = NULL;
+    frame_data = NULL;
+    frame_of_block = NULL;
+    num_frames = 0;
+    clock_hand = 0;
+    memset(&stats, 0x00, sizeof(stats));
+
+    if (use_mmap) {
+        // The page cache holds the data instead.
+        return 0;
+    }
+
+    num_blocks = geometry.user_data_num_blocks;
+    budget_frames = (cache_budget == 0) ? num_blocks : MAX(cache_budget / geometry.block_size, (uint64_t)MIN_CACHE_FRAMES);
+    num_frames = (uint32_t)MIN(budget_frames, (uint64_t)num_blocks);
+    frames = calloc(num_frames, sizeof(cache_frame_t));
+    frame_data = malloc((size_t)num_frames * geometry.block_size);
+    frame_of_block = malloc((size_t)num_blocks * sizeof(uint32_t));
+    if ((num_frames > 0 && (frames == NULL || frame_data == NULL)) || (num_blocks > 0 && frame_of_block == NULL)) {
+        num_frames = 0;
+        return -ENOMEM;
+    }
+    memset(frame_of_block, 0xFF, (size_t)num_blocks * sizeof(uint32_t));
+    stats.capacity_blocks = num_frames;
+    return 0;
+}
+
+const uint8_t* peek_block(uint32_t data_block) {
+    uint32_t frame;
+
+    if (user_data != NULL) {
+        return user_data + ((size_t)data_block * geometry.block_size);
+    }
+
+    pthread_mutex_lock(&cache_lock);
+    frame = frame_of_block[data_block];
+    pthread_mutex_unlock(&cache_lock);
+    return (frame != NO_FRAME) ? frame_bytes(frame) : NULL;
+}
+
+int pin_block(uint32_t data_block, pin_mode_t mode, uint8_t** data) {
+    cache_frame_t* entry;
+    uint32_t frame;
+    int result, writing;
+
+    if (data_block >= geometry.user_data_num_blocks) {
+        return -EIO;
+    }
+    if (user_data != NULL) {
+        *data = user_data + ((size_t)data_block * geometry.block_size);
+        return 0;
+    }
+
+    writing = (mode != PIN_READ) && (mode != PIN_READ_NOWAIT);
+    pthread_mutex_lock(&cache_lock);
+    for (;;) {
+        frame = frame_of_block[data_block];
+        if (frame != NO_FRAME && !frames[frame].loading && !frames[frame].evicting) {
+            // Hit.
+            entry = &frames[frame];
+            entry->pins++;
+            entry->referenced = 1;
+            entry->modified |= writing;
+            stats.hits++;
+            pthread_mutex_unlock(&cache_lock);
+            *data = frame_bytes(frame);
+            return 0;
+        }
+        if (frame == NO_FRAME && (frame = find_victim()) != NO_FRAME) {
+            if (frame_of_block[data_block] == NO_FRAME) {
+                break;
+            }
+            // Another thread brought the block in while a victim was written home. The victim stays free.
+            continue;
+        }
+        if (frame == NO_FRAME && mode == PIN_READ_NOWAIT) {
+            // Waiting while holding pins could leave every frame pinned by waiters.
+            pthread_mutex_unlock(&cache_lock);
+            return -EAGAIN;
+        }
+        // Another thread is reading the block in, or every frame is busy.
+        num_waiters++;
+        pthread_cond_wait(&cache_changed, &cache_lock);
+        num_waiters--;
+    }
+
+    // Miss, frame is free.
+    assign_frame(frame, data_block);
+    entry = &frames[frame];
+    entry->pins = 1;
+    entry->referenced = 1;
+    entry->modified = writing;
+    stats.misses++;
+    *data = frame_bytes(frame);
+    if (mode == PIN_OVERWRITE) {
+        pthread_mutex_unlock(&cache_lock);
+        return 0;
+    }
+
+    entry->loading = 1;
+    pthread_mutex_unlock(&cache_lock);
+    result = 0;
+    if (pread(img_fd, *data, geometry.block_size, (off_t)(geometry.user_data_begin + data_block) * geometry.block_size) != (ssize_t)geometry.block_size) {
+        perror("Failed to read user data block");
+        result = -EIO;
+    }
+    pthread_mutex_lock(&cache_lock);
+    entry->loading = 0;
+    if (result != 0) {
+        release_frame(frame);
+    }
+    wake_waiters();
+    pthread_mutex_unlock(&cache_lock);
+    return result;
+}
+
+int pin_for_writeback(uint32_t data_block) {
+    uint32_t frame;
+
+    if (user_data != NULL) {
+        return 0;
+    }
+
+    pthread_mutex_lock(&cache_lock);
+    frame = frame_of_block[data_block];
+    if (frame == NO_FRAME || frames[frame].loading || frames[frame].evicting) {
+        // Evicted, and written home on the way out.
+        pthread_mutex_unlock(&cache_lock);
+        return -ENOENT;
+    }
+    frames[frame].pins++;
+    pthread_mutex_unlock(&cache_lock);
+    return 0;
+}
+
+void prefetch_blocks(const uint32_t* chain, uint32_t chain_length, uint32_t first, uint32_t count, uint32_t ahead) {
+    struct iovec iov[PREFETCH_IOV_MAX];
+    uint32_t run_frames[PREFETCH_IOV_MAX];
+    uint32_t i, j, end, run_length, frame;
+    ssize_t expected;
+    int out_of_frames, read_ok;
+
+    if (user_data != NULL || num_frames == 0) {
+        return;
+    }
+
+    end = (uint32_t)MIN((uint64_t)first + count, (uint64_t)chain_length);
+    pthread_mutex_lock(&cache_lock);
+    for (i = first; (i < end) && (chain[i] >= geometry.user_data_num_blocks || frame_of_block[chain[i]] != NO_FRAME); i++);
+    if (i == end) {
+        // Everything wanted is already in memory.
+        pthread_mutex_unlock(&cache_lock);
+        return;
+    }
+
+    // Read the missing blocks and the next few in the chain, in runs of adjacent blocks.
+    end = (uint32_t)MIN((uint64_t)end + ahead, (uint64_t)chain_length);
+    out_of_frames = 0;
+    while ((i < end) && !out_of_frames) {
+        if (chain[i] >= geometry.user_data_num_blocks || frame_of_block[chain[i]] != NO_FRAME) {
+            i++;
+            continue;
+        }
+        for (run_length = 0; (i + run_length < end) && (run_length < PREFETCH_IOV_MAX) && (chain[i + run_length] == chain[i] + run_length)
+                             && (chain[i + run_length] < geometry.user_data_num_blocks) && (frame_of_block[chain[i + run_length]] == NO_FRAME); run_length++) {
+            if ((frame = find_victim()) == NO_FRAME) {
+                out_of_frames = 1;
+                break;
+            }
+            if (frame_of_block[chain[i + run_length]] != NO_FRAME) {
+                // Brought in by another thread while a victim was written home, end the run here.
+                break;
+            }
+            assign_frame(frame, chain[i + run_length]);
+            frames[frame].loading = 1;
+            run_frames[run_length] = frame;
+            iov[run_length].iov_base = frame_bytes(frame);
+            iov[run_length].iov_len = geometry.block_size;
+        }
+        if (run_length == 0 && out_of_frames) {
+            break;
+        }
+        if (run_length == 0) {
+            i++;
+            continue;
+        }
+
+        pthread_mutex_unlock(&cache_lock);
+        expected = (ssize_t)run_length * geometry.block_size;
+        read_ok = (preadv(img_fd, iov, (int)run_length, (off_t)(geometry.user_data_begin + chain[i]) * geometry.block_size) == expected);
+        pthread_mutex_lock(&cache_lock);
+        for (j = 0; j < run_length; j++) {
+            frames[run_frames[j]].loading = 0;
+            if (!read_ok) {
+                // Left for pin_block to retry and report.
+                release_frame(run_frames[j]);
+            }
+        }
+        if (read_ok) {
+            stats.readahead_blocks += run_length;
+        }
+        wake_waiters();
+        i += run_length;
+    }
+    pthread_mutex_unlock(&cache_lock);
+}
+
+int preload_block_cache() {
+    size_t data_bytes;
+    uint32_t i;
+
+    if (user_data != NULL || lazy_loading || num_frames < geometry.user_data_num_blocks) {
+        // Faulted in as files are used.
+        return 0;
+    }
+
+    data_bytes = (size_t)geometry.user_data_num_blocks * geometry.block_size;
+    if (pread(img_fd, frame_data, data_bytes, (off_t)geometry.user_data_begin * geometry.block_size) != (ssize_t)data_bytes) {
+        perror("Failed to read user data");
+        return -1;
+    }
+    for (i = 0; i < geometry.user_data_num_blocks; i++) {
+        assign_frame(i, i);
+    }
+    return 0;
+}
+
+static void release_frame(uint32_t frame) {
+    frame_of_block[frames[frame].block] = NO_FRAME;
+    frames[frame].in_use = 0;
+    frames[frame].pins = 0;
+    frames[frame].modified = 0;
+    stats.resident_blocks--;
+}
+
+void set_cache_size(uint64_t bytes) {
+    cache_budget = bytes;
+}
+
+void set_lazy_loading(int enabled) {
+    lazy_loading = enabled;
+}
+
+uint32_t readahead_window(uint32_t sequential_run) {
+    return readahead << MIN(sequential_run, MAX_READAHEAD_SHIFT);
+}
+
+void set_readahead(uint32_t num_blocks) {
+    readahead = num_blocks;
+}
+
+void unpin_block(uint32_t data_block) {
+    uint32_t frame;
+
+    if (user_data != NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&cache_lock);
+    frame = frame_of_block[data_block];
+    if (frame != NO_FRAME && frames[frame].pins > 0 && --frames[frame].pins == 0) {
+        wake_waiters();
+    }
+    pthread_mutex_unlock(&cache_lock);
+}
+
+static void wake_waiters() {
+    if (num_waiters > 0) {
+        pthread_cond_broadcast(&cache_changed);
+    }
+}
+
+#pragma endregion Implementations
@@ -0,0 +1,171 @@
+// File:    block_map.c
+// Author:  Eric Ekey
+// Date:    10/16/2026
+// Desc:    Cached per-file lists of the blocks in each FAT chain.
+
+#include "block_map.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+
+#include "allocator.h"
+#include "define.h"
+#include "geometry.h"
+#include "memefs_file_entry.h"
+
+extern memefs_geometry_t geometry;
+extern memefs_file_entry_t* directory;
+
+// Struct holding the cached FAT chain of one file.
+typedef struct block_map {
+    uint32_t* blocks;  // Block numbers in chain order
+    uint32_t count;    // Number of blocks in the chain
+    uint32_t capacity; // Allocated length of blocks
+    uint8_t valid;     // Whether blocks reflects the FAT
+} block_map_t;
+
+static block_map_t* block_maps;
+// Serializes lazy builds by readers sharing a file lock. Writers hold the file lock exclusively.
+static pthread_mutex_t* build_locks;
+static int num_block_maps; // Length of block_maps and build_locks.
+
+#pragma region Prototypes
+
+// static int build_block_map(int)
+// Description: Walks the main FAT to rebuild a file's block map.
+// Preconditions: Entry is in use.
+// Postconditions: Block map is valid.
+// Returns: 0 on success, < 0 on failure.
+static int build_block_map(int entry_index);
+
+// static int reserve_block_map(block_map_t*, uint32_t)
+// Description: Grows a block map so it can hold a number of blocks.
+// Preconditions: None.
+// Postconditions: Block map capacity is at least the requested count.
+// Returns: 0 on success, < 0 on failure.
+static int reserve_block_map(block_map_t* map, uint32_t count);
+
+#pragma endregion Prototypes
+
+#pragma region Implementations
+
+void block_map_append(int entry_index, uint32_t block) {
+    block_map_t* map;
+
+    map = &block_maps[entry_index];
+    if (!map->valid) {
+        // Built fresh on next access.
+        return;
+    }
+
+    if (reserve_block_map(map, map->count + 1) != 0) {
+        map->valid = 0;
+        return;
+    }
+    map->blocks[map->count++] = block;
+}
+
+int block_map_tail(int entry_index) {
+    const uint32_t* blocks;
+    uint32_t num_blocks;
+
+    if ((blocks = get_block_map(entry_index, &num_blocks)) == NULL || num_blocks == 0) {
+        return -EIO;
+    }
+    return blocks[num_blocks - 1];
+}
+
+static int build_block_map(int entry_index) {
+    block_map_t* map;
+    uint32_t curr_block;
+
+    map = &block_maps[entry_index];
+    map->count = 0;
+
+    // Walk the chain, bounded so a corrupt FAT can't loop forever.
+    for (curr_block = get_start_block(&directory[entry_index]); curr_block != FAT_END_OF_CHAIN; curr_block = get_fat_entry(curr_block)) {
+        if (curr_block >= geometry.fat_num_entries || map->count >= geometry.fat_num_entries) {
+            // Chain leaves the FAT or loops.
+            map->valid = 0;
+            return -EIO;
+        }
+        if (reserve_block_map(map, map->count + 1) != 0) {
+            map->valid = 0;
+            return -ENOMEM;
+        }
+        map->blocks[map->count++] = curr_block;
+    }
+
+    __atomic_store_n(&map->valid, 1, __ATOMIC_RELEASE);
+    return 0;
+}
+
+const uint32_t* get_block_map(int entry_index, uint32_t* num_blocks) {
+    int result;
+
+    if (!__atomic_load_n(&block_maps[entry_index].valid, __ATOMIC_ACQUIRE)) {
+        pthread_mutex_lock(&build_locks[entry_index]);
+        result = block_maps[entry_index].valid ? 0 : build_block_map(entry_index);
+        pthread_mutex_unlock(&build_locks[entry_index]);
+        if (result != 0) {
+            return NULL;
+        }
+    }
+
+    *num_blocks = block_maps[entry_index].count;
+    return block_maps[entry_index].blocks;
+}
+
+int init_block_maps() {
+    int i;
+
+    for (i = 0; i < num_block_maps; i++) {
+        free(block_maps[i].blocks);
+        pthread_mutex_destroy(&build_locks[i]);
+    }
+    free(block_maps);
+    free(build_locks);
+    num_block_maps = 0;
+
+    block_maps = calloc(geometry.max_file_entries, sizeof(block_map_t));
+    build_locks = calloc(geometry.max_file_entries, sizeof(pthread_mutex_t));
+    if (block_maps == NULL || build_locks == NULL) {
+        free(block_maps);
+        free(build_locks);
+        block_maps = NULL;
+        build_locks = NULL;
+        return -ENOMEM;
+    }
+    for (i = 0; i < (int)geometry.max_file_entries; i++) {
+        pthread_mutex_init(&build_locks[i], NULL);
+    }
+    num_block_maps = (int)geometry.max_file_entries;
+    return 0;
+}
+
+void invalidate_block_map(int entry_index) {
+    block_maps[entry_index].valid = 0;
+}
+
+static int reserve_block_map(block_map_t* map, uint32_t count) {
+    uint32_t* grown;
+    uint32_t new_capacity;
+
+    if (count <= map->capacity) {
+        return 0;
+    }
+
+    new_capacity = (map->capacity == 0) ? 8 : map->capacity;
+    while (new_capacity < count) {
+        new_capacity *= 2;
+    }
+    if ((grown = realloc(map->blocks, new_capacity * sizeof(uint32_t))) == NULL) {
+        return -ENOMEM;
+    }
+    map->blocks = grown;
+    map->capacity = new_capacity;
+    return 0;
+}
+
+#pragma endregion Implementations
\ No newline at end of file
@@ -0,0 +1,124 @@
+// File:    defrag.c
+// Author:  Eric Ekey
+// Date:    10/16/2026
+// Desc:    Online defragmentation of memefs FAT chains.
+
+#include "defrag.h"
+
+#include <errno.h>
+#include <string.h>
+
+#include "allocator.h"
+#include "block_cache.h"
+#include "block_map.h"
+#include "define.h"
+#include "dirty.h"
+#include "geometry.h"
+#include "memefs_file_entry.h"
+#include "utils.h"
+
+extern memefs_geometry_t geometry;
+extern memefs_file_entry_t* directory;
+
+#pragma region Prototypes
+
+// static int is_contiguous(const uint32_t*, uint32_t)
+// Description: Checks whether a chain's blocks are consecutive.
+// Preconditions: None.
+// Postconditions: None.
+// Returns: 1 if contiguous, 0 otherwise.
+static int is_contiguous(const uint32_t* blocks, uint32_t num_blocks);
+
+#pragma endregion Prototypes
+
+#pragma region Implementations
+
+int defragment_all(uint32_t* files_moved) {
+    uint32_t moved, moved_this_pass;
+    int i, result;
+
+    // Freed chains can open runs for files skipped earlier, so repeat while progress is made.
+    moved = 0;
+    do {
+        moved_this_pass = 0;
+        for (i = 0; i < (int)geometry.max_file_entries; i++) {
+            if (directory[i].type_permissions == 0x0000) {
+                // Free entry.
+                continue;
+            }
+            result = defragment_file(i);
+            if (result == 1) {
+                moved_this_pass++;
+            } else if ((result < 0) && (result != -ENOSPC)) {
+                return result;
+            }
+        }
+        moved += moved_this_pass;
+    } while (moved_this_pass > 0);
+
+    if (files_moved != NULL) {
+        *files_moved = moved;
+    }
+    return 0;
+}
+
+int defragment_file(int entry_index) {
+    const uint32_t* blocks;
+    uint32_t i, num_blocks, first_block, old_start;
+    uint8_t* source;
+    uint8_t* target;
+    int result;
+
+    if ((blocks = get_block_map(entry_index, &num_blocks)) == NULL) {
+        return -EIO;
+    }
+    if (is_contiguous(blocks, num_blocks)) {
+        // Nothing to do.
+        return 0;
+    }
+
+    if ((result = allocate_run(num_blocks, &first_block)) != 0) {
+        return result;
+    }
+
+    // Chain the run and copy the data over before anything points at it.
+    for (i = 0; i < num_blocks; i++) {
+        set_fat_entry(first_block + i, (i + 1 < num_blocks) ? first_block + i + 1 : FAT_END_OF_CHAIN);
+    }
+    prefetch_blocks(blocks, num_blocks, 0, num_blocks, 0);
+    for (i = 0; i < num_blocks; i++) {
+        if ((result = pin_block(blocks[i], PIN_READ, &source)) != 0) {
+            free_chain(first_block);
+            return result;
+        }
+        if ((result = pin_block(first_block + i, PIN_OVERWRITE, &target)) != 0) {
+            unpin_block(blocks[i]);
+            free_chain(first_block);
+            return result;
+        }
+        memcpy(target, source, geometry.block_size);
+        mark_data_dirty(first_block + i);
+        unpin_block(first_block + i);
+        unpin_block(blocks[i]);
+    }
+
+    old_start = get_start_block(&directory[entry_index]);
+    set_start_block(&directory[entry_index], first_block);
+    mark_directory_dirty(&directory[entry_index]);
+    free_chain(old_start);
+    invalidate_block_map(entry_index);
+    return 1;
+}
+
+static int is_contiguous(const uint32_t* blocks, uint32_t num_blocks) {
+    uint32_t i;
+
+    for (i = 1; i < num_blocks; i++) {
+        if (blocks[i] != blocks[i - 1] + 1) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+#pragma endregion Implementations
\ No newline at end of file
@@ -0,0 +1,232 @@
+// File:    dir_index.c
+// Author:  Eric Ekey
+// Date:    10/16/2026
+// Desc:    Hashed name index over the memefs directory, with each indexed entry decoded.
+
+#include "dir_index.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "define.h"
+#include "events.h"
+#include "geometry.h"
+#include "utils.h"
+
+extern memefs_geometry_t geometry;
+extern memefs_file_entry_t* directory;
+
+static int16_t* bucket_head;    // First entry in each bucket, -1 if empty.
+static int16_t* next_in_bucket; // Next entry in the same bucket, -1 at end.
+static char (*index_keys)[MAX_ENCODED_FILENAME_LENGTH]; // Canonical encoded name per entry.
+static uint8_t* is_indexed;     // Whether each entry is in the index.
+static uint32_t* generations;   // Times each entry has been given to a new file since mount.
+static uint32_t num_buckets;    // Power of two, at least the number of directory entries.
+
+// Each indexed entry as getattr and readdir report it, so they don't decode names and timestamps every call.
+typedef struct decoded_entry {
+    char readable_name[MAX_READABLE_FILENAME_LENGTH];
+    struct stat attrs;
+} decoded_entry_t;
+
+static decoded_entry_t* decoded; // Decoded form of each indexed entry.
+
+#pragma region Prototypes
+
+// static void decode_attrs(int)
+// Description: Decodes a directory entry's attributes into its slot of the decoded entries.
+// Preconditions: Entry is in use.
+// Postconditions: Attributes match the directory entry, except st_ino which is left 0.
+// Returns: None.
+static void decode_attrs(int entry_index);
+
+// static uint32_t hash_encoded_name(const char*)
+// Description: Hashes a memefs encoded filename (FNV-1a).
+// Preconditions: Encoded filename is MAX_ENCODED_FILENAME_LENGTH bytes.
+// Postconditions: None.
+// Returns: Bucket index for the name.
+static uint32_t hash_encoded_name(const char* encoded_name);
+
+#pragma endregion Prototypes
+
+#pragma region Implementations
+
+int build_dir_index() {
+    char readable_filename[MAX_READABLE_FILENAME_LENGTH];
+    uint32_t num_entries;
+    int i;
+
+    free(bucket_head);
+    free(next_in_bucket);
+    free(index_keys);
+    free(is_indexed);
+    free(generations);
+    free(decoded);
+
+    num_entries = geometry.max_file_entries;
+    for (num_buckets = 1; num_buckets < num_entries; num_buckets *= 2);
+    bucket_head = malloc(num_buckets * sizeof(int16_t));
+    next_in_bucket = malloc(num_entries * sizeof(int16_t));
+    index_keys = malloc(num_entries * sizeof(*index_keys));
+    is_indexed = calloc(num_entries, sizeof(uint8_t));
+    generations = calloc(num_entries, sizeof(uint32_t));
+    decoded = malloc(num_entries * sizeof(decoded_entry_t));
+    if (bucket_head == NULL || next_in_bucket == NULL || index_keys == NULL || is_indexed == NULL || generations == NULL
+        || decoded == NULL) {
+        free(bucket_head);
+        free(next_in_bucket);
+        free(index_keys);
+        free(is_indexed);
+        free(generations);
+        free(decoded);
+        bucket_head = next_in_bucket = NULL;
+        index_keys = NULL;
+        is_indexed = NULL;
+        generations = NULL;
+        decoded = NULL;
+        return -ENOMEM;
+    }
+    memset(bucket_head, 0xFF, num_buckets * sizeof(int16_t));
+    memset(next_in_bucket, 0xFF, num_entries * sizeof(int16_t));
+
+    for (i = 0; i < (int)num_entries; i++) {
+        if (directory[i].type_permissions == 0x0000) {
+            // Free entry.
+            continue;
+        }
+        name_to_readable(directory[i].filename, readable_filename);
+        if (check_legal_name(readable_filename) == 0) {
+            dir_index_insert(i);
+        }
+    }
+    return 0;
+}
+
+static void decode_attrs(int entry_index) {
+    struct stat* attrs = &decoded[entry_index].attrs;
+
+    memset(attrs, 0, sizeof(struct stat));
+    attrs->st_mode = (mode_t)(S_IFREG | 0644);
+    attrs->st_nlink = (nlink_t)1;
+    attrs->st_uid = (uid_t)directory[entry_index].uid_owner;
+    attrs->st_gid = (gid_t)directory[entry_index].gid_owner;
+    attrs->st_size = (off_t)directory[entry_index].size;
+    attrs->st_mtime = memefs_bcd_to_time(directory[entry_index].bcd_timestamp);
+    attrs->st_blocks = (blkcnt_t)((directory[entry_index].size + 511) / 512);
+}
+
+const struct stat* dir_index_attrs(int entry_index) {
+    return &decoded[entry_index].attrs;
+}
+
+uint32_t dir_index_generation(int entry_index) {
+    return generations[entry_index];
+}
+
+void dir_index_insert(int entry_index) {
+    uint32_t bucket;
+
+    if (is_indexed[entry_index]) {
+        dir_index_remove(entry_index);
+    } else {
+        // New file in the slot, so handles to the last one go stale.
+        generations[entry_index]++;
+    }
+
+    // Key on the canonical encoding so stray bytes after a NUL on disk don't matter.
+    name_to_readable(directory[entry_index].filename, decoded[entry_index].readable_name);
+    name_to_encoded(decoded[entry_index].readable_name, index_keys[entry_index]);
+    decode_attrs(entry_index);
+
+    bucket = hash_encoded_name(index_keys[entry_index]);
+    next_in_bucket[entry_index] = bucket_head[bucket];
+    bucket_head[bucket] = (int16_t)entry_index;
+    is_indexed[entry_index] = 1;
+}
+
+int dir_index_lookup(const char* encoded_name) {
+    int16_t curr;
+
+    for (curr = bucket_head[hash_encoded_name(encoded_name)]; curr != -1; curr = next_in_bucket[curr]) {
+        if (memcmp(index_keys[curr], encoded_name, MAX_ENCODED_FILENAME_LENGTH) == 0) {
+            // Found file entry.
+            return curr;
+        }
+    }
+
+    return -1;
+}
+
+const char* dir_index_name(int entry_index) {
+    return is_indexed[entry_index] ? decoded[entry_index].readable_name : NULL;
+}
+
+int dir_index_next(int from_entry) {
+    int i;
+
+    for (i = from_entry; i < (int)geometry.max_file_entries; i++) {
+        if (is_indexed[i]) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+void dir_index_remove(int entry_index) {
+    int16_t* link;
+
+    if (!is_indexed[entry_index]) {
+        // Not in the index.
+        return;
+    }
+
+    for (link = &bucket_head[hash_encoded_name(index_keys[entry_index])]; *link != -1; link = &next_in_bucket[*link]) {
+        if (*link == entry_index) {
+            // Unlink entry from its bucket.
+            *link = next_in_bucket[entry_index];
+            break;
+        }
+    }
+    next_in_bucket[entry_index] = -1;
+    is_indexed[entry_index] = 0;
+}
+
+void dir_index_touch(int entry_index, time_t mtime) {
+    decoded[entry_index].attrs.st_size = (off_t)directory[entry_index].size;
+    decoded[entry_index].attrs.st_mtime = mtime;
+    decoded[entry_index].attrs.st_blocks = (blkcnt_t)((directory[entry_index].size + 511) / 512);
+}
+
+static uint32_t hash_encoded_name(const char* encoded_name) {
+    uint32_t hash;
+    int i;
+
+    hash = 2166136261u;
+    for (i = 0; i < MAX_ENCODED_FILENAME_LENGTH; i++) {
+        hash ^= (uint8_t)encoded_name[i];
+        hash *= 16777619u;
+    }
+
+    return hash & (num_buckets - 1);
+}
+
+int lookup_file_entry(const char* readable_name) {
+    char encoded_filename[MAX_ENCODED_FILENAME_LENGTH];
+    uint64_t started;
+    int entry_index;
+
+    started = event_begin();
+    if (check_legal_name(readable_name) != 0) {
+        // Illegal names are never stored.
+        entry_index = -ENOENT;
+    } else {
+        name_to_encoded(readable_name, encoded_filename);
+        entry_index = dir_index_lookup(encoded_filename);
+    }
+    event_end(PHASE_LOOKUP, started);
+    return (entry_index < 0) ? -ENOENT : entry_index;
+}
+
+#pragma endregion Implementations
\ No newline at end of file
@@ -0,0 +1,212 @@
+// File:    dirty.c
+// Author:  Eric Ekey
+// Date:    10/16/2026
+// Desc:    Tracks which blocks of the filesystem image differ from memory.
+
+#include "dirty.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "define.h"
+#include "geometry.h"
+
+extern memefs_geometry_t geometry;
+extern memefs_file_entry_t* directory;
+
+// One bit per image block. Updated with atomics so ops never wait on writeback.
+static uint64_t* dirty_blocks;
+static uint32_t num_dirty_words;  // Length of dirty_blocks.
+static uint32_t num_dirty_blocks; // Number of bits set in dirty_blocks.
+
+#pragma region Prototypes
+
+// static int is_in_set(const dirty_set_t*, uint32_t)
+// Description: Checks whether an image block is in a set.
+// Preconditions: Block lies within the image.
+// Postconditions: None.
+// Returns: 1 if in the set, 0 otherwise.
+static int is_in_set(const dirty_set_t* set, uint32_t image_block);
+
+#pragma endregion Prototypes
+
+#pragma region Implementations
+
+void add_to_dirty_set(dirty_set_t* set, uint32_t image_block) {
+    if (image_block < geometry.total_blocks) {
+        set->words[image_block / DIRTY_WORD_BITS] |= (uint64_t)1 << (image_block % DIRTY_WORD_BITS);
+    }
+}
+
+int claim_dirty_block(uint32_t image_block) {
+    uint64_t mask;
+
+    if (image_block >= geometry.total_blocks) {
+        // Not part of the image.
+        return 0;
+    }
+    mask = (uint64_t)1 << (image_block % DIRTY_WORD_BITS);
+    if ((__atomic_fetch_and(&dirty_blocks[image_block / DIRTY_WORD_BITS], ~mask, __ATOMIC_ACQ_REL) & mask) == 0) {
+        return 0;
+    }
+    __atomic_fetch_sub(&num_dirty_blocks, 1, __ATOMIC_RELAXED);
+    return 1;
+}
+
+void clear_dirty_set(dirty_set_t* set) {
+    memset(set->words, 0x00, (size_t)set->num_words * sizeof(uint64_t));
+}
+
+uint32_t dirty_block_count() {
+    return __atomic_load_n(&num_dirty_blocks, __ATOMIC_RELAXED);
+}
+
+void free_dirty_set(dirty_set_t* set) {
+    free(set->words);
+    set->words = NULL;
+    set->num_words = 0;
+}
+
+int init_dirty_blocks() {
+    uint32_t num_words;
+
+    num_words = (geometry.total_blocks + DIRTY_WORD_BITS - 1) / DIRTY_WORD_BITS;
+    free(dirty_blocks);
+    if ((dirty_blocks = calloc(num_words, sizeof(uint64_t))) == NULL) {
+        num_dirty_words = 0;
+        return -ENOMEM;
+    }
+    num_dirty_words = num_words;
+    num_dirty_blocks = 0;
+    return 0;
+}
+
+int init_dirty_set(dirty_set_t* set) {
+    set->num_words = (geometry.total_blocks + DIRTY_WORD_BITS - 1) / DIRTY_WORD_BITS;
+    if ((set->words = calloc(set->num_words, sizeof(uint64_t))) == NULL) {
+        set->num_words = 0;
+        return -ENOMEM;
+    }
+    return 0;
+}
+
+static int is_in_set(const dirty_set_t* set, uint32_t image_block) {
+    return (set->words[image_block / DIRTY_WORD_BITS] >> (image_block % DIRTY_WORD_BITS)) & 1;
+}
+
+void mark_block_dirty(uint32_t image_block) {
+    uint64_t mask;
+
+    if (image_block >= geometry.total_blocks) {
+        // Not part of the image.
+        return;
+    }
+    mask = (uint64_t)1 << (image_block % DIRTY_WORD_BITS);
+    if ((__atomic_fetch_or(&dirty_blocks[image_block / DIRTY_WORD_BITS], mask, __ATOMIC_RELEASE) & mask) == 0) {
+        __atomic_fetch_add(&num_dirty_blocks, 1, __ATOMIC_RELAXED);
+    }
+}
+
+void mark_data_dirty(uint32_t data_block) {
+    if (data_block >= geometry.user_data_num_blocks) {
+        // No backing block in the user data region.
+        return;
+    }
+    mark_block_dirty(geometry.user_data_begin + data_block);
+}
+
+void mark_directory_dirty(const memefs_file_entry_t* file_entry) {
+    int64_t entry_index;
+
+    entry_index = file_entry - directory;
+    if (entry_index < 0 || entry_index >= (int64_t)geometry.max_file_entries) {
+        // Entry does not live in the directory.
+        return;
+    }
+    mark_block_dirty(geometry.directory_begin + (uint32_t)(((uint64_t)entry_index * FILE_ENTRY_SIZE) / geometry.block_size));
+}
+
+void mark_fat_dirty(uint32_t fat_index) {
+    uint32_t fat_block;
+
+    fat_block = (uint32_t)(((uint64_t)fat_index * geometry.fat_entry_size) / geometry.block_size);
+    mark_block_dirty(geometry.fat_main_begin + fat_block);
+    mark_block_dirty(geometry.fat_backup_begin + fat_block);
+}
+
+void mark_superblock_dirty() {
+    mark_block_dirty(geometry.superblock_main);
+    mark_block_dirty(geometry.superblock_backup);
+}
+
+int next_dirty_run(const dirty_set_t* set, uint32_t from_block, uint32_t* run_start, uint32_t* run_length) {
+    uint32_t i, total_blocks;
+
+    // Skip whole clean words before scanning bit by bit.
+    total_blocks = geometry.total_blocks;
+    for (i = from_block; i < total_blocks; i++) {
+        if ((i % DIRTY_WORD_BITS == 0) && (set->words[i / DIRTY_WORD_BITS] == 0)) {
+            i += DIRTY_WORD_BITS - 1;
+            continue;
+        }
+        if (is_in_set(set, i)) {
+            break;
+        }
+    }
+
+    if (i >= total_blocks) {
+        // No dirty blocks left.
+        return 0;
+    }
+
+    *run_start = i;
+    while ((i < total_blocks) && is_in_set(set, i)) {
+        i++;
+    }
+    *run_length = i - *run_start;
+    return 1;
+}
+
+void remove_from_dirty_set(dirty_set_t* set, uint32_t image_block) {
+    if (image_block < geometry.total_blocks) {
+        set->words[image_block / DIRTY_WORD_BITS] &= ~((uint64_t)1 << (image_block % DIRTY_WORD_BITS));
+    }
+}
+
+void return_dirty_blocks(const dirty_set_t* set) {
+    uint64_t was_dirty;
+    uint32_t i;
+
+    for (i = 0; i < set->num_words; i++) {
+        if (set->words[i] != 0) {
+            was_dirty = __atomic_fetch_or(&dirty_blocks[i], set->words[i], __ATOMIC_RELEASE);
+            __atomic_fetch_add(&num_dirty_blocks, (uint32_t)__builtin_popcountll(set->words[i] & ~was_dirty), __ATOMIC_RELAXED);
+        }
+    }
+}
+
+void take_dirty_blocks(dirty_set_t* set) {
+    uint32_t i;
+
+    // Clear before the caller reads memory, so a concurrent change re-marks its block.
+    for (i = 0; i < set->num_words; i++) {
+        set->words[i] = (__atomic_load_n(&dirty_blocks[i], __ATOMIC_RELAXED) == 0) ? 0 : __atomic_exchange_n(&dirty_blocks[i], 0, __ATOMIC_ACQ_REL);
+        __atomic_fetch_sub(&num_dirty_blocks, (uint32_t)__builtin_popcountll(set->words[i]), __ATOMIC_RELAXED);
+    }
+}
+
+void take_dirty_subset(dirty_set_t* set) {
+    uint64_t was_dirty;
+    uint32_t i;
+
+    for (i = 0; i < set->num_words; i++) {
+        if (set->words[i] != 0) {
+            was_dirty = __atomic_fetch_and(&dirty_blocks[i], ~set->words[i], __ATOMIC_ACQ_REL);
+            set->words[i] &= was_dirty;
+            __atomic_fetch_sub(&num_dirty_blocks, (uint32_t)__builtin_popcountll(set->words[i]), __ATOMIC_RELAXED);
+        }
+    }
+}
+
+#pragma endregion Implementations
\ No newline at end of file
@@ -0,0 +1,303 @@
+// File:    events.c
+// Author:  Eric Ekey
+// Date:    10/16/2026
+// Desc:    Per-thread rings of timed op and phase events, written out as a Chrome trace on SIGUSR1.
+
+#include "events.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "define.h"
+#include "timing.h"
+
+#define EVENT_RING_EVENTS 16384 // Events kept per thread, the oldest are overwritten.
+
+// One timed op or phase.
+typedef struct memefs_event {
+    uint64_t started;  // Monotonic time, in nanoseconds
+    uint64_t duration; // Nanoseconds
+    const char* name;  // String literal
+    uint32_t tid;      // Thread that recorded it
+    uint8_t is_op;     // Op, else a phase inside one
+} memefs_event_t;
+
+// Events of one thread. Only the owner writes, so recording takes no lock.
+typedef struct event_ring {
+    memefs_event_t events[EVENT_RING_EVENTS];
+    uint64_t head;           // Events ever recorded, event i is at i % EVENT_RING_EVENTS
+    int owned;               // A live thread records into it
+    struct event_ring* next;
+} event_ring_t;
+
+static const char* phase_names[NUM_EVENT_PHASES] = {
+    "allocate", "copy", "journal", "lookup", "sync", "writeback"
+};
+
+static int recording;          // Read without a lock by every event.
+static int event_fd = -1;      // Opened up front, the daemon changes directory before any dump.
+static event_ring_t* rings;    // Every ring made, pushed without a lock and kept until exit.
+static pthread_key_t ring_key; // Hands a ring back when its thread exits.
+static __thread event_ring_t* own_ring;
+static __thread uint32_t own_tid;
+
+static sem_t dump_requested;   // Posted from the signal handler.
+static pthread_t dump_thread;
+static int dump_running;
+static int dump_stopping;
+static struct sigaction old_action;
+
+#pragma region Prototypes
+
+// static void append_event(const char*, int, uint64_t, uint64_t)
+// Description: Adds an event to the calling thread's ring, claiming one first if the thread has none.
+// Preconditions: Recording.
+// Postconditions: Event is in the ring, unless no ring could be made.
+// Returns: None.
+static void append_event(const char* name, int is_op, uint64_t started, uint64_t duration);
+
+// static event_ring_t* claim_ring()
+// Description: Takes a ring a finished thread handed back, or makes a new one.
+// Preconditions: Calling thread has no ring.
+// Postconditions: Calling thread owns the ring until it exits.
+// Returns: Ring, or NULL if out of memory.
+static event_ring_t* claim_ring();
+
+// static int dump_events()
+// Description: Writes every ring's events to the event file as Chrome trace JSON, replacing what it held.
+// Preconditions: Event file is open.
+// Postconditions: File holds the events recorded so far, at most EVENT_RING_EVENTS per ring.
+// Returns: 0 on success, -1 on failure.
+static int dump_events();
+
+// static void* dump_main(void*)
+// Description: Writes the events out each time SIGUSR1 arrives.
+// Preconditions: None.
+// Postconditions: Returns once stop_events is called.
+// Returns: NULL.
+static void* dump_main(void* arg);
+
+// static void release_ring(void*)
+// Description: Hands a ring back when its thread exits, keeping its events for the next owner to overwrite.
+// Preconditions: ring is owned by the exiting thread.
+// Postconditions: Ring can be claimed.
+// Returns: None.
+static void release_ring(void* ring);
+
+// static void request_dump(int)
+// Description: SIGUSR1 handler, waking the dump thread.
+// Preconditions: None.
+// Postconditions: Dump is queued.
+// Returns: None.
+static void request_dump(int signal_number);
+
+#pragma endregion Prototypes
+
+#pragma region Implementations
+
+static void append_event(const char* name, int is_op, uint64_t started, uint64_t duration) {
+    memefs_event_t* event;
+    event_ring_t* ring;
+    uint64_t head;
+
+    if (((ring = own_ring) == NULL) && ((ring = claim_ring()) == NULL)) {
+        return;
+    }
+
+    head = ring->head;
+    event = &ring->events[head % EVENT_RING_EVENTS];
+    event->started = started;
+    event->duration = duration;
+    event->name = name;
+    event->tid = own_tid;
+    event->is_op = (uint8_t)is_op;
+    // Publishes the event to a dump running at the same time.
+    __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+}
+
+static event_ring_t* claim_ring() {
+    event_ring_t* ring;
+    int expected;
+
+    for (ring = __atomic_load_n(&rings, __ATOMIC_ACQUIRE); ring != NULL; ring = ring->next) {
+        expected = 0;
+        if (__atomic_compare_exchange_n(&ring->owned, &expected, 1, 0, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+            break;
+        }
+    }
+    if (ring == NULL) {
+        if ((ring = calloc(1, sizeof(event_ring_t))) == NULL) {
+            return NULL;
+        }
+        ring->owned = 1;
+        ring->next = __atomic_load_n(&rings, __ATOMIC_RELAXED);
+        while (!__atomic_compare_exchange_n(&rings, &ring->next, ring, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+        }
+    }
+
+    own_tid = (uint32_t)syscall(SYS_gettid);
+    own_ring = ring;
+    pthread_setspecific(ring_key, ring);
+    return ring;
+}
+
+static int dump_events() {
+    memefs_event_t* copy;
+    memefs_event_t* event;
+    event_ring_t* ring;
+    uint64_t head, first, valid, i;
+    FILE* file;
+    int fd, listed;
+
+    if ((copy = malloc(EVENT_RING_EVENTS * sizeof(memefs_event_t))) == NULL) {
+        return -1;
+    }
+    if ((ftruncate(event_fd, 0) != 0) || ((fd = dup(event_fd)) < 0)) {
+        free(copy);
+        return -1;
+    }
+    if ((file = fdopen(fd, "w")) == NULL) {
+        close(fd);
+        free(copy);
+        return -1;
+    }
+    rewind(file);
+
+    fprintf(file, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+    listed = 0;
+    for (ring = __atomic_load_n(&rings, __ATOMIC_ACQUIRE); ring != NULL; ring = ring->next) {
+        // Copy first, then drop whatever the owner may have overwritten while we copied.
+        head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        first = (head > EVENT_RING_EVENTS) ? head - EVENT_RING_EVENTS : 0;
+        for (i = first; i < head; i++) {
+            copy[i % EVENT_RING_EVENTS] = ring->events[i % EVENT_RING_EVENTS];
+        }
+        valid = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        valid = (valid >= EVENT_RING_EVENTS) ? MAX(first, valid - EVENT_RING_EVENTS + 1) : first;
+
+        for (i = valid; i < head; i++) {
+            event = &copy[i % EVENT_RING_EVENTS];
+            fprintf(file, "%s{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%llu.%03llu,\"dur\":%llu.%03llu,\"pid\":%d,\"tid\":%u}",
+                    (listed > 0) ? ",\n" : "", event->name, event->is_op ? "op" : "phase",
+                    (unsigned long long)(event->started / 1000), (unsigned long long)(event->started % 1000),
+                    (unsigned long long)(event->duration / 1000), (unsigned long long)(event->duration % 1000),
+                    (int)getpid(), event->tid);
+            listed++;
+        }
+    }
+    fprintf(file, "\n]}\n");
+    free(copy);
+    return (fclose(file) == 0) ? 0 : -1;
+}
+
+static void* dump_main(void* arg) {
+    (void) arg;
+
+    for (;;) {
+        if ((sem_wait(&dump_requested) != 0) && (errno == EINTR)) {
+            continue;
+        }
+        if (__atomic_load_n(&dump_stopping, __ATOMIC_ACQUIRE)) {
+            break;
+        }
+        if (dump_events() != 0) {
+            fprintf(stderr, "Failed to dump events\n");
+        }
+    }
+    return NULL;
+}
+
+uint64_t event_begin() {
+    return __atomic_load_n(&recording, __ATOMIC_RELAXED) ? monotonic_ns() : 0;
+}
+
+void event_end(event_phase_t phase, uint64_t started) {
+    if (started == 0) {
+        return;
+    }
+    append_event(phase_names[phase], 0, started, monotonic_ns() - started);
+}
+
+void record_op_event(const char* name, uint64_t started, uint64_t latency) {
+    if (!__atomic_load_n(&recording, __ATOMIC_RELAXED)) {
+        return;
+    }
+    append_event(name, 1, started, latency);
+}
+
+static void release_ring(void* ring) {
+    __atomic_store_n(&((event_ring_t*)ring)->owned, 0, __ATOMIC_RELEASE);
+}
+
+static void request_dump(int signal_number) {
+    (void) signal_number;
+
+    // Only async signal safe calls here, the dump thread does the rest.
+    sem_post(&dump_requested);
+}
+
+int set_event_file(const char* path) {
+    if ((event_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0) {
+        perror("Failed to open event file");
+        return -1;
+    }
+    if (pthread_key_create(&ring_key, release_ring) != 0) {
+        close(event_fd);
+        event_fd = -1;
+        return -1;
+    }
+    __atomic_store_n(&recording, 1, __ATOMIC_RELAXED);
+    return 0;
+}
+
+int start_events() {
+    struct sigaction action;
+    int result;
+
+    if (event_fd < 0) {
+        // Not recording.
+        return 0;
+    }
+
+    sem_init(&dump_requested, 0, 0);
+    dump_stopping = 0;
+    if ((result = pthread_create(&dump_thread, NULL, dump_main, NULL)) != 0) {
+        fprintf(stderr, "Failed to start event dump thread: %s\n", strerror(result));
+        sem_destroy(&dump_requested);
+        return -1;
+    }
+    dump_running = 1;
+
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = request_dump;
+    sigemptyset(&action.sa_mask);
+    action.sa_flags = SA_RESTART;
+    sigaction(SIGUSR1, &action, &old_action);
+    return 0;
+}
+
+void stop_events() {
+    __atomic_store_n(&recording, 0, __ATOMIC_RELAXED);
+    if (!dump_running) {
+        return;
+    }
+
+    sigaction(SIGUSR1, &old_action, NULL);
+    __atomic_store_n(&dump_stopping, 1, __ATOMIC_RELEASE);
+    sem_post(&dump_requested);
+    pthread_join(dump_thread, NULL);
+    sem_destroy(&dump_requested);
+    dump_running = 0;
+    close(event_fd);
+    event_fd = -1;
+}
+
+#pragma endregion Implementations
@@ -0,0 +1,704 @@
+// File:    file_ops.c
+// Author:  Eric Ekey
+// Date:    10/16/2026
+// Desc:    memefs ops on directory entries, shared by the path and inode frontends.
+
+#include "file_ops.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "allocator.h"
+#include "block_cache.h"
+#include "block_map.h"
+#include "defrag.h"
+#include "dir_index.h"
+#include "dirty.h"
+#include "events.h"
+#include "geometry.h"
+#include "loaders.h"
+#include "locks.h"
+#include "memefs_file_entry.h"
+#include "memefs_superblock.h"
+#include "utils.h"
+#include "writeback.h"
+
+#define FIRST_FILE_INODE 2 // Inode number of directory entry 0, the root takes 1.
+
+extern memefs_geometry_t geometry;
+extern memefs_superblock_t main_superblock;
+extern memefs_superblock_t backup_superblock;
+extern memefs_file_entry_t* directory;
+
+// A file the kernel must forget about, captured while its entry was locked.
+typedef struct changed_file {
+    uint64_t inode;
+    char readable_name[MAX_READABLE_FILENAME_LENGTH];
+} changed_file_t;
+
+// Files changed together, handed to the notifier thread.
+typedef struct change_batch {
+    change_notifier_t notifier; // Notifier set when the change was made.
+    int changes;
+    int num_files;
+    changed_file_t files[];
+} change_batch_t;
+
+static change_notifier_t change_notifier = NULL;
+static pthread_mutex_t notify_lock = PTHREAD_MUTEX_INITIALIZER; // Guards notifications_pending.
+static pthread_cond_t notify_done = PTHREAD_COND_INITIALIZER;
+static int notifications_pending = 0;
+
+#pragma region Prototypes
+
+// static void add_change(change_batch_t*, int)
+// Description: Records a file in a batch of changes.
+// Preconditions: Namespace lock is held. Entry is in use. batch has room, or is NULL.
+// Postconditions: File is in the batch, unless batch is NULL.
+// Returns: None.
+static void add_change(change_batch_t* batch, int entry_index);
+
+// static int copy_from_blocks(int, char*, size_t, off_t, uint32_t)
+// Description: Copies a byte range of a file out of its blocks, reading ahead blocks past it on a miss.
+// Preconditions: Entry is locked. Range lies within the file.
+// Postconditions: buf holds the bytes copied.
+// Returns: Number of bytes copied on success, < 0 on failure.
+static int copy_from_blocks(int entry_index, char* buf, size_t size, off_t offset, uint32_t ahead);
+
+// static void fill_stat(int, struct stat*)
+// Description: Fills in a file's attributes from its directory entry.
+// Preconditions: Entry is locked, or the namespace lock is held for writing.
+// Postconditions: stbuf describes the file.
+// Returns: None.
+static void fill_stat(int entry_index, struct stat* stbuf);
+
+// static change_batch_t* new_change_batch(int, int)
+// Description: Allocates a batch of changed files to notify the frontend of.
+// Preconditions: None.
+// Postconditions: None.
+// Returns: Empty batch, or NULL if no notifier is set or allocation failed.
+static change_batch_t* new_change_batch(int max_files, int changes);
+
+// static void* notify_changes(void*)
+// Description: Thread body passing a batch of changed files to the notifier.
+// Preconditions: batch came from send_changes().
+// Postconditions: batch is freed and no longer pending.
+// Returns: NULL.
+static void* notify_changes(void* batch);
+
+// static void send_changes(change_batch_t*)
+// Description: Notifies the frontend of a batch of changed files from a separate thread, since the kernel may
+//              wait on requests this thread would otherwise have to serve first.
+// Preconditions: No memefs lock is held.
+// Postconditions: batch is owned by the notifier thread.
+// Returns: None.
+static void send_changes(change_batch_t* batch);
+
+// static uint32_t track_read(open_file_t*, off_t, size_t)
+// Description: Feeds a read to its handle's sequential access detector.
+// Preconditions: handle may be NULL.
+// Postconditions: handle expects the next read where this one ends.
+// Returns: Blocks to read ahead of this read.
+static uint32_t track_read(open_file_t* handle, off_t offset, size_t size);
+
+#pragma endregion Prototypes
+
+#pragma region Implementations
+
+static void add_change(change_batch_t* batch, int entry_index) {
+    if (batch == NULL) {
+        return;
+    }
+    batch->files[batch->num_files].inode = entry_inode(entry_index);
+    strcpy(batch->files[batch->num_files].readable_name, dir_index_name(entry_index));
+    batch->num_files++;
+}
+
+static int copy_from_blocks(int entry_index, char* buf, size_t size, off_t offset, uint32_t ahead) {
+    int bytes_read;
+    uint32_t num_blocks, block_index, block_offset;
+    const uint32_t* blocks;
+    uint8_t* block_data;
+    size_t bytes_to_read;
+    off_t buffer_offset;
+
+    if ((blocks = get_block_map(entry_index, &num_blocks)) == NULL) {
+        return -EIO;
+    }
+
+    block_index = (uint32_t)(offset / geometry.block_size);
+    block_offset = (uint32_t)(offset % geometry.block_size);
+    prefetch_blocks(blocks, num_blocks, block_index, (uint32_t)(((uint64_t)block_offset + size + geometry.block_size - 1) / geometry.block_size), ahead);
+    bytes_read = 0;
+    buffer_offset = 0;
+
+    // Copy data from the blocks covering [offset, offset + size) into buffer.
+    while ((size > 0) && (block_index < num_blocks)) {
+        bytes_to_read = MIN((size_t)(geometry.block_size - block_offset), size);
+        if (pin_block(blocks[block_index], PIN_READ, &block_data) != 0) {
+            return (bytes_read > 0) ? bytes_read : -EIO;
+        }
+        memcpy(buf + buffer_offset, block_data + block_offset, bytes_to_read);
+        unpin_block(blocks[block_index]);
+        buffer_offset += bytes_to_read;
+        size -= bytes_to_read;
+        bytes_read += bytes_to_read;
+        block_index++;
+        block_offset = 0;
+    }
+    return bytes_read;
+}
+
+int create_entry(const char* readable_name, struct stat* stbuf) {
+    char encoded_filename[MAX_ENCODED_FILENAME_LENGTH];
+    int i, name_legal;
+    uint32_t start_block;
+
+    if ((name_legal = check_legal_name(readable_name)) != 0) {
+        // File name is not legal.
+        return name_legal;
+    }
+
+    lock_namespace_write();
+    if (lookup_file_entry(readable_name) >= 0) {
+        // File already exists.
+        unlock_namespace();
+        return -EEXIST;
+    }
+
+    for (i = 0; i < (int)geometry.max_file_entries; i++) {
+        if (directory[i].type_permissions == 0x0000) {
+            // Found free file entry in directory.
+            break;
+        }
+    }
+
+    begin_update();
+    if ((i == (int)geometry.max_file_entries) || (allocate_blocks(1, NO_BLOCK_HINT, &start_block) != 0)) {
+        // Directory or disk is full.
+        end_update();
+        unlock_namespace();
+        return -ENOSPC;
+    }
+
+    name_to_encoded(readable_name, encoded_filename);
+    memcpy(directory[i].filename, encoded_filename, 11);
+    directory[i].type_permissions = (uint16_t)(S_IFREG | 0644);
+    directory[i].start_block_high = 0x00;
+    set_start_block(&directory[i], start_block);
+    generate_memefs_timestamp(directory[i].bcd_timestamp);
+    directory[i].uid_owner = (uint16_t)getuid();
+    directory[i].gid_owner = (uint16_t)getgid();
+    directory[i].size = (uint32_t)0;
+    set_fat_entry(start_block, FAT_END_OF_CHAIN);
+    mark_directory_dirty(&directory[i]);
+    invalidate_block_map(i);
+    dir_index_insert(i);
+    end_update();
+    if (stbuf != NULL) {
+        fill_stat(i, stbuf);
+    }
+    unlock_namespace();
+
+    if (commit_update() != 0) {
+        fprintf(stderr, "Failed to update image after create()\n");
+        return -EIO;
+    }
+    return i;
+}
+
+int defragment_entry(int entry_index) {
+    change_batch_t* batch;
+    int result;
+
+    // The bytes stay the same, but the kernel's copy must not outlive the blocks it was read from.
+    batch = new_change_batch(1, CHANGED_DATA);
+    lock_file_write(entry_index);
+    begin_update();
+    result = defragment_file(entry_index);
+    end_update();
+    add_change(batch, entry_index);
+    unlock_file(entry_index);
+    unlock_namespace();
+
+    if (result < 0) {
+        free(batch);
+        return result;
+    }
+    send_changes(batch);
+    if (commit_update() != 0) {
+        fprintf(stderr, "Failed to unload image after ioctl()\n");
+        return -EIO;
+    }
+    return 0;
+}
+
+int defragment_every_entry() {
+    const char* readable_name;
+    change_batch_t* batch;
+    int i, result;
+
+    batch = new_change_batch((int)geometry.max_file_entries, CHANGED_DATA);
+
+    // Moves every file, so nothing else may run.
+    lock_namespace_write();
+    begin_update();
+    result = defragment_all(NULL);
+    end_update();
+    for (i = next_listed_entry(0, &readable_name, NULL); i >= 0; i = next_listed_entry(i + 1, &readable_name, NULL)) {
+        add_change(batch, i);
+    }
+    unlock_namespace();
+
+    if (result < 0) {
+        free(batch);
+        return result;
+    }
+    send_changes(batch);
+    if (commit_update() != 0) {
+        fprintf(stderr, "Failed to unload image after ioctl()\n");
+        return -EIO;
+    }
+    return 0;
+}
+
+uint64_t entry_inode(int entry_index) {
+    return ((uint64_t)dir_index_generation(entry_index) << 32) | (uint64_t)(entry_index + FIRST_FILE_INODE);
+}
+
+static void fill_stat(int entry_index, struct stat* stbuf) {
+    *stbuf = *dir_index_attrs(entry_index);
+    stbuf->st_ino = (ino_t)entry_inode(entry_index);
+}
+
+void free_open_file(open_file_t* handle) {
+    free(handle);
+}
+
+int inode_entry(uint64_t inode) {
+    uint64_t slot;
+
+    slot = (inode & 0xFFFFFFFF) - FIRST_FILE_INODE;
+    if ((inode & 0xFFFFFFFF) < FIRST_FILE_INODE || slot >= geometry.max_file_entries
+        || dir_index_name((int)slot) == NULL || entry_inode((int)slot) != inode) {
+        // Never handed out, or the file was deleted since.
+        return -ENOENT;
+    }
+    return (int)slot;
+}
+
+int lock_named_entry(const char* readable_name) {
+    int i;
+
+    lock_namespace_read();
+    if ((i = lookup_file_entry(readable_name)) < 0) {
+        unlock_namespace();
+    }
+    return i;
+}
+
+int lock_open_file(const open_file_t* handle) {
+    int i;
+
+    lock_namespace_read();
+    if ((i = inode_entry(handle->inode)) < 0) {
+        unlock_namespace();
+    }
+    return i;
+}
+
+static change_batch_t* new_change_batch(int max_files, int changes) {
+    change_batch_t* batch;
+
+    if (change_notifier == NULL) {
+        // Frontend doesn't let the kernel cache anything.
+        return NULL;
+    }
+    if ((batch = malloc(sizeof(change_batch_t) + (size_t)max_files * sizeof(changed_file_t))) == NULL) {
+        fprintf(stderr, "Out of memory, kernel caches may be stale until they time out\n");
+        return NULL;
+    }
+    batch->notifier = change_notifier;
+    batch->changes = changes;
+    batch->num_files = 0;
+    return batch;
+}
+
+open_file_t* new_open_file(uint64_t inode) {
+    open_file_t* handle;
+
+    if ((handle = malloc(sizeof(open_file_t))) == NULL) {
+        return NULL;
+    }
+    handle->inode = inode;
+    handle->next_offset = 0;
+    handle->sequential_run = 0;
+    return handle;
+}
+
+int next_listed_entry(int from_entry, const char** readable_name, struct stat* stbuf) {
+    int i;
+
+    // Only entries with legal names are indexed, so the index is exactly what to list.
+    if ((i = dir_index_next(from_entry)) < 0) {
+        return -1;
+    }
+    *readable_name = dir_index_name(i);
+    if (stbuf != NULL) {
+        lock_file_read(i);
+        fill_stat(i, stbuf);
+        unlock_file(i);
+    }
+    return i;
+}
+
+static void* notify_changes(void* batch) {
+    change_batch_t* changed = (change_batch_t*)batch;
+    int i;
+
+    for (i = 0; i < changed->num_files; i++) {
+        changed->notifier(changed->files[i].inode, changed->files[i].readable_name, changed->changes);
+    }
+    free(changed);
+
+    pthread_mutex_lock(&notify_lock);
+    if (--notifications_pending == 0) {
+        pthread_cond_broadcast(&notify_done);
+    }
+    pthread_mutex_unlock(&notify_lock);
+    return NULL;
+}
+
+int read_entry(int entry_index, open_file_t* handle, char* buf, size_t size, off_t offset) {
+    uint32_t file_size, ahead;
+    uint64_t started;
+    int bytes_read;
+
+    lock_file_read(entry_index);
+    file_size = directory[entry_index].size;
+    if ((uint64_t)offset >= file_size) {
+        // Reading at or beyond EOF.
+        unlock_file(entry_index);
+        unlock_namespace();
+        return 0;
+    }
+
+    // Adjust size if reading beyond EOF
+    size = (size_t)MIN(size, file_size - (uint64_t)offset);
+    ahead = track_read(handle, offset, size);
+    started = event_begin();
+    bytes_read = copy_from_blocks(entry_index, buf, size, offset, ahead);
+    event_end(PHASE_COPY, started);
+    unlock_file(entry_index);
+    unlock_namespace();
+    return bytes_read;
+}
+
+static void send_changes(change_batch_t* batch) {
+    pthread_attr_t attr;
+    pthread_t thread;
+    int result;
+
+    if ((batch == NULL) || (batch->num_files == 0)) {
+        free(batch);
+        return;
+    }
+
+    pthread_mutex_lock(&notify_lock);
+    notifications_pending++;
+    pthread_mutex_unlock(&notify_lock);
+
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    result = pthread_create(&thread, &attr, notify_changes, batch);
+    pthread_attr_destroy(&attr);
+    if (result != 0) {
+        // Fine with a multithreaded loop, which has another thread to serve whatever the kernel waits on.
+        notify_changes(batch);
+    }
+}
+
+int send_entry(int entry_index, open_file_t* handle, size_t size, off_t offset, data_sender_t send, void* context) {
+    struct fuse_bufvec single = FUSE_BUFVEC_INIT(0);
+    struct fuse_bufvec* bufv;
+    struct fuse_buf* segment;
+    const uint32_t* blocks;
+    uint32_t file_size, num_blocks, first_block, num_segments, block_offset, pinned, ahead, i;
+    size_t bytes_left, bytes;
+    uint64_t started;
+    uint8_t* block_data;
+    char* copy;
+    int result;
+
+    lock_file_read(entry_index);
+    file_size = directory[entry_index].size;
+    if (((uint64_t)offset >= file_size) || (size == 0)) {
+        // Reading at or beyond EOF.
+        send(context, &single);
+        unlock_file(entry_index);
+        unlock_namespace();
+        return 0;
+    }
+
+    size = (size_t)MIN(size, file_size - (uint64_t)offset);
+    first_block = (uint32_t)(offset / geometry.block_size);
+    block_offset = (uint32_t)(offset % geometry.block_size);
+    num_segments = (uint32_t)(((uint64_t)block_offset + size + geometry.block_size - 1) / geometry.block_size);
+    if (((blocks = get_block_map(entry_index, &num_blocks)) == NULL) || ((uint64_t)first_block + num_segments > num_blocks)) {
+        unlock_file(entry_index);
+        unlock_namespace();
+        return -EIO;
+    }
+    if ((bufv = malloc(sizeof(struct fuse_bufvec) + (num_segments - 1) * sizeof(struct fuse_buf))) == NULL) {
+        unlock_file(entry_index);
+        unlock_namespace();
+        return -ENOMEM;
+    }
+
+    // One segment per block, or per run of blocks that sit next to each other in the mapping.
+    ahead = track_read(handle, offset, size);
+    prefetch_blocks(blocks, num_blocks, first_block, num_segments, ahead);
+    bufv->count = 0;
+    bufv->idx = 0;
+    bufv->off = 0;
+    bytes_left = size;
+    result = 0;
+    for (pinned = 0; pinned < num_segments; pinned++) {
+        bytes = MIN((size_t)(geometry.block_size - block_offset), bytes_left);
+        if ((result = pin_block(blocks[first_block + pinned], PIN_READ_NOWAIT, &block_data)) != 0) {
+            break;
+        }
+        if ((bufv->count > 0) && ((uint8_t*)bufv->buf[bufv->count - 1].mem + bufv->buf[bufv->count - 1].size == block_data + block_offset)) {
+            bufv->buf[bufv->count - 1].size += bytes;
+        } else {
+            segment = &bufv->buf[bufv->count++];
+            memset(segment, 0, sizeof(struct fuse_buf));
+            segment->size = bytes;
+            segment->mem = block_data + block_offset;
+            segment->fd = -1;
+        }
+        bytes_left -= bytes;
+        block_offset = 0;
+    }
+
+    if (result == 0) {
+        // The frontend copies the blocks out from here.
+        started = event_begin();
+        send(context, bufv);
+        event_end(PHASE_COPY, started);
+        result = (int)size;
+    }
+    for (i = 0; i < pinned; i++) {
+        unpin_block(blocks[first_block + i]);
+    }
+    free(bufv);
+
+    if (result == -EAGAIN) {
+        // Other readers hold the rest of the cache, so copy one block at a time instead.
+        if ((copy = malloc(size)) == NULL) {
+            result = -ENOMEM;
+        } else if ((result = copy_from_blocks(entry_index, copy, size, offset, 0)) >= 0) {
+            single = FUSE_BUFVEC_INIT((size_t)result);
+            single.buf[0].mem = copy;
+            send(context, &single);
+        }
+        free(copy);
+    }
+    unlock_file(entry_index);
+    unlock_namespace();
+    return result;
+}
+
+void set_change_notifier(change_notifier_t notifier) {
+    change_notifier = notifier;
+}
+
+void start_filesystem() {
+    // Started once FUSE runs rather than at load, so the thread survives daemonizing.
+    if (start_flusher() != 0) {
+        fprintf(stderr, "Writing back on every update instead\n");
+        set_durability("sync");
+    }
+    if (start_events() != 0) {
+        fprintf(stderr, "Events can't be dumped on SIGUSR1\n");
+    }
+}
+
+int stat_entry(int entry_index, struct stat* stbuf) {
+    lock_file_read(entry_index);
+    fill_stat(entry_index, stbuf);
+    unlock_file(entry_index);
+    unlock_namespace();
+    return 0;
+}
+
+void stat_filesystem(struct statvfs* stbuf) {
+    uint32_t i, free_entries;
+
+    free_entries = 0;
+    lock_namespace_read();
+    for (i = 0; i < geometry.max_file_entries; i++) {
+        if (directory[i].type_permissions == 0x0000) {
+            free_entries++;
+        }
+    }
+    unlock_namespace();
+
+    memset(stbuf, 0, sizeof(struct statvfs));
+    stbuf->f_bsize = geometry.block_size;
+    stbuf->f_frsize = geometry.block_size;
+    stbuf->f_blocks = geometry.user_data_num_blocks;
+    stbuf->f_bfree = free_block_count();
+    stbuf->f_bavail = stbuf->f_bfree;
+    stbuf->f_files = geometry.max_file_entries;
+    stbuf->f_ffree = free_entries;
+    stbuf->f_favail = free_entries;
+    // Without the terminator.
+    stbuf->f_namemax = MAX_READABLE_FILENAME_LENGTH - 1;
+}
+
+void stat_root(struct stat* stbuf) {
+    memset(stbuf, 0, sizeof(struct stat));
+    stbuf->st_ino = (ino_t)ROOT_INODE;
+    stbuf->st_mode = (mode_t)(S_IFDIR | 0755);
+    stbuf->st_nlink = (nlink_t)2;
+}
+
+int stop_filesystem() {
+    int result;
+
+    // Notifications need the session, which goes away after this returns.
+    pthread_mutex_lock(&notify_lock);
+    while (notifications_pending > 0) {
+        pthread_cond_wait(&notify_done, &notify_lock);
+    }
+    pthread_mutex_unlock(&notify_lock);
+
+    stop_events();
+    stop_flusher();
+    lock_namespace_write();
+    main_superblock.cleanly_unmounted = 0x00;
+    backup_superblock.cleanly_unmounted = 0x00;
+    mark_superblock_dirty();
+    unlock_namespace();
+    result = 0;
+    if ((unload_image() != 0) || (sync_image(0) != 0)) {
+        fprintf(stderr, "Failed to update image after destroy()\n");
+        result = -1;
+    }
+
+    // Unmap and close the image
+    close_image();
+    return result;
+}
+
+int sync_entry(int entry_index, int datasync) {
+    int result;
+
+    lock_file_read(entry_index);
+    result = flush_file(entry_index, datasync);
+    unlock_file(entry_index);
+    unlock_namespace();
+
+    return (result != 0) ? -EIO : 0;
+}
+
+static uint32_t track_read(open_file_t* handle, off_t offset, size_t size) {
+    uint32_t run;
+
+    if (handle == NULL) {
+        return readahead_window(0);
+    }
+
+    // Readers sharing a descriptor race here, which at worst misjudges one read's pattern.
+    if (__atomic_exchange_n(&handle->next_offset, (uint64_t)offset + size, __ATOMIC_RELAXED) == (uint64_t)offset) {
+        run = __atomic_add_fetch(&handle->sequential_run, 1, __ATOMIC_RELAXED);
+    } else {
+        run = 0;
+        __atomic_store_n(&handle->sequential_run, 0, __ATOMIC_RELAXED);
+    }
+    return readahead_window(run);
+}
+
+int truncate_entry(int entry_index, off_t new_size) {
+    int result;
+
+    lock_file_write(entry_index);
+    begin_update();
+    if ((result = truncate_file(&directory[entry_index], new_size)) == 0) {
+        // Update file timestamp.
+        dir_index_touch(entry_index, generate_memefs_timestamp(directory[entry_index].bcd_timestamp));
+        mark_directory_dirty(&directory[entry_index]);
+    }
+    end_update();
+    unlock_file(entry_index);
+    unlock_namespace();
+
+    if (result != 0) {
+        return result;
+    }
+    if (commit_update() != 0) {
+        fprintf(stderr, "Failed to unload image after truncate()\n");
+        return -EIO;
+    }
+    return 0;
+}
+
+int unlink_entry(const char* readable_name) {
+    int i;
+
+    // Find file in directory.
+    lock_namespace_write();
+    if ((i = lookup_file_entry(readable_name)) < 0) {
+        // File not found.
+        unlock_namespace();
+        return i;
+    }
+
+    // Unlink file from FAT.
+    begin_update();
+    free_chain(get_start_block(&directory[i]));
+    directory[i].type_permissions = 0x0000;
+    mark_directory_dirty(&directory[i]);
+    invalidate_block_map(i);
+    dir_index_remove(i);
+    end_update();
+    unlock_namespace();
+
+    if (commit_update() != 0) {
+        fprintf(stderr, "Failed to unload image after unlink()\n");
+        return -EIO;
+    }
+    return 0;
+}
+
+int write_entry(int entry_index, struct fuse_bufvec* src, off_t offset) {
+    size_t size;
+    int result;
+
+    size = fuse_buf_size(src);
+    lock_file_write(entry_index);
+    begin_update();
+    if ((result = write_file_buf(&directory[entry_index], src, offset)) == 0) {
+        dir_index_touch(entry_index, generate_memefs_timestamp(directory[entry_index].bcd_timestamp));
+        mark_directory_dirty(&directory[entry_index]);
+    }
+    end_update();
+    unlock_file(entry_index);
+    unlock_namespace();
+
+    if (result != 0) {
+        return result;
+    }
+    if (commit_update() != 0) {
+        fprintf(stderr, "Failed to unload image after write()\n");
+        return -EIO;
+    }
+    return (int)size;
+}
+
+#pragma endregion Implementations
@@ -0,0 +1,152 @@
+// File:    geometry.c
+// Author:  Eric Ekey
+// Date:    10/16/2026
+// Desc:    Image layout read from the superblock at mount.
+
+#include "geometry.h"
+
+#include <arpa/inet.h>
+#include <stdio.h>
+
+#include "define.h"
+
+#define NUM_REGIONS 7
+
+memefs_geometry_t geometry;
+
+#pragma region Prototypes
+
+// static int regions_overlap(const uint32_t[][2], int)
+// Description: Checks whether any two block ranges overlap.
+// Preconditions: Each range is {first block, number of blocks}.
+// Postconditions: None.
+// Returns: 1 if two ranges overlap, 0 otherwise.
+static int regions_overlap(const uint32_t regions[][2], int num_regions);
+
+#pragma endregion Prototypes
+
+#pragma region Implementations
+
+uint32_t get_start_block(const memefs_file_entry_t* file_entry) {
+    if (geometry.version == 1) {
+        return file_entry->start_block;
+    }
+    return ((uint32_t)file_entry->start_block_high << 16) | file_entry->start_block;
+}
+
+int read_geometry(const memefs_superblock_t* superblock, uint64_t image_size) {
+    memefs_geometry_t layout;
+    uint32_t regions[NUM_REGIONS][2];
+    uint32_t i;
+
+    layout.version = ntohl(superblock->fs_version);
+    if (layout.version == 1) {
+        // Fixed layout, the 16-bit superblock fields are informational.
+        layout.block_size = BLOCK_SIZE;
+        layout.total_blocks = IMAGE_NUM_BLOCKS;
+        layout.superblock_main = SUPERBLOCK_MAIN_BEGIN;
+        layout.superblock_backup = SUPERBLOCK_BACKUP_BEGIN;
+        layout.journal_begin = JOURNAL_BEGIN;
+        layout.journal_num_blocks = JOURNAL_NUM_BLOCKS;
+        layout.fat_main_begin = FAT_MAIN_BEGIN;
+        layout.fat_backup_begin = FAT_BACKUP_BEGIN;
+        layout.fat_num_blocks = 1;
+        layout.fat_entry_size = sizeof(uint16_t);
+        layout.fat_num_entries = MAX_FAT_ENTRIES;
+        layout.directory_begin = DIRECTORY_BEGIN;
+        layout.directory_num_blocks = DIRECTORY_NUM_BLOCKS;
+        layout.max_file_entries = MAX_FILE_ENTRIES;
+        layout.user_data_begin = USER_DATA_BEGIN;
+        layout.user_data_num_blocks = USER_DATA_NUM_BLOCKS;
+    } else if (layout.version == 2) {
+        layout.block_size = ntohl(superblock->block_size);
+        layout.total_blocks = ntohl(superblock->total_blocks);
+        layout.superblock_main = 0;
+        layout.superblock_backup = layout.total_blocks - 1;
+        layout.journal_begin = ntohl(superblock->journal_start);
+        layout.journal_num_blocks = ntohl(superblock->journal_size);
+        layout.fat_main_begin = ntohl(superblock->main_fat32);
+        layout.fat_backup_begin = ntohl(superblock->backup_fat32);
+        layout.fat_num_blocks = ntohl(superblock->fat_size32);
+        layout.fat_entry_size = superblock->fat_entry_size;
+        layout.directory_begin = ntohl(superblock->directory_start32);
+        layout.directory_num_blocks = ntohl(superblock->directory_size32);
+        layout.user_data_begin = ntohl(superblock->first_user_block32);
+        layout.user_data_num_blocks = ntohl(superblock->num_user_blocks32);
+
+        if ((layout.block_size < MIN_BLOCK_SIZE) || (layout.block_size > MAX_BLOCK_SIZE) || (layout.block_size & (layout.block_size - 1))) {
+            fprintf(stderr, "Unsupported block size %u\n", layout.block_size);
+            return -1;
+        }
+        if ((layout.fat_entry_size != sizeof(uint32_t)) || (layout.total_blocks < 2) || (layout.journal_num_blocks < 2)
+            || (layout.user_data_num_blocks == 0) || (layout.user_data_num_blocks > MAX_USER_BLOCKS_V2)) {
+            fprintf(stderr, "Invalid v2 superblock geometry\n");
+            return -1;
+        }
+        layout.fat_num_entries = layout.user_data_num_blocks;
+        if ((uint64_t)layout.fat_num_blocks * layout.block_size < (uint64_t)layout.fat_num_entries * layout.fat_entry_size) {
+            fprintf(stderr, "FAT is too small for %u user blocks\n", layout.user_data_num_blocks);
+            return -1;
+        }
+        layout.max_file_entries = (uint32_t)(((uint64_t)layout.directory_num_blocks * layout.block_size) / FILE_ENTRY_SIZE);
+        if ((layout.max_file_entries == 0) || (layout.max_file_entries > INT16_MAX)) {
+            // Directory index links are 16 bits.
+            fprintf(stderr, "Unsupported directory size of %u entries\n", layout.max_file_entries);
+            return -1;
+        }
+    } else {
+        fprintf(stderr, "Unsupported filesystem version %u\n", layout.version);
+        return -1;
+    }
+
+    if ((uint64_t)layout.total_blocks * layout.block_size > image_size) {
+        fprintf(stderr, "Filesystem image is smaller than %u blocks\n", layout.total_blocks);
+        return -1;
+    }
+
+    regions[0][0] = layout.superblock_main;     regions[0][1] = 1;
+    regions[1][0] = layout.superblock_backup;   regions[1][1] = 1;
+    regions[2][0] = layout.journal_begin;       regions[2][1] = layout.journal_num_blocks;
+    regions[3][0] = layout.fat_main_begin;      regions[3][1] = layout.fat_num_blocks;
+    regions[4][0] = layout.fat_backup_begin;    regions[4][1] = layout.fat_num_blocks;
+    regions[5][0] = layout.directory_begin;     regions[5][1] = layout.directory_num_blocks;
+    regions[6][0] = layout.user_data_begin;     regions[6][1] = layout.user_data_num_blocks;
+    for (i = 0; i < NUM_REGIONS; i++) {
+        if ((uint64_t)regions[i][0] + regions[i][1] > layout.total_blocks) {
+            fprintf(stderr, "Superblock describes a region past the end of the image\n");
+            return -1;
+        }
+    }
+    if (regions_overlap(regions, NUM_REGIONS)) {
+        fprintf(stderr, "Superblock describes overlapping regions\n");
+        return -1;
+    }
+
+    geometry = layout;
+    return 0;
+}
+
+static int regions_overlap(const uint32_t regions[][2], int num_regions) {
+    int i, j;
+
+    for (i = 0; i < num_regions; i++) {
+        for (j = i + 1; j < num_regions; j++) {
+            if (((uint64_t)regions[i][0] < (uint64_t)regions[j][0] + regions[j][1])
+                && ((uint64_t)regions[j][0] < (uint64_t)regions[i][0] + regions[i][1])) {
+                return 1;
+            }
+        }
+    }
+    return 0;
+}
+
+void set_start_block(memefs_file_entry_t* file_entry, uint32_t block) {
+    if (geometry.version == 1) {
+        file_entry->start_block = (uint16_t)block;
+        return;
+    }
+    file_entry->start_block = (uint16_t)(block & 0xFFFF);
+    file_entry->start_block_high = (uint8_t)((block >> 16) & 0xFF);
+}
+
+#pragma endregion Implementations
\ No newline at end of file
@@ -0,0 +1,276 @@
+// File:    journal.c
+// Author:  Eric Ekey
+// Date:    10/16/2026
+// Desc:    Metadata journal kept in the reserved blocks of the filesystem image.
+
+#include "journal.h"
+
+#include <arpa/inet.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "define.h"
+#include "events.h"
+#include "geometry.h"
+#include "memefs_journal.h"
+#include "stats.h"
+
+#define FNV_OFFSET_BASIS 2166136261u
+#define FNV_PRIME 16777619u
+#define JOURNAL_IOV_MAX 64 // Segments gathered per pwritev.
+
+extern memefs_geometry_t geometry;
+
+static uint32_t next_sequence; // Sequence number of the next transaction.
+
+#pragma region Prototypes
+
+// static uint32_t checksum_bytes(uint32_t, const void*, size_t)
+// Description: Continues an FNV-1a checksum over a buffer.
+// Preconditions: None.
+// Postconditions: None.
+// Returns: Updated checksum.
+static uint32_t checksum_bytes(uint32_t checksum, const void* data, size_t length);
+
+// static uint32_t checksum_transaction(const uint8_t*, const void* const*, uint32_t)
+// Description: Checksums a journal header block (with its checksum zeroed) and its logged blocks.
+// Preconditions: Header num_blocks has been validated.
+// Postconditions: None.
+// Returns: Transaction checksum.
+static uint32_t checksum_transaction(const uint8_t* header_block, const void* const* blocks, uint32_t num_blocks);
+
+// static uint32_t get_home_block(const uint8_t*, uint32_t)
+// Description: Reads the home block of a logged block from a header block.
+// Preconditions: Index is below the header's num_blocks.
+// Postconditions: None.
+// Returns: Image block number.
+static uint32_t get_home_block(const uint8_t* header_block, uint32_t index);
+
+// static void set_home_block(uint8_t*, uint32_t, uint32_t)
+// Description: Stores the home block of a logged block in a header block.
+// Preconditions: Index is below journal_capacity().
+// Postconditions: Header block records the home block.
+// Returns: None.
+static void set_home_block(uint8_t* header_block, uint32_t index, uint32_t home_block);
+
+#pragma endregion Prototypes
+
+#pragma region Implementations
+
+static uint32_t checksum_bytes(uint32_t checksum, const void* data, size_t length) {
+    const uint8_t* bytes;
+    size_t i;
+
+    bytes = (const uint8_t*)data;
+    for (i = 0; i < length; i++) {
+        checksum ^= bytes[i];
+        checksum *= FNV_PRIME;
+    }
+    return checksum;
+}
+
+static uint32_t checksum_transaction(const uint8_t* header_block, const void* const* blocks, uint32_t num_blocks) {
+    memefs_journal_header_t unsummed;
+    uint32_t checksum, i;
+
+    memcpy(&unsummed, header_block, sizeof(unsummed));
+    unsummed.checksum = 0;
+    checksum = checksum_bytes(FNV_OFFSET_BASIS, &unsummed, sizeof(unsummed));
+    checksum = checksum_bytes(checksum, header_block + sizeof(unsummed), geometry.block_size - sizeof(unsummed));
+    for (i = 0; i < num_blocks; i++) {
+        checksum = checksum_bytes(checksum, blocks[i], geometry.block_size);
+    }
+    return checksum;
+}
+
+static uint32_t get_home_block(const uint8_t* header_block, uint32_t index) {
+    uint16_t home16;
+    uint32_t home32;
+
+    if (geometry.fat_entry_size == sizeof(uint16_t)) {
+        memcpy(&home16, header_block + sizeof(memefs_journal_header_t) + (index * sizeof(uint16_t)), sizeof(home16));
+        return ntohs(home16);
+    }
+    memcpy(&home32, header_block + sizeof(memefs_journal_header_t) + (index * sizeof(uint32_t)), sizeof(home32));
+    return ntohl(home32);
+}
+
+uint32_t journal_capacity() {
+    uint32_t capacity;
+
+    // Bounded by the blocks after the header, the home blocks the header can name and the 16-bit count.
+    capacity = (uint32_t)((geometry.block_size - sizeof(memefs_journal_header_t)) / geometry.fat_entry_size);
+    capacity = MIN(capacity, geometry.journal_num_blocks - 1);
+    return MIN(capacity, (uint32_t)UINT16_MAX);
+}
+
+int load_journal(int fd, int replay) {
+    const memefs_journal_header_t* header;
+    const void** sources;
+    uint8_t* header_block;
+    uint8_t* logged;
+    size_t block_size;
+    uint32_t i, num_blocks, home_block, fat_block;
+    int result;
+
+    next_sequence = 0;
+    block_size = geometry.block_size;
+    if ((header_block = malloc(block_size)) == NULL) {
+        return -1;
+    }
+    header = (const memefs_journal_header_t*)header_block;
+    if (pread(fd, header_block, block_size, (off_t)geometry.journal_begin * block_size) != (ssize_t)block_size) {
+        perror("Failed to read journal header");
+        free(header_block);
+        return -1;
+    }
+    if (memcmp(header->magic, JOURNAL_MAGIC, sizeof(header->magic)) != 0) {
+        // Nothing has been journaled on this image yet.
+        free(header_block);
+        return 0;
+    }
+    next_sequence = ntohl(header->sequence) + 1;
+
+    num_blocks = ntohs(header->num_blocks);
+    if (!replay || num_blocks == 0 || num_blocks > journal_capacity()) {
+        free(header_block);
+        return 0;
+    }
+
+    logged = malloc((size_t)num_blocks * block_size);
+    sources = malloc(num_blocks * sizeof(const void*));
+    if (logged == NULL || sources == NULL) {
+        free(header_block);
+        free(logged);
+        free(sources);
+        return -1;
+    }
+
+    result = -1;
+    if (pread(fd, logged, (size_t)num_blocks * block_size, (off_t)(geometry.journal_begin + 1) * block_size) != (ssize_t)(num_blocks * block_size)) {
+        perror("Failed to read journal blocks");
+        goto done;
+    }
+    for (i = 0; i < num_blocks; i++) {
+        sources[i] = logged + ((size_t)i * block_size);
+    }
+    if (checksum_transaction(header_block, sources, num_blocks) != ntohl(header->checksum)) {
+        // Torn transaction, the crash hit before it committed so the home blocks are still intact.
+        fprintf(stderr, "Discarding incomplete journal transaction %u\n", ntohl(header->sequence));
+        result = 0;
+        goto done;
+    }
+
+    for (i = 0; i < num_blocks; i++) {
+        home_block = get_home_block(header_block, i);
+        if (home_block >= geometry.total_blocks) {
+            fprintf(stderr, "Journal names block %u outside the image\n", home_block);
+            goto done;
+        }
+        if (pwrite(fd, sources[i], block_size, (off_t)home_block * block_size) != (ssize_t)block_size) {
+            perror("Failed to replay journal block");
+            goto done;
+        }
+        if ((home_block >= geometry.fat_main_begin) && (home_block < geometry.fat_main_begin + geometry.fat_num_blocks)) {
+            // Backup FAT is not logged, it is always a copy of the main FAT.
+            fat_block = home_block - geometry.fat_main_begin;
+            if (pwrite(fd, sources[i], block_size, (off_t)(geometry.fat_backup_begin + fat_block) * block_size) != (ssize_t)block_size) {
+                perror("Failed to replay journal block");
+                goto done;
+            }
+        }
+    }
+    if (fdatasync(fd) != 0) {
+        perror("Failed to sync replayed journal");
+        goto done;
+    }
+
+    fprintf(stderr, "Replayed journal transaction %u (%u blocks)\n", ntohl(header->sequence), num_blocks);
+    result = 1;
+
+done:
+    free(header_block);
+    free(logged);
+    free(sources);
+    return result;
+}
+
+static void set_home_block(uint8_t* header_block, uint32_t index, uint32_t home_block) {
+    uint16_t home16;
+    uint32_t home32;
+
+    if (geometry.fat_entry_size == sizeof(uint16_t)) {
+        home16 = htons((uint16_t)home_block);
+        memcpy(header_block + sizeof(memefs_journal_header_t) + (index * sizeof(uint16_t)), &home16, sizeof(home16));
+        return;
+    }
+    home32 = htonl(home_block);
+    memcpy(header_block + sizeof(memefs_journal_header_t) + (index * sizeof(uint32_t)), &home32, sizeof(home32));
+}
+
+int write_journal(int fd, const uint32_t* home_blocks, const void* const* sources, uint32_t num_blocks) {
+    struct iovec iov[JOURNAL_IOV_MAX];
+    memefs_journal_header_t* header;
+    uint8_t* header_block;
+    size_t block_size;
+    uint32_t i, batch_start;
+    uint64_t started;
+    int iov_count, result;
+
+    if (num_blocks > journal_capacity()) {
+        fprintf(stderr, "Journal transaction of %u blocks is too large\n", num_blocks);
+        return -1;
+    }
+
+    block_size = geometry.block_size;
+    if ((header_block = calloc(1, block_size)) == NULL) {
+        return -1;
+    }
+    started = event_begin();
+    header = (memefs_journal_header_t*)header_block;
+    memcpy(header->magic, JOURNAL_MAGIC, sizeof(header->magic));
+    header->sequence = htonl(next_sequence);
+    header->num_blocks = htons((uint16_t)num_blocks);
+    for (i = 0; i < num_blocks; i++) {
+        set_home_block(header_block, i, home_blocks[i]);
+    }
+    header->checksum = htonl(checksum_transaction(header_block, sources, num_blocks));
+
+    // Header and blocks go out in as few writes as the segment limit allows, the checksum catches a torn one.
+    iov[0].iov_base = header_block;
+    iov[0].iov_len = block_size;
+    iov_count = 1;
+    batch_start = 0;
+    result = 0;
+    for (i = 0; (i <= num_blocks) && (result == 0); i++) {
+        if ((i == num_blocks) || (iov_count == JOURNAL_IOV_MAX)) {
+            // Batch covers journal blocks [batch_start, batch_start + iov_count).
+            if (pwritev(fd, iov, iov_count, (off_t)(geometry.journal_begin + batch_start) * block_size) != (ssize_t)(iov_count * block_size)) {
+                perror("Failed to write journal transaction");
+                result = -1;
+            }
+            batch_start += (uint32_t)iov_count;
+            iov_count = 0;
+        }
+        if (i < num_blocks) {
+            iov[iov_count].iov_base = (void*)sources[i];
+            iov[iov_count].iov_len = block_size;
+            iov_count++;
+        }
+    }
+
+    free(header_block);
+    event_end(PHASE_JOURNAL, started);
+    if (result == 0) {
+        next_sequence++;
+        // An empty transaction only clears the journal, nothing was committed.
+        add_stat(STAT_BYTES_WRITTEN, ((uint64_t)num_blocks + 1) * block_size);
+        add_stat(STAT_JOURNAL_COMMITS, (num_blocks > 0) ? 1 : 0);
+    }
+    return result;
+}
+
+#pragma endregion Implementations
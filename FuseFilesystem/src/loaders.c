@@ -7,24 +7,92 @@
 
 #include <arpa/inet.h>
 #include <errno.h>
+#include <pthread.h>
+#include <stddef.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
 #include <unistd.h>
 
+#include "allocator.h"
+#include "block_cache.h"
+#include "block_map.h"
 #include "define.h"
+#include "dir_index.h"
+#include "dirty.h"
+#include "events.h"
+#include "geometry.h"
+#include "journal.h"
+#include "locks.h"
 #include "memefs_file_entry.h"
 #include "memefs_superblock.h"
+#include "stats.h"
+
+#define FLUSH_IOV_MAX 64 // Segments gathered per pwritev.
+
+extern memefs_geometry_t geometry;
 
 int img_fd; // Filesystem image file descriptor.
+int use_mmap; // Whether the image is mapped instead of copied into memory.
 memefs_superblock_t main_superblock;
 memefs_superblock_t backup_superblock;
-memefs_file_entry_t directory[MAX_FILE_ENTRIES];
-uint16_t main_fat[MAX_FAT_ENTRIES];
-uint16_t backup_fat[MAX_FAT_ENTRIES];
-uint8_t user_data[USER_DATA_NUM_BLOCKS * BLOCK_SIZE];
+memefs_file_entry_t* directory; // Directory entries.
+uint32_t* main_fat; // FAT entries in host byte order, FAT_END_OF_CHAIN ends a chain. The backup FAT is always a copy.
+uint8_t* user_data; // User data blocks in the image mapping, NULL unless use_mmap. Otherwise they live in the block cache.
+
+static memefs_file_entry_t* directory_buffer; // Whole directory region.
+static uint8_t* image_map; // MAP_SHARED view of the whole image, NULL unless use_mmap.
+static size_t image_map_size; // Bytes in image_map.
+
+static uint8_t* directory_out;  // Directory snapshot for writeback.
+static uint8_t* fat_out;        // FAT in the on-disk format for writeback, serves both copies.
+static uint8_t* superblock_out; // Main then backup superblock, padded to a block each.
+static uint8_t* zero_block;     // Contents of the unused reserved blocks.
+static uint32_t* logged_homes;        // Home block of each block in the transaction being written.
+static const void** logged_sources;   // Contents of each block in the transaction being written.
+static dirty_set_t claimed_set;   // Blocks claimed by the writeback in progress.
+static dirty_set_t metadata_set;  // Claimed directory and FAT blocks, journaled.
+static dirty_set_t other_set;     // Claimed blocks written straight home.
+static dirty_set_t metadata_mask; // Every directory and FAT block.
+static pthread_mutex_t flush_lock = PTHREAD_MUTEX_INITIALIZER; // One writeback at a time, guards everything below.
+static int image_synced;   // Whether everything written so far would survive a crash, given journal replay.
+static uint32_t unsynced_evictions; // Data blocks the block cache wrote home since the last sync. Updated with atomics.
+static int mounted_unclean; // Whether the image was not cleanly unmounted last time.
+static int refuse_unclean;  // Whether load_image leaves an image that is mounted or crashed alone.
 
 #pragma region Prototypes
 
+// static int flush_run_mapped(uint32_t, uint32_t)
+// Description: Flushes a run of dirty blocks through the image mapping.
+// Preconditions: Image is mapped, staging buffers are filled.
+// Postconditions: Mapping holds the run and msync has been issued over it.
+// Returns: 0 on success, -1 on failure.
+static int flush_run_mapped(uint32_t run_start, uint32_t run_length);
+
+// static int flush_run_pwritev(uint32_t, uint32_t)
+// Description: Writes a run of dirty blocks to the image, gathering up to FLUSH_IOV_MAX segments per pwritev.
+// Preconditions: Staging buffers are filled.
+// Postconditions: Image holds the run.
+// Returns: 0 on success, -1 on failure.
+static int flush_run_pwritev(uint32_t run_start, uint32_t run_length);
+
+// static const void* image_block_source(uint32_t)
+// Description: Finds the in-memory copy of an image block.
+// Preconditions: Staging buffers are filled.
+// Postconditions: None.
+// Returns: Pointer to a block of bytes to write for the block, or NULL if a user data block is not in the cache.
+static const void* image_block_source(uint32_t image_block);
+
+// static int init_image_buffers()
+// Description: Sizes every in-memory copy of the image for its geometry.
+// Preconditions: Geometry is read. No other thread is running.
+// Postconditions: Buffers, dirty map, block maps and file locks cover the image.
+// Returns: 0 on success, -1 on failure.
+static int init_image_buffers();
+
 // static int load_directory()
 // Description: Loads the directory fromm the filesystem image into memory.
 // Preconditions: Image exists.
@@ -33,16 +101,16 @@ uint8_t user_data[USER_DATA_NUM_BLOCKS * BLOCK_SIZE];
 static int load_directory();
 
 // static int load_fat()
-// Description: Loads the FATs from the filesystem image into memory.
+// Description: Loads the main FAT from the filesystem image into memory.
 // Preconditions: Image exists.
-// Postconditions: FATs are loaded into memory.
+// Postconditions: FAT is loaded into memory.
 // Returns: 0 on success, -1 on failure.
 static int load_fat();
 
 // static int load_superblock()
-// Description: Loads the superblocks from the filesystem image into memory.
+// Description: Loads the superblocks from the filesystem image into memory and reads the geometry.
 // Preconditions: Image exists.
-// Postconditions: Superblocks are loaded into memory.
+// Postconditions: Superblocks are loaded into memory and geometry describes the image.
 // Returns: 0 on success, -1 on failure.
 static int load_superblock();
 
@@ -53,105 +121,334 @@ static int load_superblock();
 // Returns: 0 on success, -1 on failure.
 static int load_user_data();
 
-// static int unload_directory()
-// Description: Unloads the directory from memory into the filesystem image.
-// Preconditions: Directory exists in memory.
-// Postconditions: Directory is rewritten on image from memory.
+// static void pin_claimed_data(dirty_set_t*)
+// Description: Pins the claimed user data blocks in the block cache for writeback.
+// Preconditions: flush_lock is held. Set holds claimed blocks.
+// Postconditions: Data blocks left in the set are pinned. Those already evicted, and so written, are removed.
+// Returns: None.
+static void pin_claimed_data(dirty_set_t* blocks);
+
+// static void release_claimed_data(const dirty_set_t*, int)
+// Description: Unpins the user data blocks pinned by pin_claimed_data.
+// Preconditions: flush_lock is held. Blocks were pinned by pin_claimed_data.
+// Postconditions: Blocks are unpinned, and evictable without a write if written is set.
+// Returns: None.
+static void release_claimed_data(const dirty_set_t* blocks, int written);
+
+// static int map_image()
+// Description: Maps the filesystem image and points the user data into it.
+// Preconditions: Image is open read/write. Geometry is read.
+// Postconditions: user_data is a view into the mapping.
+// Returns: 0 on success, -1 on failure.
+static int map_image();
+
+// static int sync_data()
+// Description: Syncs the image's data with fdatasync.
+// Preconditions: flush_lock is held.
+// Postconditions: Everything written to the image so far is on stable storage, on success.
 // Returns: 0 on success, -1 on failure.
-static int unload_directory();
+static int sync_data();
 
-// static int unload_fat()
-// Description: Unloads the FATs from memory into the filesystem image.
-// Preconditions: FATs exist in memory.
-// Postconditions: FATs are rewritten on image from memory.
+// static int write_claimed(const dirty_set_t*)
+// Description: Claims dirty blocks from the dirty map between ops and writes them to the image.
+// Preconditions: flush_lock is held. wanted is NULL to claim every dirty block.
+// Postconditions: Image holds the claimed blocks, or they are marked dirty again on failure.
 // Returns: 0 on success, -1 on failure.
-static int unload_fat();
+static int write_claimed(const dirty_set_t* wanted);
 
-// static int unload_superblock()
-// Description: Unloads the superblocks from memory into the filesystem image.
-// Preconditions: Superblocks exist in memory.
-// Postconditions: Superblocks are rewritten on image from memory.
+// static int write_dirty_runs(const dirty_set_t*)
+// Description: Writes every run of blocks in a set to their home locations.
+// Preconditions: flush_lock is held. Staging buffers are filled.
+// Postconditions: Image holds the blocks, not yet synced.
 // Returns: 0 on success, -1 on failure.
-static int unload_superblock();
+static int write_dirty_runs(const dirty_set_t* blocks);
 
-// static int unload_user_data()
-// Description: Unloads the user data from memory into the filesystem image.
-// Preconditions: User data exists in memory.
-// Postconditions: User data is rewritten on image from memory.
+// static int write_segments(const struct iovec*, int, uint32_t, size_t)
+// Description: Writes gathered segments to the image starting at a block.
+// Preconditions: Segments add up to length bytes.
+// Postconditions: Image holds the segments.
 // Returns: 0 on success, -1 on failure.
-static int unload_user_data();
+static int write_segments(const struct iovec* iov, int iov_count, uint32_t first_block, size_t length);
 
 #pragma endregion Prototypes
 
 #pragma region Implementations
 
-static int load_directory() {
-    off_t directory_offset;
-    int i;
-    
-    // Load directory entries from bottom (240) to top (253).
-    directory_offset = (off_t)(DIRECTORY_BEGIN * BLOCK_SIZE);
-    for (i = 0; i < MAX_FILE_ENTRIES; i++) {
-        if (pread(img_fd, &directory[i], FILE_ENTRY_SIZE, directory_offset) != FILE_ENTRY_SIZE) {
-            perror("Failed to read directory entry");
+void close_image() {
+    if (image_map != NULL) {
+        munmap(image_map, image_map_size);
+        image_map = NULL;
+        user_data = NULL;
+    }
+
+    if (img_fd >= 0) {
+        close(img_fd);
+        img_fd = -1;
+    }
+}
+
+static int flush_run_mapped(uint32_t run_start, uint32_t run_length) {
+    const uint8_t* source;
+    uint8_t* target;
+    size_t block_size, sync_start, sync_end, page_size;
+    uint32_t curr_block;
+
+    // Directory and data blocks already live in the mapping, the rest are copied in.
+    block_size = geometry.block_size;
+    for (curr_block = run_start; curr_block < run_start + run_length; curr_block++) {
+        if ((source = (const uint8_t*)image_block_source(curr_block)) == NULL) {
+            fprintf(stderr, "Dirty block %u is not in memory\n", curr_block);
             return -1;
         }
-        directory_offset += (off_t)FILE_ENTRY_SIZE;
+        target = image_map + ((size_t)curr_block * block_size);
+        if (source != target) {
+            memcpy(target, source, block_size);
+        }
     }
 
+    // msync wants a page aligned start.
+    page_size = (size_t)sysconf(_SC_PAGESIZE);
+    sync_start = ((size_t)run_start * block_size) & ~(page_size - 1);
+    sync_end = (size_t)(run_start + run_length) * block_size;
+    if (msync(image_map + sync_start, sync_end - sync_start, MS_ASYNC) != 0) {
+        perror("Failed to sync dirty blocks");
+        return -1;
+    }
+
+    add_stat(STAT_BYTES_WRITTEN, (uint64_t)run_length * block_size);
     return 0;
 }
 
-static int load_fat() {
-    off_t fat_offset;
-    int i;
-    
-    // Load main FAT.
-    fat_offset = (off_t)(FAT_MAIN_BEGIN * BLOCK_SIZE);
-    if (pread(img_fd, &main_fat, BLOCK_SIZE, fat_offset) != sizeof(main_fat)) {
-        perror("Failed to read main FAT");
+static int flush_run_pwritev(uint32_t run_start, uint32_t run_length) {
+    struct iovec iov[FLUSH_IOV_MAX];
+    const uint8_t* source;
+    uint32_t curr_block, batch_start;
+    size_t block_size, batch_bytes;
+    int iov_count;
+
+    block_size = geometry.block_size;
+    batch_start = run_start;
+    batch_bytes = 0;
+    for (curr_block = run_start, iov_count = 0; curr_block < run_start + run_length; curr_block++) {
+        if ((source = (const uint8_t*)image_block_source(curr_block)) == NULL) {
+            fprintf(stderr, "Dirty block %u is not in memory\n", curr_block);
+            return -1;
+        }
+        if ((iov_count > 0) && ((const uint8_t*)iov[iov_count - 1].iov_base + iov[iov_count - 1].iov_len == source)) {
+            // Contiguous in memory too, grow the previous segment.
+            iov[iov_count - 1].iov_len += block_size;
+        } else {
+            if (iov_count == FLUSH_IOV_MAX) {
+                // Out of segments, write what has been gathered so far.
+                if (write_segments(iov, iov_count, batch_start, batch_bytes) < 0) {
+                    return -1;
+                }
+                batch_start = curr_block;
+                batch_bytes = 0;
+                iov_count = 0;
+            }
+            iov[iov_count].iov_base = (void*)source;
+            iov[iov_count].iov_len = block_size;
+            iov_count++;
+        }
+        batch_bytes += block_size;
+    }
+
+    return write_segments(iov, iov_count, batch_start, batch_bytes);
+}
+
+static const void* image_block_source(uint32_t image_block) {
+    size_t block_size;
+
+    block_size = geometry.block_size;
+    if (image_block == geometry.superblock_main) {
+        return superblock_out;
+    } else if (image_block == geometry.superblock_backup) {
+        return superblock_out + block_size;
+    } else if ((image_block >= geometry.fat_main_begin) && (image_block < geometry.fat_main_begin + geometry.fat_num_blocks)) {
+        return fat_out + ((size_t)(image_block - geometry.fat_main_begin) * block_size);
+    } else if ((image_block >= geometry.fat_backup_begin) && (image_block < geometry.fat_backup_begin + geometry.fat_num_blocks)) {
+        // Backup FAT is written from the main FAT's staging.
+        return fat_out + ((size_t)(image_block - geometry.fat_backup_begin) * block_size);
+    } else if ((image_block >= geometry.directory_begin) && (image_block < geometry.directory_begin + geometry.directory_num_blocks)) {
+        return directory_out + ((size_t)(image_block - geometry.directory_begin) * block_size);
+    } else if ((image_block >= geometry.user_data_begin) && (image_block < geometry.user_data_begin + geometry.user_data_num_blocks)) {
+        return peek_block(image_block - geometry.user_data_begin);
+    }
+    return zero_block;
+}
+
+static int init_image_buffers() {
+    size_t block_size, directory_bytes;
+    uint32_t block, num_metadata_blocks;
+
+    free(directory_buffer);
+    free(directory_out);
+    free(fat_out);
+    free(superblock_out);
+    free(zero_block);
+    free(main_fat);
+    free(logged_homes);
+    free(logged_sources);
+    free_dirty_set(&claimed_set);
+    free_dirty_set(&metadata_set);
+    free_dirty_set(&other_set);
+    free_dirty_set(&metadata_mask);
+
+    block_size = geometry.block_size;
+    directory_bytes = (size_t)geometry.directory_num_blocks * block_size;
+    num_metadata_blocks = geometry.directory_num_blocks + geometry.fat_num_blocks;
+    directory_buffer = calloc(1, directory_bytes);
+    directory_out = calloc(1, directory_bytes);
+    fat_out = calloc(geometry.fat_num_blocks, block_size);
+    superblock_out = calloc(2, block_size);
+    zero_block = calloc(1, block_size);
+    main_fat = malloc((size_t)geometry.fat_num_entries * sizeof(uint32_t));
+    logged_homes = malloc(num_metadata_blocks * sizeof(uint32_t));
+    logged_sources = malloc(num_metadata_blocks * sizeof(const void*));
+    if ((directory_buffer == NULL) || (directory_out == NULL) || (fat_out == NULL)
+        || (superblock_out == NULL) || (zero_block == NULL) || (main_fat == NULL) || (logged_homes == NULL) || (logged_sources == NULL)
+        || (init_dirty_set(&claimed_set) != 0) || (init_dirty_set(&metadata_set) != 0) || (init_dirty_set(&other_set) != 0)
+        || (init_dirty_set(&metadata_mask) != 0)) {
+        fprintf(stderr, "Failed to allocate memory for a %u block image\n", geometry.total_blocks);
         return -1;
     }
 
-    // Load backup FAT.
-    fat_offset = (off_t)(FAT_BACKUP_BEGIN * BLOCK_SIZE);
-    if (pread(img_fd, &backup_fat, BLOCK_SIZE, fat_offset) != sizeof(backup_fat)) {
-        perror("Failed to read backup FAT");
+    for (block = 0; block < geometry.directory_num_blocks; block++) {
+        add_to_dirty_set(&metadata_mask, geometry.directory_begin + block);
+    }
+    for (block = 0; block < geometry.fat_num_blocks; block++) {
+        add_to_dirty_set(&metadata_mask, geometry.fat_main_begin + block);
+        add_to_dirty_set(&metadata_mask, geometry.fat_backup_begin + block);
+    }
+
+    if ((init_dirty_blocks() != 0) || (init_block_maps() != 0) || (init_file_locks() != 0) || (init_block_cache() != 0)) {
+        fprintf(stderr, "Failed to allocate memory for a %u block image\n", geometry.total_blocks);
+        return -1;
+    }
+    return 0;
+}
+
+static int load_directory() {
+    size_t directory_bytes;
+
+    // Kept out of the mapping even with use_mmap, so the kernel can't write it home ahead of the journal.
+    directory_bytes = (size_t)geometry.directory_num_blocks * geometry.block_size;
+    if (pread(img_fd, directory, directory_bytes, (off_t)geometry.directory_begin * geometry.block_size) != (ssize_t)directory_bytes) {
+        perror("Failed to read directory");
+        return -1;
+    }
+
+    return 0;
+}
+
+static int load_fat() {
+    const uint16_t* fat16;
+    const uint32_t* fat32;
+    size_t fat_bytes;
+    uint32_t i;
+
+    // Only the main FAT is read, the backup is always rewritten as a copy of it.
+    fat_bytes = (size_t)geometry.fat_num_blocks * geometry.block_size;
+    if (pread(img_fd, fat_out, fat_bytes, (off_t)geometry.fat_main_begin * geometry.block_size) != (ssize_t)fat_bytes) {
+        perror("Failed to read main FAT");
         return -1;
     }
 
     // Convert FAT entries from network byte order to host byte order.
-    for (i = 0; i < MAX_FAT_ENTRIES; i++) {
-        main_fat[i] = ntohs(main_fat[i]);
-        backup_fat[i] = ntohs(backup_fat[i]);
+    fat16 = (const uint16_t*)fat_out;
+    fat32 = (const uint32_t*)fat_out;
+    for (i = 0; i < geometry.fat_num_entries; i++) {
+        if (geometry.fat_entry_size == sizeof(uint16_t)) {
+            main_fat[i] = (ntohs(fat16[i]) == 0xFFFF) ? FAT_END_OF_CHAIN : ntohs(fat16[i]);
+        } else {
+            main_fat[i] = ntohl(fat32[i]);
+        }
     }
 
     return 0;
 }
 
 int load_image() {
-	if (load_superblock() < 0 || load_directory() < 0) {
-    	fprintf(stderr, "Failed to load superblock or directory\n");
-    	close(img_fd);
+	if (load_superblock() < 0) {
+    	fprintf(stderr, "Failed to load superblock\n");
+    	close_image();
     	return 1;
 	}
+    // Mounted elsewhere looks the same as crashed, so nothing is replayed or written until the caller says which.
+    if (mounted_unclean && refuse_unclean) {
+        fprintf(stderr, "Filesystem image is mounted or was not cleanly unmounted\n");
+        close_image();
+        return 2;
+    }
+    if (init_image_buffers() < 0) {
+        close_image();
+        return 1;
+    }
+
+    directory = directory_buffer;
+    user_data = NULL;
+    if (use_mmap && map_image() < 0) {
+        fprintf(stderr, "Failed to map filesystem image\n");
+        close_image();
+        return 1;
+    }
+
+    // Replay before reading metadata, the journal may hold newer directory and FAT blocks.
+    if (load_journal(img_fd, mounted_unclean) < 0 || load_directory() < 0) {
+        fprintf(stderr, "Failed to replay journal or load directory\n");
+        close_image();
+        return 1;
+    }
     if (load_fat() < 0 || load_user_data() < 0) {
         fprintf(stderr, "Failed to load FATs or user data\n");
-        close(img_fd);
+        close_image();
         return 1;
     }
 
     main_superblock.cleanly_unmounted = 0xFF;
     backup_superblock.cleanly_unmounted = 0xFF;
+    mark_superblock_dirty();
+    if (build_free_map() != 0 || build_dir_index() != 0) {
+        fprintf(stderr, "Failed to index filesystem image\n");
+        close_image();
+        return 1;
+    }
+
+    // Get the unclean flag onto disk now, it is what triggers replay after a crash.
+    if (unload_image() != 0 || sync_image(1) != 0) {
+        fprintf(stderr, "Failed to mark filesystem image in use\n");
+        close_image();
+        return 1;
+    }
     return 0;
 }
 
 static int load_superblock() {
+    memefs_superblock_t first_superblock;
+    struct stat image_stat;
     off_t superblock_offset;
-    
+
+    // Block 0 holds a superblock in every version, and it says where everything else lives.
+    if (pread(img_fd, &first_superblock, sizeof(first_superblock), 0) != sizeof(memefs_superblock_t)) {
+        perror("Failed to read superblock");
+        return -1;
+    }
+    if (strncmp(first_superblock.signature, SIGNATURE, strlen(SIGNATURE)) != 0) {
+        fprintf(stderr, "Invalid filesystem signature\n");
+        return -1;
+    }
+    if (fstat(img_fd, &image_stat) != 0) {
+        perror("Failed to stat filesystem image");
+        return -1;
+    }
+    if (read_geometry(&first_superblock, (uint64_t)image_stat.st_size) < 0) {
+        return -1;
+    }
+
     // Load main superblock.
-    superblock_offset = (off_t)(SUPERBLOCK_MAIN_BEGIN * BLOCK_SIZE);
-    if (pread(img_fd, &main_superblock, BLOCK_SIZE, superblock_offset) != sizeof(memefs_superblock_t)) {
+    superblock_offset = (off_t)geometry.superblock_main * geometry.block_size;
+    if (pread(img_fd, &main_superblock, sizeof(memefs_superblock_t), superblock_offset) != sizeof(memefs_superblock_t)) {
         perror("Failed to read main superblock");
         return -1;
     }
@@ -161,8 +458,8 @@ static int load_superblock() {
     }
 
     // Load backup superblock.
-    superblock_offset = (off_t)(SUPERBLOCK_BACKUP_BEGIN * BLOCK_SIZE);
-    if (pread(img_fd, &backup_superblock, BLOCK_SIZE, superblock_offset) != sizeof(memefs_superblock_t)) {
+    superblock_offset = (off_t)geometry.superblock_backup * geometry.block_size;
+    if (pread(img_fd, &backup_superblock, sizeof(memefs_superblock_t), superblock_offset) != sizeof(memefs_superblock_t)) {
         perror("Failed to read backup superblock");
         return -1;
     }
@@ -171,114 +468,284 @@ static int load_superblock() {
         return -1;
     }
 
+    mounted_unclean = (main_superblock.cleanly_unmounted != 0x00);
     memset(main_superblock.reserved1, 0x00, sizeof(main_superblock.reserved1));
     memset(backup_superblock.reserved1, 0x00, sizeof(backup_superblock.reserved1));
-    memset(main_superblock.unused, 0x00, sizeof(main_superblock.unused));
-    memset(backup_superblock.unused, 0x00, sizeof(backup_superblock.unused));
+    if (geometry.version == 1) {
+        // Everything after the volume label is unused on v1.
+        memset(&main_superblock.block_size, 0x00, sizeof(memefs_superblock_t) - offsetof(memefs_superblock_t, block_size));
+        memset(&backup_superblock.block_size, 0x00, sizeof(memefs_superblock_t) - offsetof(memefs_superblock_t, block_size));
+    } else {
+        memset(main_superblock.unused, 0x00, sizeof(main_superblock.unused));
+        memset(backup_superblock.unused, 0x00, sizeof(backup_superblock.unused));
+    }
     main_superblock.cleanly_unmounted = 0x00;
     backup_superblock.cleanly_unmounted = 0x00;
     return 0;
 }
 
 static int load_user_data() {
-    off_t data_offset;
+    if (image_map != NULL) {
+        // User data is a view into the mapping.
+        return 0;
+    }
 
-    data_offset = (off_t)(USER_DATA_BEGIN * BLOCK_SIZE);
-    if (pread(img_fd, &user_data, USER_DATA_NUM_BLOCKS * BLOCK_SIZE, data_offset) != (USER_DATA_NUM_BLOCKS * BLOCK_SIZE)) {
-        perror("Failed to read user data");
+    // Reads everything up front only if it all fits the cache and loading isn't lazy.
+    return preload_block_cache();
+}
+
+static int map_image() {
+    void* mapping;
+    size_t map_size;
+
+    // load_superblock already checked the image holds every block.
+    map_size = (size_t)geometry.total_blocks * geometry.block_size;
+    mapping = mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, img_fd, 0);
+    if (mapping == MAP_FAILED) {
+        perror("Failed to map filesystem image");
         return -1;
     }
 
+    image_map = (uint8_t*)mapping;
+    image_map_size = map_size;
+    user_data = image_map + ((size_t)geometry.user_data_begin * geometry.block_size);
     return 0;
 }
 
-static int unload_directory() {
-    off_t directory_offset;
-    int i;
+static void pin_claimed_data(dirty_set_t* blocks) {
+    uint32_t block, curr_block, run_start, run_length, data_end;
 
-    // Unload directory entries from bottom (253) to top (240).
-    directory_offset = (off_t)(DIRECTORY_BEGIN * BLOCK_SIZE);
-    for (i = 0; i < MAX_FILE_ENTRIES; i++) {
-        if (pwrite(img_fd, &directory[i], FILE_ENTRY_SIZE, directory_offset) != FILE_ENTRY_SIZE) {
-            perror("Failed to write directory entry");
-            return -1;
+    data_end = geometry.user_data_begin + geometry.user_data_num_blocks;
+    for (block = geometry.user_data_begin; next_dirty_run(blocks, block, &run_start, &run_length) && (run_start < data_end); block = run_start + run_length) {
+        for (curr_block = run_start; (curr_block < run_start + run_length) && (curr_block < data_end); curr_block++) {
+            if (pin_for_writeback(curr_block - geometry.user_data_begin) != 0) {
+                remove_from_dirty_set(blocks, curr_block);
+            }
         }
-        directory_offset += (off_t)FILE_ENTRY_SIZE;
     }
-
-    return 0;
 }
 
-static int unload_fat() { 
-    off_t fat_offset;
-    int i;
-    
-    // Convert FAT entries from host byte order to network byte order.
-    for (i = 0; i < MAX_FAT_ENTRIES; i++) {
-        main_fat[i] = htons(main_fat[i]);
-        backup_fat[i] = htons(backup_fat[i]);
-    }
+static void release_claimed_data(const dirty_set_t* blocks, int written) {
+    uint32_t block, curr_block, run_start, run_length, data_end;
 
-    // Load main FAT.
-    fat_offset = (off_t)(FAT_MAIN_BEGIN * BLOCK_SIZE);
-    if (pwrite(img_fd, &main_fat, BLOCK_SIZE, fat_offset) != sizeof(main_fat)) {
-        perror("Failed to write main FAT");
-        return -1;
+    data_end = geometry.user_data_begin + geometry.user_data_num_blocks;
+    for (block = geometry.user_data_begin; next_dirty_run(blocks, block, &run_start, &run_length) && (run_start < data_end); block = run_start + run_length) {
+        for (curr_block = run_start; (curr_block < run_start + run_length) && (curr_block < data_end); curr_block++) {
+            finish_block_writeback(curr_block - geometry.user_data_begin, written);
+        }
     }
+}
 
-    // Load backup FAT.
-    fat_offset = (off_t)(FAT_BACKUP_BEGIN * BLOCK_SIZE);
-    if (pwrite(img_fd, &backup_fat, BLOCK_SIZE, fat_offset) != sizeof(backup_fat)) {
-        perror("Failed to write backup FAT");
-        return -1;
+void set_refuse_unclean(int refuse) {
+    refuse_unclean = refuse;
+}
+
+static int sync_data() {
+    uint64_t started;
+    int result;
+
+    started = event_begin();
+    add_stat(STAT_IMAGE_SYNCS, 1);
+    result = fdatasync(img_fd);
+    event_end(PHASE_SYNC, started);
+    return result;
+}
+
+int sync_image(int datasync) {
+    uint32_t evictions;
+    uint64_t started;
+    int result;
+
+    pthread_mutex_lock(&flush_lock);
+    evictions = __atomic_load_n(&unsynced_evictions, __ATOMIC_ACQUIRE);
+    if (image_synced && datasync && (evictions == 0)) {
+        // Last writeback ended with a journal commit, nothing is unprotected.
+        pthread_mutex_unlock(&flush_lock);
+        return 0;
     }
 
-    // Convert local FAT entries from network byte order back to host byte order.
-    for (i = 0; i < MAX_FAT_ENTRIES; i++) {
-        main_fat[i] = ntohs(main_fat[i]);
-        backup_fat[i] = ntohs(backup_fat[i]);
+    result = 0;
+    started = event_begin();
+    add_stat(STAT_IMAGE_SYNCS, 1);
+    if ((image_map != NULL) && (msync(image_map, image_map_size, MS_SYNC) != 0)) {
+        perror("Failed to sync image mapping");
+        result = -1;
+    } else if ((datasync ? fdatasync(img_fd) : fsync(img_fd)) != 0) {
+        perror("Failed to sync filesystem image");
+        result = -1;
     }
+    event_end(PHASE_SYNC, started);
+    image_synced = (result == 0);
+    if (result == 0) {
+        __atomic_fetch_sub(&unsynced_evictions, evictions, __ATOMIC_RELEASE);
+    }
+    pthread_mutex_unlock(&flush_lock);
+    return result;
+}
 
-    return 0;
+int unload_blocks(const dirty_set_t* blocks) {
+    uint64_t started;
+    int result;
+
+    pthread_mutex_lock(&flush_lock);
+    started = event_begin();
+    result = write_claimed(blocks);
+    event_end(PHASE_WRITEBACK, started);
+    pthread_mutex_unlock(&flush_lock);
+    return result;
 }
 
 int unload_image() {
-    if (unload_user_data() < 0 || unload_fat() < 0 || unload_directory() < 0 || unload_superblock() < 0) {
+    uint64_t started;
+    int result;
+
+    pthread_mutex_lock(&flush_lock);
+    started = event_begin();
+    result = write_claimed(NULL);
+    event_end(PHASE_WRITEBACK, started);
+    pthread_mutex_unlock(&flush_lock);
+    return result;
+}
+
+static int write_claimed(const dirty_set_t* wanted) {
+    const dirty_set_t* claimed;
+    size_t block_size, block_offset;
+    uint32_t i, block, curr_block, run_start, run_length, num_logged, entries_per_block;
+    int fits, result;
+
+    add_stat(STAT_WRITEBACKS, 1);
+    // Claim and snapshot between the same two ops, so the data written first is all the logged metadata points at.
+    // Anything changed after the snapshot is marked dirty again and caught next time.
+    quiesce_updates();
+    claimed = &claimed_set;
+    if (wanted != NULL) {
+        memcpy(claimed_set.words, wanted->words, (size_t)claimed_set.num_words * sizeof(uint64_t));
+        take_dirty_subset(&claimed_set);
+        for (i = 0; (i < claimed_set.num_words) && ((claimed_set.words[i] & metadata_mask.words[i]) == 0); i++);
+        if (i < claimed_set.num_words) {
+            // The FAT and directory blocks logged may point at other files' new blocks too, so their data goes first as well.
+            for (i = 0; i < other_set.num_words; i++) {
+                other_set.words[i] = ~metadata_mask.words[i];
+            }
+            take_dirty_subset(&other_set);
+            for (i = 0; i < claimed_set.num_words; i++) {
+                claimed_set.words[i] |= other_set.words[i];
+            }
+        }
+    } else {
+        take_dirty_blocks(&claimed_set);
+    }
+
+    // Split off the directory and FAT blocks, those go through the journal.
+    for (i = 0; i < claimed->num_words; i++) {
+        other_set.words[i] = claimed->words[i] & ~metadata_mask.words[i];
+        metadata_set.words[i] = claimed->words[i] & metadata_mask.words[i];
+    }
+    for (block = geometry.fat_backup_begin; next_dirty_run(&metadata_set, block, &run_start, &run_length) && (run_start < geometry.fat_backup_begin + geometry.fat_num_blocks); block = run_start + run_length) {
+        // Only the main FAT is logged, replay copies it over the backup.
+        for (curr_block = run_start; (curr_block < run_start + run_length) && (curr_block < geometry.fat_backup_begin + geometry.fat_num_blocks); curr_block++) {
+            add_to_dirty_set(&metadata_set, geometry.fat_main_begin + (curr_block - geometry.fat_backup_begin));
+        }
+    }
+
+    // The journal never logs a half-done metadata change.
+    block_size = geometry.block_size;
+    entries_per_block = geometry.block_size / geometry.fat_entry_size;
+    memcpy(superblock_out, &main_superblock, sizeof(memefs_superblock_t));
+    memcpy(superblock_out + block_size, &backup_superblock, sizeof(memefs_superblock_t));
+    for (block = 0; next_dirty_run(&metadata_set, block, &run_start, &run_length); block = run_start + run_length) {
+        for (curr_block = run_start; curr_block < run_start + run_length; curr_block++) {
+            if ((curr_block >= geometry.directory_begin) && (curr_block < geometry.directory_begin + geometry.directory_num_blocks)) {
+                block_offset = (size_t)(curr_block - geometry.directory_begin) * block_size;
+                memcpy(directory_out + block_offset, (const uint8_t*)directory + block_offset, block_size);
+            } else if ((curr_block >= geometry.fat_main_begin) && (curr_block < geometry.fat_main_begin + geometry.fat_num_blocks)) {
+                block_offset = (size_t)(curr_block - geometry.fat_main_begin);
+                snapshot_fat((uint32_t)block_offset * entries_per_block, entries_per_block, fat_out + (block_offset * block_size));
+            }
+        }
+    }
+    resume_updates();
+
+    // Data and superblocks go straight home.
+    pin_claimed_data(&other_set);
+    result = write_dirty_runs(&other_set);
+    release_claimed_data(&other_set, result == 0);
+    if (result < 0) {
+        return_dirty_blocks(claimed);
         return -1;
     }
-    return 0;
-}
 
-static int unload_superblock() {
-    off_t superblock_offset;
-    
-    // Load main superblock.
-    superblock_offset = (off_t)(SUPERBLOCK_MAIN_BEGIN * BLOCK_SIZE);
-    if (pwrite(img_fd, &main_superblock, BLOCK_SIZE, superblock_offset) != sizeof(memefs_superblock_t)) {
-        perror("Failed to write main superblock");
+    num_logged = 0;
+    for (block = 0; next_dirty_run(&metadata_set, block, &run_start, &run_length); block = run_start + run_length) {
+        for (curr_block = run_start; curr_block < run_start + run_length; curr_block++) {
+            if ((curr_block < geometry.fat_backup_begin) || (curr_block >= geometry.fat_backup_begin + geometry.fat_num_blocks)) {
+                logged_homes[num_logged] = curr_block;
+                logged_sources[num_logged++] = image_block_source(curr_block);
+            }
+        }
+    }
+    if (num_logged == 0) {
+        image_synced = 0;
+        return 0;
+    }
+
+    // One sync makes the data above and the last checkpoint durable before the journal is reused,
+    // and one more commits every op batched into this writeback.
+    // A transaction too big for the journal empties it instead, so replay can't roll the blocks back,
+    // and goes home unprotected.
+    fits = (num_logged <= journal_capacity());
+    if (sync_data() != 0) {
+        result = -1;
+    } else if (fits) {
+        result = write_journal(img_fd, logged_homes, logged_sources, num_logged);
+    } else {
+        result = write_journal(img_fd, NULL, NULL, 0);
+    }
+    if ((result != 0) || (sync_data() != 0)) {
+        perror("Failed to commit journal transaction");
+        return_dirty_blocks(claimed);
+        image_synced = 0;
         return -1;
     }
 
-    // Load backup superblock.
-    superblock_offset = (off_t)(SUPERBLOCK_BACKUP_BEGIN * BLOCK_SIZE);
-    if (pwrite(img_fd, &backup_superblock, BLOCK_SIZE, superblock_offset) != sizeof(memefs_superblock_t)) {
-        perror("Failed to write backup superblock");
+    // Checkpoint, a crash from here on is repaired by replay.
+    if (write_dirty_runs(&metadata_set) < 0) {
+        return_dirty_blocks(&metadata_set);
+        image_synced = 0;
         return -1;
     }
+    image_synced = fits;
+    return 0;
+}
 
+int write_data_block(uint32_t data_block, const void* data) {
+    if (pwrite(img_fd, data, geometry.block_size, (off_t)(geometry.user_data_begin + data_block) * geometry.block_size) != (ssize_t)geometry.block_size) {
+        perror("Failed to write evicted block");
+        return -1;
+    }
+    __atomic_fetch_add(&unsynced_evictions, 1, __ATOMIC_RELEASE);
+    add_stat(STAT_BYTES_WRITTEN, geometry.block_size);
     return 0;
 }
 
-static int unload_user_data() {
-    off_t data_offset;
+static int write_dirty_runs(const dirty_set_t* blocks) {
+    uint32_t block, run_start, run_length;
 
-    data_offset = (off_t)(USER_DATA_BEGIN * BLOCK_SIZE);
-    if (pwrite(img_fd, &user_data, USER_DATA_NUM_BLOCKS * BLOCK_SIZE, data_offset) != (USER_DATA_NUM_BLOCKS * BLOCK_SIZE)) {
-        perror("Failed to write user data");
-        return -1;
+    for (block = 0; next_dirty_run(blocks, block, &run_start, &run_length); block = run_start + run_length) {
+        if ((image_map != NULL) ? (flush_run_mapped(run_start, run_length) < 0) : (flush_run_pwritev(run_start, run_length) < 0)) {
+            return -1;
+        }
     }
+    return 0;
+}
 
+static int write_segments(const struct iovec* iov, int iov_count, uint32_t first_block, size_t length) {
+    if (pwritev(img_fd, iov, iov_count, (off_t)first_block * geometry.block_size) != (ssize_t)length) {
+        perror("Failed to write dirty blocks");
+        return -1;
+    }
+    add_stat(STAT_BYTES_WRITTEN, length);
     return 0;
 }
 
-#pragma endregion Implementations
\ No newline at end of file
+#pragma endregion Implementations
@@ -0,0 +1,89 @@
+// File:    locks.c
+// Author:  Eric Ekey
+// Date:    10/16/2026
+// Desc:    Namespace and per-file locks for multithreaded mounts.
+
+#define _GNU_SOURCE // Writer preferring rwlocks
+
+#include "locks.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+
+#include "define.h"
+#include "geometry.h"
+
+extern memefs_geometry_t geometry;
+
+// Prefers the writer, so a steady stream of reads and writes can't hold off creates and unlinks forever.
+// Nothing takes it shared twice.
+static pthread_rwlock_t namespace_lock = PTHREAD_RWLOCK_WRITER_NONRECURSIVE_INITIALIZER_NP;
+// Shared by ops changing metadata, exclusive for snapshots. Prefers the writer, so a steady stream of writes
+// can't hold off the flusher or fsync forever. Nothing takes it shared twice, which would deadlock behind a waiting writer.
+static pthread_rwlock_t update_barrier = PTHREAD_RWLOCK_WRITER_NONRECURSIVE_INITIALIZER_NP;
+static pthread_rwlock_t* file_locks; // One per directory entry.
+static int num_file_locks;           // Length of file_locks.
+
+#pragma region Implementations
+
+void begin_update() {
+    pthread_rwlock_rdlock(&update_barrier);
+}
+
+void end_update() {
+    pthread_rwlock_unlock(&update_barrier);
+}
+
+int init_file_locks() {
+    int i;
+
+    for (i = 0; i < num_file_locks; i++) {
+        pthread_rwlock_destroy(&file_locks[i]);
+    }
+    free(file_locks);
+    num_file_locks = 0;
+
+    if ((file_locks = calloc(geometry.max_file_entries, sizeof(pthread_rwlock_t))) == NULL) {
+        return -ENOMEM;
+    }
+    for (i = 0; i < (int)geometry.max_file_entries; i++) {
+        pthread_rwlock_init(&file_locks[i], NULL);
+    }
+    num_file_locks = (int)geometry.max_file_entries;
+    return 0;
+}
+
+void lock_file_read(int entry_index) {
+    pthread_rwlock_rdlock(&file_locks[entry_index]);
+}
+
+void lock_file_write(int entry_index) {
+    pthread_rwlock_wrlock(&file_locks[entry_index]);
+}
+
+void lock_namespace_read() {
+    pthread_rwlock_rdlock(&namespace_lock);
+}
+
+void lock_namespace_write() {
+    pthread_rwlock_wrlock(&namespace_lock);
+}
+
+void quiesce_updates() {
+    pthread_rwlock_wrlock(&update_barrier);
+}
+
+void resume_updates() {
+    pthread_rwlock_unlock(&update_barrier);
+}
+
+void unlock_file(int entry_index) {
+    pthread_rwlock_unlock(&file_locks[entry_index]);
+}
+
+void unlock_namespace() {
+    pthread_rwlock_unlock(&namespace_lock);
+}
+
+#pragma endregion Implementations
\ No newline at end of file
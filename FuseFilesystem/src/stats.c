@@ -0,0 +1,170 @@
+// File:    stats.c
+// Author:  Eric Ekey
+// Date:    10/16/2026
+// Desc:    Op counters, latency histograms and engine counters, read through the virtual stats file.
+
+#include "stats.h"
+
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/statvfs.h>
+#include <unistd.h>
+
+#include "block_cache.h"
+#include "define.h"
+#include "file_ops.h"
+#include "trace.h"
+
+#define STATS_TEXT_SIZE (64 * 1024) // Enough for every op with every latency bucket in use.
+
+// Counters of one op type.
+typedef struct op_counters {
+    uint64_t calls;
+    uint64_t errors;
+    uint64_t bytes;      // Bytes read or written
+    uint64_t latency_ns; // Sum of every call's latency
+    uint64_t buckets[NUM_LATENCY_BUCKETS];
+} op_counters_t;
+
+static op_counters_t op_counters[NUM_TRACE_OPS];
+static uint64_t counters[NUM_STAT_COUNTERS];
+
+static const char* counter_names[NUM_STAT_COUNTERS] = {
+    "fat.allocations", "fat.blocks_allocated", "fat.blocks_freed", "writeback.passes", "writeback.file_flushes",
+    "writeback.journal_commits", "image.syncs", "image.bytes_written"
+};
+
+#pragma region Prototypes
+
+// static void append_text(char*, size_t, size_t*, const char*, ...)
+// Description: Appends formatted text to a buffer, counting what doesn't fit.
+// Preconditions: length is the text's length so far.
+// Postconditions: length includes the new text.
+// Returns: None.
+static void append_text(char* buf, size_t size, size_t* length, const char* format, ...) __attribute__((format(printf, 4, 5)));
+
+// static uint32_t latency_bucket(uint64_t)
+// Description: Gets the histogram bucket of a latency.
+// Preconditions: None.
+// Postconditions: None.
+// Returns: Bucket index, < NUM_LATENCY_BUCKETS.
+static uint32_t latency_bucket(uint64_t latency);
+
+#pragma endregion Prototypes
+
+#pragma region Implementations
+
+void add_stat(stat_counter_t counter, uint64_t amount) {
+    __atomic_fetch_add(&counters[counter], amount, __ATOMIC_RELAXED);
+}
+
+static void append_text(char* buf, size_t size, size_t* length, const char* format, ...) {
+    va_list args;
+    int written;
+
+    va_start(args, format);
+    written = vsnprintf(buf + MIN(*length, size), size - MIN(*length, size), format, args);
+    va_end(args);
+    *length += (size_t)MAX(written, 0);
+}
+
+size_t format_stats(char* buf, size_t size) {
+    memefs_cache_stats_t cache;
+    struct statvfs fs;
+    op_counters_t* op;
+    uint64_t calls, count;
+    size_t length;
+    uint32_t i, k;
+
+    // Counters are read one at a time, so a line may be a little ahead of the one before it.
+    length = 0;
+    for (i = TRACE_FILE + 1; i < NUM_TRACE_OPS; i++) {
+        op = &op_counters[i];
+        if ((calls = __atomic_load_n(&op->calls, __ATOMIC_RELAXED)) == 0) {
+            continue;
+        }
+        append_text(buf, size, &length, "op.%s.calls %llu\n", trace_op_name((trace_op_t)i), (unsigned long long)calls);
+        append_text(buf, size, &length, "op.%s.errors %llu\n", trace_op_name((trace_op_t)i), (unsigned long long)__atomic_load_n(&op->errors, __ATOMIC_RELAXED));
+        if ((i == TRACE_READ) || (i == TRACE_WRITE)) {
+            append_text(buf, size, &length, "op.%s.bytes %llu\n", trace_op_name((trace_op_t)i), (unsigned long long)__atomic_load_n(&op->bytes, __ATOMIC_RELAXED));
+        }
+        append_text(buf, size, &length, "op.%s.latency_us_total %llu\n", trace_op_name((trace_op_t)i),
+                    (unsigned long long)(__atomic_load_n(&op->latency_ns, __ATOMIC_RELAXED) / 1000));
+        for (k = 0; k < NUM_LATENCY_BUCKETS; k++) {
+            if ((count = __atomic_load_n(&op->buckets[k], __ATOMIC_RELAXED)) == 0) {
+                continue;
+            }
+            if (k == NUM_LATENCY_BUCKETS - 1) {
+                append_text(buf, size, &length, "op.%s.latency_us.ge_%llu %llu\n", trace_op_name((trace_op_t)i), 1ull << (k - 1), (unsigned long long)count);
+            } else {
+                append_text(buf, size, &length, "op.%s.latency_us.lt_%llu %llu\n", trace_op_name((trace_op_t)i), 1ull << k, (unsigned long long)count);
+            }
+        }
+    }
+
+    for (i = 0; i < NUM_STAT_COUNTERS; i++) {
+        append_text(buf, size, &length, "%s %llu\n", counter_names[i], (unsigned long long)__atomic_load_n(&counters[i], __ATOMIC_RELAXED));
+    }
+    stat_filesystem(&fs);
+    append_text(buf, size, &length, "fs.blocks %llu\nfs.free_blocks %llu\nfs.entries %llu\nfs.free_entries %llu\n",
+                (unsigned long long)fs.f_blocks, (unsigned long long)fs.f_bfree, (unsigned long long)fs.f_files, (unsigned long long)fs.f_ffree);
+    get_cache_stats(&cache);
+    append_text(buf, size, &length, "cache.hits %llu\ncache.misses %llu\ncache.readahead_blocks %llu\ncache.evictions %llu\n"
+                "cache.dirty_evictions %llu\ncache.resident_blocks %llu\ncache.capacity_blocks %llu\n",
+                (unsigned long long)cache.hits, (unsigned long long)cache.misses, (unsigned long long)cache.readahead_blocks,
+                (unsigned long long)cache.evictions, (unsigned long long)cache.dirty_evictions, (unsigned long long)cache.resident_blocks,
+                (unsigned long long)cache.capacity_blocks);
+    return length;
+}
+
+static uint32_t latency_bucket(uint64_t latency) {
+    uint64_t us;
+
+    us = latency / 1000;
+    if (us == 0) {
+        return 0;
+    }
+    return (uint32_t)MIN((uint64_t)(64 - __builtin_clzll(us)), (uint64_t)(NUM_LATENCY_BUCKETS - 1));
+}
+
+int read_stats(char* buf, size_t size, off_t offset) {
+    size_t length, bytes;
+    char* text;
+
+    if ((text = malloc(STATS_TEXT_SIZE)) == NULL) {
+        return -ENOMEM;
+    }
+    length = MIN(format_stats(text, STATS_TEXT_SIZE), (size_t)STATS_TEXT_SIZE);
+    bytes = ((uint64_t)offset < length) ? MIN(size, length - (size_t)offset) : 0;
+    memcpy(buf, text + (bytes > 0 ? (size_t)offset : 0), bytes);
+    free(text);
+    return (int)bytes;
+}
+
+void record_op_stats(trace_op_t op, uint64_t bytes, int failed, uint64_t latency) {
+    op_counters_t* entry = &op_counters[op];
+
+    __atomic_fetch_add(&entry->calls, 1, __ATOMIC_RELAXED);
+    if (failed) {
+        __atomic_fetch_add(&entry->errors, 1, __ATOMIC_RELAXED);
+    }
+    if (bytes > 0) {
+        __atomic_fetch_add(&entry->bytes, bytes, __ATOMIC_RELAXED);
+    }
+    __atomic_fetch_add(&entry->latency_ns, latency, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&entry->buckets[latency_bucket(latency)], 1, __ATOMIC_RELAXED);
+}
+
+void stat_stats_file(struct stat* stbuf) {
+    memset(stbuf, 0, sizeof(struct stat));
+    stbuf->st_ino = (ino_t)STATS_INODE;
+    stbuf->st_mode = (mode_t)(S_IFREG | 0444);
+    stbuf->st_nlink = (nlink_t)1;
+    stbuf->st_uid = getuid();
+    stbuf->st_gid = getgid();
+}
+
+#pragma endregion Implementations
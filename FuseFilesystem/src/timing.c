@@ -0,0 +1,26 @@
+// File:    timing.c
+// Author:  Eric Ekey
+// Date:    10/16/2026
+// Desc:    Clock and latency sorting shared by the engine's tracing and the benchmark tools.
+
+#include "timing.h"
+
+#include <time.h>
+
+#pragma region Implementations
+
+int compare_ns(const void* a, const void* b) {
+    uint64_t x = *(const uint64_t*)a;
+    uint64_t y = *(const uint64_t*)b;
+
+    return (x > y) - (x < y);
+}
+
+uint64_t monotonic_ns() {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec + 1;
+}
+
+#pragma endregion Implementations
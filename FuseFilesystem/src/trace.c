@@ -0,0 +1,176 @@
+// File:    trace.c
+// Author:  Eric Ekey
+// Date:    10/16/2026
+// Desc:    Times the ops a mount serves, counting them and recording them to a binary trace file for memefs_replay.
+
+#include "trace.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "define.h"
+#include "events.h"
+#include "file_ops.h"
+#include "geometry.h"
+#include "locks.h"
+#include "stats.h"
+#include "timing.h"
+
+#define TRACE_BUFFER_RECORDS 1024 // Records gathered before each write to the trace file.
+
+extern memefs_geometry_t geometry;
+
+static int trace_fd = -1;   // Trace file, -1 when not tracing.
+static uint64_t trace_epoch; // Monotonic time tracing started.
+static memefs_trace_record_t buffer[TRACE_BUFFER_RECORDS];
+static size_t num_buffered;
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER; // Guards buffer and writes to the trace file.
+
+static const char* op_names[NUM_TRACE_OPS] = {
+    "file", "create", "flush", "fsync", "getattr", "lookup", "open", "read", "readdir", "release", "truncate", "unlink", "write", "statfs"
+};
+
+#pragma region Prototypes
+
+// static void append_record(const memefs_trace_record_t*)
+// Description: Adds a record to the buffer, writing the buffer out first if it is full.
+// Preconditions: trace_lock is held. Tracing.
+// Postconditions: Record is buffered.
+// Returns: None.
+static void append_record(const memefs_trace_record_t* record);
+
+// static void flush_records()
+// Description: Writes the buffered records to the trace file.
+// Preconditions: trace_lock is held. Tracing.
+// Postconditions: Buffer is empty. On a write error tracing stops.
+// Returns: None.
+static void flush_records();
+
+#pragma endregion Prototypes
+
+#pragma region Implementations
+
+static void append_record(const memefs_trace_record_t* record) {
+    if (num_buffered == TRACE_BUFFER_RECORDS) {
+        flush_records();
+    }
+    buffer[num_buffered++] = *record;
+}
+
+static void flush_records() {
+    size_t bytes;
+
+    bytes = num_buffered * sizeof(memefs_trace_record_t);
+    num_buffered = 0;
+    if (write(trace_fd, buffer, bytes) != (ssize_t)bytes) {
+        // Losing the trace shouldn't take the mount down with it.
+        perror("Failed to write trace, stopping it");
+        close(trace_fd);
+        trace_fd = -1;
+    }
+}
+
+int start_trace(const char* path) {
+    memefs_trace_header_t header;
+    memefs_trace_record_t record;
+    const char* readable_name;
+    struct stat stbuf;
+    struct timespec now;
+    int fd, i;
+
+    if ((fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0) {
+        perror("Failed to open trace file");
+        return -1;
+    }
+    memset(&header, 0x00, sizeof(header));
+    memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+    header.record_size = sizeof(memefs_trace_record_t);
+    header.block_size = geometry.block_size;
+    header.max_file_entries = geometry.max_file_entries;
+    clock_gettime(CLOCK_REALTIME, &now);
+    header.start_time = (uint64_t)now.tv_sec * 1000000000ull + (uint64_t)now.tv_nsec;
+    if (write(fd, &header, sizeof(header)) != (ssize_t)sizeof(header)) {
+        perror("Failed to write trace file");
+        close(fd);
+        return -1;
+    }
+
+    pthread_mutex_lock(&trace_lock);
+    trace_fd = fd;
+    trace_epoch = monotonic_ns();
+    num_buffered = 0;
+
+    // The files already there, so a replay can start from the same directory.
+    lock_namespace_read();
+    for (i = next_listed_entry(0, &readable_name, &stbuf); (i >= 0) && (trace_fd >= 0); i = next_listed_entry(i + 1, &readable_name, &stbuf)) {
+        memset(&record, 0x00, sizeof(record));
+        record.op = TRACE_FILE;
+        record.slot = i;
+        record.offset = (uint64_t)stbuf.st_size;
+        snprintf(record.name, sizeof(record.name), "%s", readable_name);
+        append_record(&record);
+    }
+    unlock_namespace();
+    pthread_mutex_unlock(&trace_lock);
+    return (trace_fd >= 0) ? 0 : -1;
+}
+
+void stop_trace() {
+    pthread_mutex_lock(&trace_lock);
+    if (trace_fd >= 0) {
+        flush_records();
+    }
+    if (trace_fd >= 0) {
+        close(trace_fd);
+        trace_fd = -1;
+    }
+    pthread_mutex_unlock(&trace_lock);
+}
+
+uint64_t trace_begin() {
+    return monotonic_ns();
+}
+
+void trace_end(trace_op_t op, const char* readable_name, int slot, uint64_t offset, uint64_t size, int result, uint64_t started) {
+    memefs_trace_record_t record;
+    uint64_t latency;
+
+    latency = monotonic_ns() - started;
+    record_op_stats(op, ((op == TRACE_READ) || (op == TRACE_WRITE)) ? (uint64_t)MAX(result, 0) : 0, result < 0, latency);
+    record_op_event(trace_op_name(op), started, latency);
+    // Read without the lock, tracing starts before the first op and stops after the last.
+    if (trace_fd < 0) {
+        return;
+    }
+
+    memset(&record, 0x00, sizeof(record));
+    record.op = (uint8_t)op;
+    record.slot = (slot >= 0) ? slot : -1;
+    record.offset = offset;
+    record.size = (uint32_t)MIN(size, (uint64_t)UINT32_MAX);
+    record.result = result;
+    record.latency = (uint32_t)MIN(latency, (uint64_t)UINT32_MAX);
+    if (readable_name != NULL) {
+        // Names too long to be legal are cut short, the op failed anyway.
+        snprintf(record.name, sizeof(record.name), "%s", readable_name);
+    }
+
+    pthread_mutex_lock(&trace_lock);
+    if (trace_fd >= 0) {
+        record.timestamp = started - trace_epoch;
+        append_record(&record);
+    }
+    pthread_mutex_unlock(&trace_lock);
+}
+
+const char* trace_op_name(trace_op_t op) {
+    return (op < NUM_TRACE_OPS) ? op_names[op] : "unknown";
+}
+
+#pragma endregion Implementations
@@ -9,21 +9,35 @@
 #include <errno.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <time.h>
 
+#include "allocator.h"
+#include "block_cache.h"
+#include "block_map.h"
 #include "define.h"
-
-extern uint16_t main_fat[MAX_FAT_ENTRIES];
-extern uint16_t backup_fat[MAX_FAT_ENTRIES];
-extern uint8_t user_data[USER_DATA_NUM_BLOCKS * BLOCK_SIZE];
-
-// static void clear_fat_chain(const memefs_file_entry_t*)
-// Description: Clears the FAT chain for a given file entry.
-// Preconditions: File entry exists.
-// Postconditions: FAT chain is cleared.
-// Returns: None.
-static void clear_fat_chain(memefs_file_entry_t* file_entry);
+#include "dirty.h"
+#include "events.h"
+#include "geometry.h"
+
+extern memefs_geometry_t geometry;
+extern memefs_file_entry_t* directory;
+
+// static int copy_into_blocks(const uint32_t*, uint32_t, uint64_t, struct fuse_bufvec*, size_t)
+// Description: Copies data into the blocks covering a byte range of a file.
+// Preconditions: Blocks cover the whole range. File is locked for writing. src holds at least size bytes.
+// Postconditions: Range holds the data (zeros if src is NULL) and touched blocks are marked dirty. src is advanced
+//                 past the bytes copied.
+// Returns: 0 on success, < 0 on failure.
+static int copy_into_blocks(const uint32_t* blocks, uint32_t num_blocks, uint64_t file_offset, struct fuse_bufvec* src, size_t size);
+
+// static int extend_fat_chain(int, uint32_t)
+// Description: Links free blocks onto the end of a file's FAT chain.
+// Preconditions: File entry is in use. num_blocks is not 0.
+// Postconditions: Chain is extended by num_blocks zeroed blocks, or left untouched on failure.
+// Returns: 0 on success, < 0 on failure.
+static int extend_fat_chain(int entry_index, uint32_t num_blocks);
 
 // static int from_bcd(uint8_t)
 // Description: Converts a byte from BCD format to decimal.
@@ -42,64 +56,7 @@ static uint8_t to_bcd(uint8_t num);
 #pragma region Implementations
 
 int append_file(memefs_file_entry_t* file_entry, const char* buf, size_t size) {
-    int i, append_start_index, last_block_index, curr_block_index, space_to_write, free_fat_blocks, is_first_block;
-    off_t buffer_offset;
-
-    // Count free FAT blocks.
-    for (i = 0, free_fat_blocks = 0; i < MAX_FAT_ENTRIES; i++) {
-        if (main_fat[i] == 0x0000) {
-            free_fat_blocks++;
-        }
-    }
-
-    last_block_index = (int)file_entry->start_block;
-    while (main_fat[last_block_index] != 0xFFFF) {
-        last_block_index = main_fat[last_block_index];
-    }
-    append_start_index = (last_block_index * BLOCK_SIZE) + (file_entry->size % BLOCK_SIZE);
-    space_to_write = MIN((int)size, BLOCK_SIZE - ((int)file_entry->size % BLOCK_SIZE));
-
-    is_first_block = true;
-    buffer_offset = 0;
-    while ((int)size > 0) {
-        if (free_fat_blocks == 0) {
-            // No more free FAT blocks. Disk is full, cannot continue writing.
-            return -ENOSPC;
-        }
-
-        if (is_first_block) {
-            space_to_write = ((int)size < (BLOCK_SIZE - ((int)file_entry->size % BLOCK_SIZE))) ? size : (BLOCK_SIZE - (file_entry->size % BLOCK_SIZE));
-            is_first_block = false;
-        } else {
-            space_to_write = MIN((int)size, BLOCK_SIZE);
-        }
-
-        // Fill the space in current block.
-        memset(user_data + append_start_index, '\0', space_to_write);
-        memcpy(user_data + append_start_index, buf + buffer_offset, space_to_write);
-        size -= space_to_write;
-        buffer_offset += space_to_write;
-        file_entry->size += space_to_write;
-
-        if ((int)size > 0) {
-            // Add a new FAT block to the chain, updating last_block_index.
-            for (curr_block_index = 0; curr_block_index < MAX_FAT_ENTRIES; curr_block_index++) {
-                if (main_fat[curr_block_index] == 0x0000) {
-                    main_fat[last_block_index] = curr_block_index;
-                    backup_fat[last_block_index] = curr_block_index;
-                    main_fat[curr_block_index] = 0xFFFF;
-                    backup_fat[curr_block_index] = 0xFFFF;
-                    last_block_index = curr_block_index;
-                    free_fat_blocks--;
-                    break;
-                }
-            }
-            // Move append_start_index to next block.
-            append_start_index = last_block_index * BLOCK_SIZE;
-        }
-    }
-
-    return 0;
+    return write_file(file_entry, buf, size, (off_t)file_entry->size);
 }
 
 int check_legal_name(const char* filename) {
@@ -154,25 +111,106 @@ int check_legal_name(const char* filename) {
     return 0;
 }
 
-static void clear_fat_chain(memefs_file_entry_t* file_entry) {
-    uint16_t fat_start_index, curr_blk_index, next_blk_index;
+static int copy_into_blocks(const uint32_t* blocks, uint32_t num_blocks, uint64_t file_offset, struct fuse_bufvec* src, size_t size) {
+    uint32_t block_index, block_offset;
+    size_t space_to_write;
+    struct fuse_bufvec dst;
+    uint8_t* block_data;
+    ssize_t copied;
+    int result;
+
+    block_index = (uint32_t)(file_offset / geometry.block_size);
+    block_offset = (uint32_t)(file_offset % geometry.block_size);
+    while (size > 0) {
+        space_to_write = MIN((size_t)(geometry.block_size - block_offset), size);
+        // Part of a block survives the copy, so only whole blocks skip the read.
+        if ((space_to_write < geometry.block_size) && (block_index < num_blocks)) {
+            prefetch_blocks(blocks, num_blocks, block_index, 1, readahead_window(0));
+        }
+        if ((result = pin_block(blocks[block_index], (space_to_write < geometry.block_size) ? PIN_WRITE : PIN_OVERWRITE, &block_data)) != 0) {
+            return result;
+        }
+        if (src == NULL) {
+            memset(block_data + block_offset, '\0', space_to_write);
+            copied = (ssize_t)space_to_write;
+        } else {
+            // Memory is copied, a pipe spliced from the kernel is read straight into the block.
+            dst = FUSE_BUFVEC_INIT(space_to_write);
+            dst.buf[0].mem = block_data + block_offset;
+            copied = fuse_buf_copy(&dst, src, 0);
+            if (copied != (ssize_t)space_to_write) {
+                // An overwritten frame still holds whatever block it cached before.
+                memset(block_data + block_offset + MAX(copied, 0), '\0', space_to_write - (size_t)MAX(copied, 0));
+            }
+        }
+        mark_data_dirty(blocks[block_index]);
+        unpin_block(blocks[block_index]);
+        if (copied != (ssize_t)space_to_write) {
+            return (copied < 0) ? (int)copied : -EIO;
+        }
+        size -= space_to_write;
+        block_index++;
+        block_offset = 0;
+    }
+    return 0;
+}
+
+static int extend_fat_chain(int entry_index, uint32_t num_blocks) {
+    uint32_t* new_blocks;
+    uint8_t* block_data;
+    int last_block_index, result;
+    uint32_t i;
+
+    if (num_blocks > geometry.user_data_num_blocks) {
+        // More blocks than the disk holds.
+        return -ENOSPC;
+    }
+
+    if ((last_block_index = block_map_tail(entry_index)) < 0) {
+        return last_block_index;
+    }
+
+    if ((new_blocks = malloc((size_t)num_blocks * sizeof(uint32_t))) == NULL) {
+        return -ENOMEM;
+    }
+    if ((result = allocate_blocks(num_blocks, (uint32_t)last_block_index, new_blocks)) != 0) {
+        // Disk is full, leave the chain untouched.
+        free(new_blocks);
+        return result;
+    }
 
-    fat_start_index = file_entry->start_block;
-    for (curr_blk_index = fat_start_index, next_blk_index = main_fat[fat_start_index]; curr_blk_index != 0xFFFF; curr_blk_index = next_blk_index) {
-        next_blk_index = main_fat[curr_blk_index];
-        main_fat[curr_blk_index] = 0x0000;
-        backup_fat[curr_blk_index] = 0x0000;
+    // Chain the new blocks to each other and zero them, so holes read back as zeros, before the file can see them.
+    for (i = 0; i < num_blocks; i++) {
+        set_fat_entry(new_blocks[i], (i + 1 < num_blocks) ? new_blocks[i + 1] : FAT_END_OF_CHAIN);
+    }
+    for (i = 0; (i < num_blocks) && (result == 0); i++) {
+        if ((result = pin_block(new_blocks[i], PIN_OVERWRITE, &block_data)) == 0) {
+            memset(block_data, '\0', geometry.block_size);
+            mark_data_dirty(new_blocks[i]);
+            unpin_block(new_blocks[i]);
+        }
+    }
+    if (result != 0) {
+        // Not linked to the file yet, give the blocks back and leave the chain untouched.
+        free_chain(new_blocks[0]);
+        free(new_blocks);
+        return result;
     }
-    main_fat[fat_start_index] = 0xFFFF;
-    backup_fat[fat_start_index] = 0xFFFF;
-    file_entry->size = 0;
+
+    set_fat_entry((uint32_t)last_block_index, new_blocks[0]);
+    for (i = 0; i < num_blocks; i++) {
+        block_map_append(entry_index, new_blocks[i]);
+    }
+
+    free(new_blocks);
+    return 0;
 }
 
 static int from_bcd(uint8_t bcd) {
     return (((bcd >> 4) * 10) + (bcd & 0x0F));
 }
 
-void generate_memefs_timestamp(uint8_t bcd_time[8]) {
+time_t generate_memefs_timestamp(uint8_t bcd_time[8]) {
 	time_t now = time(NULL);
 	struct tm utc;
     int full_year;
@@ -187,6 +225,7 @@ void generate_memefs_timestamp(uint8_t bcd_time[8]) {
 	bcd_time[5] = to_bcd(utc.tm_min);      	// Minute
 	bcd_time[6] = to_bcd(utc.tm_sec);      	// Second
 	bcd_time[7] = 0x00;                         	// Unused (reserved)
+	return now;
 }
 
 time_t memefs_bcd_to_time(const uint8_t bcd_time[8]) {
@@ -232,7 +271,7 @@ void name_to_encoded(const char* readable_name, char* encoded_name) {
     }
 
     memcpy(filename, readable_name, i);
-    memcpy(extension, readable_name + i + 1, 3);
+    strncpy(extension, readable_name + i + 1, 3);
 
     memcpy(encoded_name, filename, 8);
     memcpy(encoded_name + 8, extension, 3);
@@ -246,17 +285,13 @@ void name_to_readable(const char* name, char* readable_name) {
     memset(extension, '\0', 4);
     memset(readable_name, '\0', MAX_READABLE_FILENAME_LENGTH);
 
+    // The extension isn't NUL terminated, start_block_high follows it on v2 images.
     memcpy(filename, name, 8);
-    strcpy(extension, name + 8);
+    memcpy(extension, name + 8, 3);
 
     snprintf(readable_name, MAX_READABLE_FILENAME_LENGTH, "%s.%s", filename, extension);
 }
 
-int overwrite_file(memefs_file_entry_t* file_entry, const char* buf, size_t size) {
-    clear_fat_chain(file_entry);
-    return append_file(file_entry, buf, size);
-}
-
 static uint8_t to_bcd(uint8_t num) {
 	if (num > 99) {
         return 0xFF;
@@ -264,4 +299,115 @@ static uint8_t to_bcd(uint8_t num) {
 	return (((num / 10) << 4) | (num % 10));
 }
 
+int truncate_file(memefs_file_entry_t* file_entry, off_t new_size) {
+    int entry_index, result;
+    const uint32_t* blocks;
+    uint32_t num_blocks, blocks_needed;
+
+    if (new_size < 0) {
+        return -EINVAL;
+    }
+    if ((uint64_t)new_size > UINT32_MAX) {
+        // File size field is 32 bits.
+        return -EFBIG;
+    }
+
+    entry_index = (int)(file_entry - directory);
+    if ((blocks = get_block_map(entry_index, &num_blocks)) == NULL) {
+        return -EIO;
+    }
+
+    blocks_needed = (uint32_t)(((uint64_t)new_size + geometry.block_size - 1) / geometry.block_size);
+    if (blocks_needed == 0) {
+        // Even empty files take up a FAT block.
+        blocks_needed = 1;
+    }
+
+    if (blocks_needed < num_blocks) {
+        // Release blocks after the new end of chain.
+        free_chain(blocks[blocks_needed]);
+        set_fat_entry(blocks[blocks_needed - 1], FAT_END_OF_CHAIN);
+        invalidate_block_map(entry_index);
+    } else if (blocks_needed > num_blocks) {
+        if ((result = extend_fat_chain(entry_index, blocks_needed - num_blocks)) != 0) {
+            return result;
+        }
+        if ((blocks = get_block_map(entry_index, &num_blocks)) == NULL) {
+            return -EIO;
+        }
+    }
+
+    if ((uint64_t)new_size > file_entry->size) {
+        // Growing exposes bytes past the old EOF, zero them.
+        if ((result = copy_into_blocks(blocks, num_blocks, file_entry->size, NULL, (size_t)((uint64_t)new_size - file_entry->size))) != 0) {
+            return result;
+        }
+    }
+
+    file_entry->size = (uint32_t)new_size;
+    mark_directory_dirty(file_entry);
+    return 0;
+}
+
+int write_file(memefs_file_entry_t* file_entry, const char* buf, size_t size, off_t offset) {
+    struct fuse_bufvec src = FUSE_BUFVEC_INIT(size);
+
+    src.buf[0].mem = (void*)buf;
+    return write_file_buf(file_entry, &src, offset);
+}
+
+int write_file_buf(memefs_file_entry_t* file_entry, struct fuse_bufvec* src, off_t offset) {
+    int entry_index, result;
+    size_t size;
+    const uint32_t* blocks;
+    uint32_t num_blocks, blocks_needed;
+    uint64_t end_offset, started;
+
+    if (offset < 0) {
+        return -EINVAL;
+    }
+
+    entry_index = (int)(file_entry - directory);
+    size = fuse_buf_size(src);
+    end_offset = (uint64_t)offset + size;
+    if (end_offset > UINT32_MAX) {
+        // File size field is 32 bits.
+        return -EFBIG;
+    }
+
+    if ((blocks = get_block_map(entry_index, &num_blocks)) == NULL) {
+        return -EIO;
+    }
+
+    // Extend the chain only if the write runs past the blocks already held.
+    blocks_needed = (uint32_t)((end_offset + geometry.block_size - 1) / geometry.block_size);
+    if (blocks_needed > num_blocks) {
+        if ((result = extend_fat_chain(entry_index, blocks_needed - num_blocks)) != 0) {
+            return result;
+        }
+        if ((blocks = get_block_map(entry_index, &num_blocks)) == NULL) {
+            return -EIO;
+        }
+    }
+
+    if ((uint64_t)offset > file_entry->size) {
+        // Zero the gap between the old EOF and the write.
+        if ((result = copy_into_blocks(blocks, num_blocks, file_entry->size, NULL, (size_t)((uint64_t)offset - file_entry->size))) != 0) {
+            return result;
+        }
+    }
+    started = event_begin();
+    result = copy_into_blocks(blocks, num_blocks, (uint64_t)offset, src, size);
+    event_end(PHASE_COPY, started);
+    if (result != 0) {
+        return result;
+    }
+
+    if (end_offset > file_entry->size) {
+        file_entry->size = (uint32_t)end_offset;
+    }
+    mark_directory_dirty(file_entry);
+    return 0;
+}
+
 #pragma endregion Implementations
\ No newline at end of file
@@ -0,0 +1,204 @@
+// File:    writeback.c
+// Author:  Eric Ekey
+// Date:    10/16/2026
+// Desc:    Durability modes and the background flusher.
+
+#include "writeback.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "block_map.h"
+#include "define.h"
+#include "dirty.h"
+#include "geometry.h"
+#include "loaders.h"
+#include "memefs_file_entry.h"
+#include "stats.h"
+
+#define DEFAULT_DIRTY_LIMIT (64 * 1024)
+#define DEFAULT_FLUSH_INTERVAL 5000
+
+extern memefs_geometry_t geometry;
+extern memefs_file_entry_t* directory;
+
+static durability_t durability = DURABILITY_STANDARD;
+static uint32_t dirty_limit = DEFAULT_DIRTY_LIMIT;       // Dirty bytes that wake the flusher early.
+static uint32_t flush_interval = DEFAULT_FLUSH_INTERVAL; // Milliseconds between writebacks.
+
+static pthread_mutex_t flusher_lock = PTHREAD_MUTEX_INITIALIZER; // Guards the flusher state below.
+static pthread_cond_t flusher_wake = PTHREAD_COND_INITIALIZER;
+static pthread_t flusher_thread;
+static int flusher_running;
+static int flusher_kicked;   // Dirty limit was reached since the last writeback.
+static int flusher_stopping;
+
+#pragma region Prototypes
+
+// static void* flusher_main(void*)
+// Description: Writes back dirty blocks every interval, or sooner when kicked.
+// Preconditions: None.
+// Postconditions: Returns once stop_flusher is called.
+// Returns: NULL.
+static void* flusher_main(void* arg);
+
+#pragma endregion Prototypes
+
+#pragma region Implementations
+
+int commit_update() {
+    if (durability == DURABILITY_SYNC) {
+        return ((unload_image() != 0) || (sync_image(1) != 0)) ? -1 : 0;
+    }
+
+    if ((uint64_t)dirty_block_count() * geometry.block_size < dirty_limit) {
+        // Leave it for the flusher.
+        return 0;
+    }
+
+    pthread_mutex_lock(&flusher_lock);
+    if (flusher_running) {
+        flusher_kicked = 1;
+        pthread_cond_signal(&flusher_wake);
+        pthread_mutex_unlock(&flusher_lock);
+        return 0;
+    }
+    pthread_mutex_unlock(&flusher_lock);
+
+    // No flusher to hand off to, write back here.
+    return unload_image();
+}
+
+int flush_file(int entry_index, int datasync) {
+    const uint32_t* blocks;
+    dirty_set_t file_blocks;
+    uint32_t i, num_blocks;
+    int result;
+
+    if ((blocks = get_block_map(entry_index, &num_blocks)) == NULL) {
+        return -1;
+    }
+    if (init_dirty_set(&file_blocks) != 0) {
+        return -1;
+    }
+    add_stat(STAT_FILE_FLUSHES, 1);
+
+    for (i = 0; i < num_blocks; i++) {
+        add_to_dirty_set(&file_blocks, geometry.user_data_begin + blocks[i]);
+    }
+    add_to_dirty_set(&file_blocks, geometry.directory_begin + (uint32_t)(((uint64_t)entry_index * FILE_ENTRY_SIZE) / geometry.block_size));
+    // Every FAT block, since blocks freed by a truncate sit outside the chain. Only dirty ones are written.
+    for (i = 0; i < geometry.fat_num_blocks; i++) {
+        add_to_dirty_set(&file_blocks, geometry.fat_backup_begin + i);
+        add_to_dirty_set(&file_blocks, geometry.fat_main_begin + i);
+    }
+    add_to_dirty_set(&file_blocks, geometry.superblock_backup);
+    add_to_dirty_set(&file_blocks, geometry.superblock_main);
+
+    result = ((unload_blocks(&file_blocks) != 0) || (sync_image(datasync) != 0)) ? -1 : 0;
+    free_dirty_set(&file_blocks);
+    return result;
+}
+
+static void* flusher_main(void* arg) {
+    (void) arg;
+    struct timespec deadline;
+
+    pthread_mutex_lock(&flusher_lock);
+    while (!flusher_stopping) {
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_sec += flush_interval / 1000;
+        deadline.tv_nsec += (long)(flush_interval % 1000) * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+        while (!flusher_stopping && !flusher_kicked) {
+            if (pthread_cond_timedwait(&flusher_wake, &flusher_lock, &deadline) == ETIMEDOUT) {
+                break;
+            }
+        }
+        flusher_kicked = 0;
+        pthread_mutex_unlock(&flusher_lock);
+
+        if ((dirty_block_count() > 0) && (unload_image() != 0)) {
+            // Blocks stay dirty, try again next time.
+            fprintf(stderr, "Flusher failed to write back dirty blocks\n");
+        }
+
+        pthread_mutex_lock(&flusher_lock);
+    }
+    pthread_mutex_unlock(&flusher_lock);
+
+    return NULL;
+}
+
+durability_t get_durability() {
+    return durability;
+}
+
+void set_dirty_limit(uint32_t bytes) {
+    dirty_limit = bytes;
+}
+
+int set_durability(const char* name) {
+    if (strcmp(name, "sync") == 0) {
+        durability = DURABILITY_SYNC;
+    } else if (strcmp(name, "standard") == 0) {
+        durability = DURABILITY_STANDARD;
+    } else if (strcmp(name, "relaxed") == 0) {
+        durability = DURABILITY_RELAXED;
+    } else {
+        return -EINVAL;
+    }
+    return 0;
+}
+
+void set_flush_interval(uint32_t milliseconds) {
+    flush_interval = (milliseconds == 0) ? 1 : milliseconds;
+}
+
+int start_flusher() {
+    int result;
+
+    if (durability == DURABILITY_SYNC) {
+        // Nothing is left dirty between ops.
+        return 0;
+    }
+
+    pthread_mutex_lock(&flusher_lock);
+    flusher_stopping = 0;
+    flusher_kicked = 0;
+    result = pthread_create(&flusher_thread, NULL, flusher_main, NULL);
+    flusher_running = (result == 0);
+    pthread_mutex_unlock(&flusher_lock);
+
+    if (result != 0) {
+        fprintf(stderr, "Failed to start flusher: %s\n", strerror(result));
+        return -1;
+    }
+    return 0;
+}
+
+void stop_flusher() {
+    pthread_mutex_lock(&flusher_lock);
+    if (!flusher_running) {
+        pthread_mutex_unlock(&flusher_lock);
+        return;
+    }
+    flusher_stopping = 1;
+    pthread_cond_signal(&flusher_wake);
+    pthread_mutex_unlock(&flusher_lock);
+
+    pthread_join(flusher_thread, NULL);
+
+    pthread_mutex_lock(&flusher_lock);
+    flusher_running = 0;
+    pthread_mutex_unlock(&flusher_lock);
+}
+
+#pragma endregion Implementations
\ No newline at end of file
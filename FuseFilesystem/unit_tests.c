@@ -1,130 +1,58 @@
-#include "define.h"
-#include <stdlib.h>
+// Checks the name helpers of src/utils.c. Built against the engine sources as memefs_bench is:
+// gcc -Iinclude -o unit_tests unit_tests.c src/*.c -lfuse3 -lpthread && ./unit_tests
+// Exits 0 if every check passes, 1 otherwise.
+
+#include <errno.h>
 #include <stdio.h>
 #include <string.h>
-#include <errno.h>
-#include <ctype.h>
-
-void name_to_readable(const char* name, char* readable_name) {
-    char filename[9];
-    char extension[4];
-
-    memset(filename, '\0', 9);
-    memset(extension, '\0', 4);
-    memset(readable_name, '\0', MAX_READABLE_FILENAME_LENGTH);
-
-    memcpy(filename, name, 8);
-    strcpy(extension, name + 8);
-
-    snprintf(readable_name, MAX_READABLE_FILENAME_LENGTH, "%s.%s", filename, extension);
-}
-
-void name_to_encoded(const char* readable_name, char* encoded_name) {
-    char filename[9];
-    char extension[4];
-    int i;
-
-    memset(encoded_name, '\0', MAX_ENCODED_FILENAME_LENGTH);
-    memset(filename, '\0', 9);
-    memset(extension, '\0', 4);
-
-    // Get index of '.'
-    for (i = 0; i < 8; i++) {
-        if (readable_name[i] == '.') {
-            break;
-        }
-    }
-
-    memcpy(filename, readable_name, i);
-    memcpy(extension, readable_name + i + 1, 3);
-
-    memcpy(encoded_name, filename, 8);
-    memcpy(encoded_name + 8, extension, 3);
-}
-int check_legal_name(const char* path) {
-    int i, j;
 
-    printf("strlen %d\n", strlen(path + 1));
-    if (strlen(path + 1) >= MAX_READABLE_FILENAME_LENGTH) {
-        // File name too long.
-        printf("catch path too long\n");
-        return -ENAMETOOLONG;
-    }
+#include "define.h"
+#include "utils.h"
 
-    // Check filename for illegal characters or too long.
-    for (i = 0; ((path + 1)[i] != '.') && ((path + 1)[i] != '\0'); i++) {
-        if (i > 7) {
-            // Too many characters before '.'
-            printf("catch too many chars before dot\n");
-            return -ENAMETOOLONG;
-        }
+// A name and what check_legal_name should make of it.
+typedef struct name_case {
+    const char* filename;
+    int expected;
+} name_case_t;
 
-        if (!isalnum((path + 1)[i]) && ((path + 1)[i] != '^') && ((path + 1)[i] != '-') && ((path + 1)[i] != '_') && ((path + 1)[i] != '=') && ((path + 1)[i] != '|')) {
-            // Invalid character in file name.
-            printf("catch bad char in filename\n");
-            return -EINVAL;
-        }
-    }
-
-    if ((path + 1)[i] == '\0') {
-        // No '.' in filename.
-        printf("catch no dot\n");
-        return -EINVAL;
+int main() {
+    static const name_case_t name_cases[] = {
+        { "nametoolo.ng", -ENAMETOOLONG },
+        { "ext.toolong", -ENAMETOOLONG },
+        { "pathtoolong.txt", -ENAMETOOLONG },
+        { "bad(name.txt", -EINVAL },
+        { "bade.x(t", -EINVAL },
+        { "valid.txt", 0 },
+        { "nodot", -EINVAL },
+        { "goodname.md", 0 },
+        { "longnamew.txt", -ENAMETOOLONG },
+        { "longnamewithdot.txt", -ENAMETOOLONG },
+    };
+    char entry_name[MAX_ENCODED_FILENAME_LENGTH + 1];
+    char readable_name[MAX_READABLE_FILENAME_LENGTH];
+    char encoded_name[MAX_ENCODED_FILENAME_LENGTH];
+    size_t i;
+    int result, failures;
+
+    failures = 0;
+
+    // Round trip with a v2 start_block_high byte right after the extension, as for start block 65536 or higher.
+    name_to_encoded("small.txt", entry_name);
+    entry_name[MAX_ENCODED_FILENAME_LENGTH] = 0x01;
+    name_to_readable(entry_name, readable_name);
+    name_to_encoded(readable_name, encoded_name);
+    if ((strcmp(readable_name, "small.txt") != 0) || (memcmp(encoded_name, entry_name, MAX_ENCODED_FILENAME_LENGTH) != 0)) {
+        printf("FAIL name round trip: got %s\n", readable_name);
+        failures++;
     }
 
-    // Check extension for illegal characters or too long.
-    for (j = 0; (path + 1 + i + 1)[j] != '\0'; j++) {
-        if (j > 2) {
-            // Too many characters after '.'
-            printf("catch too many chars after dot\n");
-            return -ENAMETOOLONG;
-        }
-
-        if (!isalnum((path + 1 + i + 1)[j]) && ((path + 1 + i + 1)[j] != '^') && ((path + 1 + i + 1)[j] != '-') && ((path + 1 + i + 1)[j] != '_') && ((path + 1 + i + 1)[j] != '=') && ((path + 1 + i + 1)[j] != '|')) {
-            // Invalid character in file extension.
-            printf("catch bad char in extension\n");
-            return -EINVAL;
+    for (i = 0; i < sizeof(name_cases) / sizeof(name_cases[0]); i++) {
+        if ((result = check_legal_name(name_cases[i].filename)) != name_cases[i].expected) {
+            printf("FAIL check_legal_name(\"%s\"): got %d, expected %d\n", name_cases[i].filename, result, name_cases[i].expected);
+            failures++;
         }
     }
 
-    return 0;
+    printf("%d failed\n", failures);
+    return (failures == 0) ? 0 : 1;
 }
-
-int main() {
-
-    // char name[11] = "filenam\0md";
-    // char readable_name[MAX_READABLE_FILENAME_LENGTH];
-    // name_to_readable(name, readable_name);
-    // printf("%s\n", readable_name);
-
-    // char encoded_name[MAX_ENCODED_FILENAME_LENGTH];
-    // name_to_encoded(readable_name, encoded_name);
-    // for (int i = 0; i < 11; i++) {
-    //     printf("%c", (encoded_name[i] == '\0') ? '0' : encoded_name[i]);
-    // }
-
-
-    char* path = "/nametoolo.ng";
-    char* path2 = "/ext.toolong";
-    char* path3 = "/pathtoolong.txt";
-    char* path4 = "/bad(name.txt";
-    char* path5 = "/bade.x(t";
-    char* path6 = "/valid.txt";
-    char* path7 = "/nodot";
-    char* path8 = "/goodname.md"; 
-    char* path9 = "/longnamew.txt";
-    char* path10 = "/longnamewithdot.txt";
-    printf("%d\n", check_legal_name(path));
-    printf("%d\n", check_legal_name(path2));
-    printf("%d\n", check_legal_name(path3));
-    printf("%d\n", check_legal_name(path4));
-    printf("%d\n", check_legal_name(path5));
-    printf("%d\n", check_legal_name(path6));
-    printf("%d\n", check_legal_name(path7));
-    printf("%d\n", check_legal_name(path8));
-    printf("%d\n", check_legal_name(path9));
-    printf("%d\n", check_legal_name(path10));
-
-
-    return 0;
-}
\ No newline at end of file